@@ -0,0 +1,51 @@
+/*
+ * Header file for heat relay interface
+ */
+
+#ifndef ACTUATOR_H_
+#define ACTUATOR_H_
+
+#include <stdbool.h>
+
+struct actuator_str;
+
+/* backend operations */
+struct actuator_ops_str {
+	const char *name;
+	int (*set)(struct actuator_str *actuator, bool on);
+	int (*close)(struct actuator_str *actuator);
+};
+
+struct actuator_str {
+	const struct actuator_ops_str *ops;
+	bool state;		/* last value set */
+	unsigned long switch_count;
+	void *priv;		/* backend private data */
+};
+
+/* inlines */
+
+static inline int actuator_close(struct actuator_str *actuator)
+{
+	return actuator->ops->close(actuator);
+}
+
+/*
+ * public function prototypes
+ */
+
+/* set relay, maintaining state and switch count */
+int
+actuator_set(struct actuator_str *actuator, bool on);
+
+/* libgpiod output line, initially off */
+int
+actuator_open_gpiod(struct actuator_str *actuator,
+		    const char *gpio_device, unsigned offset,
+		    bool active_low);
+
+/* in-memory relay, no hardware */
+int
+actuator_open_fake(struct actuator_str *actuator);
+
+#endif
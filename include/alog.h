@@ -0,0 +1,69 @@
+/*
+ * Header file for alog module: syslog off the control loop.
+ *
+ * ALOG() formats the message and queues it on a lock-free ring; a
+ * background thread hands it to syslog.  each call site may log
+ * ALOG_BURST messages per ALOG_INTERVAL seconds, the rest are counted
+ * and summarized once the interval is over.
+ */
+
+#ifndef ALOG_H_
+#define ALOG_H_
+
+#include <stdbool.h>
+#include <syslog.h>
+#include <time.h>
+
+#ifndef ALOG_RING
+#define ALOG_RING 64		/* queued messages, power of 2 */
+#endif
+
+#ifndef ALOG_MSG_MAX
+#define ALOG_MSG_MAX 200
+#endif
+
+#ifndef ALOG_BURST
+#define ALOG_BURST 5		/* messages per site per interval */
+#endif
+
+#ifndef ALOG_INTERVAL
+#define ALOG_INTERVAL 60	/* seconds */
+#endif
+
+/* rate limit state, one per ALOG() call site */
+struct alog_site_str {
+	const char *file;
+	int line;
+	int prio;		/* of the last message, for the summary */
+	time_t window;		/* start of the current interval */
+	unsigned count;		/* messages this interval */
+	unsigned long suppressed;
+	bool listed;		/* on the summary list */
+	struct alog_site_str *next;
+};
+
+#define ALOG(prio, ...)							\
+	do {								\
+		static struct alog_site_str alog_site_ = {		\
+			.file = __FILE__, .line = __LINE__ };		\
+		alog_post(&alog_site_, (prio), __VA_ARGS__);		\
+	} while (0)
+
+/*
+ * public function prototypes
+ */
+
+/* start the syslog thread.  until then, ALOG() calls syslog directly */
+int
+alog_start(void);
+
+/* rate limit (unless site is NULL), format and queue one message */
+void
+alog_post(struct alog_site_str *site, int prio, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/* log what is queued, summarize suppressed messages, join the thread */
+void
+alog_stop(void);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Header file for archive module: background compression and
+ * retention of closed dayfiles.
+ *
+ * closed dayfiles (.dat, .bin) and daily rollups (.min, .hr) are
+ * gzipped.  retention removes whole days, the year's rollup
+ * (YYYY.day) going with its last day.  keep_bytes counts every file,
+ * the journal and model included, but never removes those two, which
+ * are small and the only copy of what they hold, nor rollups of the
+ * last ARCHIVE_ROLLUP_DAYS.
+ */
+
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifndef ARCHIVE_ROLLUP_DAYS
+#define ARCHIVE_ROLLUP_DAYS 30
+#endif
+
+struct archive_str {
+	const char *data_dir;
+	bool compress;		/* gzip closed dayfiles */
+	int keep_days;		/* zero: keep forever */
+	long long keep_bytes;	/* zero: no size limit */
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool pending;		/* day rolled over, work to do */
+	bool stop;
+	struct tm today;	/* date of the active dayfile */
+};
+
+/*
+ * public function prototypes
+ */
+
+/* start the archive thread, nothing to do unless data_dir is set */
+int
+archive_start(struct archive_str *archive);
+
+/* the active dayfile is now for today: older days are closed */
+void
+archive_notify(struct archive_str *archive, const struct tm *today);
+
+/* finish pending work and join the thread */
+void
+archive_stop(struct archive_str *archive);
+
+#endif
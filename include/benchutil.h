@@ -0,0 +1,22 @@
+/*
+ * Header file for benchmark support
+ */
+
+#ifndef BENCHUTIL_H_
+#define BENCHUTIL_H_
+
+#include <time.h>
+
+/*
+ * public function prototypes
+ */
+
+/* number of malloc, calloc and realloc calls so far */
+unsigned long
+bench_alloc_count(void);
+
+/* monotonic nanoseconds since start */
+long long
+bench_elapsed_ns(const struct timespec *start);
+
+#endif
@@ -4,26 +4,52 @@
 #define CFGFILE_H_
 
 #include <stddef.h>
+#include <stdbool.h>
+
+#include "pid.h"
 
 #ifndef SCHED_MAX_EVENTS
 #define SCHED_MAX_EVENTS 100
 #endif
 
+#ifndef SCHED_MAX_PROFILES
+#define SCHED_MAX_PROFILES 8	/* the schedule, plus named profiles */
+#endif
+
+#define PROFILE_NAME_MAX 32
+#define PROFILE_DEFAULT "default"	/* the top-level schedule */
+
 enum units_enum {
 	UNITS_DEGC,
 	UNITS_DEGF,
 	UNITS_AUTO
 };
 
+enum ctrl_mode_enum {
+	CTRL_BANG,		/* on/off with hysteresis */
+	CTRL_PID		/* PID, time-proportioned */
+};
+
 struct event_str {
 	long sow;                   /* second of week */
 	double setpoint_degc;       /* setpoint */
 };
 
-struct cfg_data_str {
-	enum units_enum units;
+/* a compiled schedule, events sorted by sow */
+struct profile_str {
+	char name[PROFILE_NAME_MAX];
 	size_t num_events;
 	struct event_str event[SCHED_MAX_EVENTS];
+};
+
+struct cfg_data_str {
+	enum units_enum units;
+	size_t num_profiles;
+	struct profile_str profile[SCHED_MAX_PROFILES];	/* [0]: default */
+	enum ctrl_mode_enum mode;
+	struct pid_cfg_str pid;   /* used in CTRL_PID mode */
+	bool optimal_start;       /* preheat for the next event */
+	int max_lead;             /* seconds, earliest preheat */
 	const char *fname;        /* need to check for config file updates */
 	time_t mtime;	          /* config file time of last modification */
 };
@@ -0,0 +1,55 @@
+/*
+ * Header file for cycle module: keeps the relay from short cycling.
+ * minimum on and off times and a cap on starts per hour, timed on the
+ * control (monotonic) clock.  a switch held back is deferred, not
+ * dropped: the controller asks again each second.
+ */
+
+#ifndef CYCLE_H_
+#define CYCLE_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifndef CYCLE_MAX_PER_HOUR
+#define CYCLE_MAX_PER_HOUR 60	/* upper bound for max_per_hour */
+#endif
+
+#ifndef CYCLE_REPORT
+#define CYCLE_REPORT 3600	/* seconds between deferral reports */
+#endif
+
+struct cycle_str {
+	int min_on;		/* seconds, zero: no limit */
+	int min_off;		/* seconds, zero: no limit */
+	int max_per_hour;	/* relay starts, zero: no limit */
+	/* private */
+	bool switched;		/* last_switch is valid */
+	time_t last_switch;
+	time_t starts[CYCLE_MAX_PER_HOUR];	/* ring of start times */
+	unsigned num_starts;
+	bool deferring;		/* holding back a switch now */
+	unsigned long deferred;	/* switches held back, since report */
+};
+
+/*
+ * public function prototypes
+ */
+
+/* limits set by the caller, clear the rest */
+void
+cycle_init(struct cycle_str *cycle);
+
+/* may the relay go from on to want at now?  counts and logs refusals */
+bool
+cycle_allow(struct cycle_str *cycle, bool on, bool want, time_t now);
+
+/* the relay did switch */
+void
+cycle_switched(struct cycle_str *cycle, bool on, time_t now);
+
+/* log and reset */
+void
+cycle_report(struct cycle_str *cycle);
+
+#endif
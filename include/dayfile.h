@@ -0,0 +1,71 @@
+/*
+ * Header file for dayfile reader: parses records written by log_data()
+ * and the dat sink, or by the bin sink (YYYYMMDD.bin)
+ */
+
+#ifndef DAYFILE_H_
+#define DAYFILE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * one record:
+ *   seq sec nsec wday YYYYMMDDhhmmss temp temp_avg setpoint heat hold
+ *   override advance
+ * temperatures are in the logged units (deg F or deg C)
+ */
+struct dayrec_str {
+	unsigned long sequence;
+	time_t sec;
+	long nsec;
+	int wday;
+	long long datetime;	/* YYYYMMDDhhmmss, local time */
+	double temp;
+	double temp_avg;
+	double setpoint;
+	bool heat;
+	bool hold;
+	bool override;
+	bool advance;
+};
+
+/*
+ * public function prototypes
+ */
+
+/*
+ * parse the text record starting at *pos, ending before end.
+ * *pos is always advanced past the line.
+ * returns 0 on success, -1 for a malformed line
+ */
+int
+dayfile_parse_line(const char **pos, const char *end, struct dayrec_str *rec);
+
+/*
+ * parse the bin sink record at *pos, as dayfile_parse_line() does a
+ * text one.  wday and datetime are the reader's local time.
+ */
+int
+dayfile_parse_bin(const char **pos, const char *end, struct dayrec_str *rec);
+
+/* YYYYMMDD.bin or YYYYMMDD.bin.gz */
+bool
+dayfile_is_bin(const char *path);
+
+/*
+ * read a dayfile, plain or gzipped, from uncompressed offset start,
+ * handing whole lines (or rec_size records, if not zero) to chunk()
+ * a buffer at a time.  base is the uncompressed offset of buf.
+ * chunk() returns nonzero to stop early.
+ * returns 0 on success, -1 on error
+ */
+int
+dayfile_stream(const char *path, off_t start, size_t rec_size,
+	       int (*chunk)(const char *buf, size_t len, off_t base,
+			    void *arg),
+	       void *arg);
+
+#endif
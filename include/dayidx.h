@@ -0,0 +1,47 @@
+/*
+ * Header file for dayfile index: byte offset of the first record
+ * of each minute, kept in a sidecar next to the dayfile named for it
+ * in full: YYYYMMDD.dat.idx, YYYYMMDD.bin.idx
+ */
+
+#ifndef DAYIDX_H_
+#define DAYIDX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define DAYIDX_ENTRIES (24 * 60)
+#define DAYIDX_NONE UINT32_MAX	/* no record in this minute */
+
+/*
+ * public function prototypes
+ */
+
+/*
+ * note that the record at offset in data_dir/dayfile_name is the
+ * first of minute of day (local).  entries already set are left
+ * alone.
+ */
+int
+dayidx_mark(const char *data_dir, const char *dayfile_name, int minute,
+	    uint32_t offset);
+
+/* build index from dayfile contents, bin sink records if bin */
+void
+dayidx_build(const char *buf, size_t len, bool bin,
+	     uint32_t idx[DAYIDX_ENTRIES]);
+
+/*
+ * load index for the dayfile at path, rebuilding and saving it
+ * if missing or damaged
+ */
+int
+dayidx_load(const char *dayfile_path, uint32_t idx[DAYIDX_ENTRIES]);
+
+/* offset to start scanning for records at or after minute of day */
+uint32_t
+dayidx_seek(const uint32_t idx[DAYIDX_ENTRIES], int minute);
+
+#endif
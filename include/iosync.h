@@ -0,0 +1,51 @@
+/*
+ * Header file for iosync module: an I/O thread that runs fdatasync
+ * (and the close that follows it) off the control loop
+ */
+
+#ifndef IOSYNC_H_
+#define IOSYNC_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifndef IOSYNC_QUEUE
+#define IOSYNC_QUEUE 32
+#endif
+
+struct iosync_req_str {
+	int fd;
+	bool close;		/* close once synced */
+};
+
+struct iosync_str {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct iosync_req_str req[IOSYNC_QUEUE];
+	unsigned head;		/* oldest request */
+	unsigned len;
+	bool running;
+	bool stop;
+	unsigned long dropped;	/* queue full: syncs skipped */
+};
+
+/*
+ * public function prototypes
+ */
+
+int
+iosync_start(struct iosync_str *iosync);
+
+/*
+ * queue fdatasync(fd), never blocking on the disk.  with close_after,
+ * the fd belongs to the I/O thread from here on.
+ */
+void
+iosync_request(struct iosync_str *iosync, int fd, bool close_after);
+
+/* finish queued requests and join the thread */
+void
+iosync_stop(struct iosync_str *iosync);
+
+#endif
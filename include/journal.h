@@ -0,0 +1,105 @@
+/*
+ * Header file for journal module: append-only binary log of state
+ * transitions (relay, HOLD/OVERRIDE/ADVANCE/RESUME, schedule events,
+ * config reloads, clock steps, sensor faults, profile switches), and
+ * replay of it
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "rollup.h"
+
+#define JOURNAL_FNAME "bang.jnl"
+#define JOURNAL_VERSION 1
+
+enum journal_type_enum {
+	JOURNAL_START,		/* arg: JOURNAL_VERSION */
+	JOURNAL_STOP,
+	JOURNAL_HEAT_ON,
+	JOURNAL_HEAT_OFF,
+	JOURNAL_HOLD,
+	JOURNAL_OVERRIDE,
+	JOURNAL_ADVANCE,
+	JOURNAL_RESUME,
+	JOURNAL_SCHED_EVENT,	/* arg: index of event now in force */
+	JOURNAL_CONFIG,		/* arg: number of events loaded */
+	JOURNAL_CLOCK,		/* arg: wall clock step, seconds */
+	JOURNAL_SENSOR,		/* arg: 1 fail-safe (no reading), 0 cleared */
+	JOURNAL_PROFILE,	/* arg: index of profile now in force */
+	JOURNAL_NUM_TYPES
+};
+
+/*
+ * one transition, 32 bytes in host byte order.  mode, heat and
+ * setpoint are the state after the transition.
+ */
+struct journal_rec_str {
+	int64_t realtime_ns;
+	int64_t monotonic_ns;	/* restarts with each JOURNAL_START */
+	uint8_t type;		/* enum journal_type_enum */
+	uint8_t mode;		/* enum rollup_mode_enum */
+	uint8_t heat;
+	uint8_t reserved;
+	int32_t arg;
+	int32_t setpoint_mdegc;	/* millidegrees C */
+	uint32_t reserved2;
+};
+
+struct journal_str {
+	int fd;			/* -1: no journal */
+	off_t torn;		/* bytes of a partial record cut at open */
+};
+
+/* what the journal says happened, from replay */
+struct journal_summary_str {
+	int64_t first_ns;	/* realtime span */
+	int64_t last_ns;
+	double covered_sec;	/* within a run, START to last record */
+	double heat_sec;	/* relay runtime */
+	unsigned long cycles;	/* relay off -> on */
+	unsigned long sensor_faults;	/* fail-safe entered */
+	double mode_sec[ROLLUP_NUM_MODES];
+	unsigned long count[JOURNAL_NUM_TYPES];
+};
+
+/*
+ * public function prototypes
+ */
+
+/*
+ * open (append) data_dir/bang.jnl, no journal if data_dir is NULL.
+ * a partial record left by a crash is truncated away.
+ */
+int
+journal_open(struct journal_str *journal, const char *data_dir);
+
+int
+journal_append(struct journal_str *journal,
+	       const struct journal_rec_str *rec);
+
+int
+journal_close(struct journal_str *journal);
+
+/*
+ * read the whole journal into a malloc'd array.  a partial record
+ * at the end (torn write) is dropped.
+ */
+int
+journal_read(const char *path, struct journal_rec_str **recs, size_t *num);
+
+/* recompute runtime, cycles and time in each mode */
+void
+journal_replay(const struct journal_rec_str *recs, size_t num,
+	       struct journal_summary_str *summary);
+
+const char *
+journal_type_name(int type);
+
+#endif
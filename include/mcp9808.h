@@ -5,16 +5,74 @@
 #ifndef MCP9808_H_
 #define MCP9808_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/* register RESOLUTION, values */
+enum mcp9808_res_enum {
+	MCP9808_RES_0_5,	/* deg C, 30 ms conversion */
+	MCP9808_RES_0_25,	/* 65 ms */
+	MCP9808_RES_0_125,	/* 130 ms */
+	MCP9808_RES_0_0625,	/* 250 ms, power-on default */
+	MCP9808_NUM_RES
+};
+
+#ifndef MCP9808_BURST_MAX
+#define MCP9808_BURST_MAX 21	/* I2C_RDWR takes 42 messages */
+#endif
+
+#ifndef MCP9808_CONV_SLACK_MS
+#define MCP9808_CONV_SLACK_MS 10	/* one-shot: added to the conversion */
+#endif
+
 /*
  * public function prototypes
  */
 
+/* select the slave; quiet, errno on failure */
 int
 mcp9808_config(int fd, uint8_t slave_addr);
 
 int
 mcp9808_read_temp(int fd, uint16_t *raw, double *temp);
 
+/* adapter does plain I2C transfers, as mcp9808_read_burst() needs */
+bool
+mcp9808_can_burst(int fd);
+
+/*
+ * n reads of T_AMB in a single I2C_RDWR transaction.  they all see
+ * the same conversion: the point is to outvote bus glitches.
+ */
+int
+mcp9808_read_burst(int fd, uint8_t slave_addr, double *temp, int n);
+
+int
+mcp9808_set_resolution(int fd, enum mcp9808_res_enum res);
+
+/* shutdown: no conversions, T_AMB keeps the last one */
+int
+mcp9808_set_shutdown(int fd, bool shutdown);
+
+/* typical conversion time, milliseconds */
+int
+mcp9808_conv_ms(enum mcp9808_res_enum res);
+
+/* out of shutdown, and wait out the first conversion */
+int
+mcp9808_wake(int fd, enum mcp9808_res_enum res);
+
+/*
+ * T_LOWER and T_UPPER, rounded inward to 0.25 deg C and clamped to
+ * the register range (so +-INFINITY is no limit); T_CRIT out of reach.
+ * lower and upper are updated to the limits written.  ALERT is
+ * asserted while T_AMB is outside [lower, upper].
+ */
+int
+mcp9808_set_limits(int fd, double *lower, double *upper);
+
+/* ALERT enabled in comparator mode, active low, or disabled */
+int
+mcp9808_set_alert(int fd, bool enable);
+
 #endif
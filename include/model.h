@@ -0,0 +1,121 @@
+/*
+ * Header file for model module: first-order thermal model of the room,
+ *
+ *     dT/dt = (ambient - T) / tau + gain * heat
+ *
+ * fitted online by recursive least squares, one update per second.
+ * the fit is linear in theta:  dT = theta[0] + theta[1] * T
+ * + theta[2] * heat, so loss = 1 / tau = -theta[1], gain = theta[2]
+ * and ambient = theta[0] / loss.  saved to data_dir so a restart
+ * picks up where it left off.
+ *
+ * temperature and heat both go through the same causal low-pass
+ * filter first.  the model is linear, so it holds for the filtered
+ * signals too, while the sensor's quantization steps, which would
+ * otherwise bias the loss high, are smoothed away.
+ */
+
+#ifndef MODEL_H_
+#define MODEL_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#define MODEL_NUM_PARAMS 3
+
+#ifndef MODEL_MEMORY
+#define MODEL_MEMORY 86400.0	/* seconds, forgetting time constant */
+#endif
+
+#ifndef MODEL_MIN_SAMPLES
+#define MODEL_MIN_SAMPLES 7200	/* before the fit is trusted */
+#endif
+
+#ifndef MODEL_FILTER
+#define MODEL_FILTER 60.0	/* seconds, low-pass time constant */
+#endif
+
+#ifndef MODEL_SETTLE
+#define MODEL_SETTLE 300	/* seconds of filtering before a fit */
+#endif
+
+#ifndef MODEL_P0
+#define MODEL_P0 1e3		/* initial covariance, diagonal */
+#endif
+
+#ifndef MODEL_REPORT
+#define MODEL_REPORT 3600	/* seconds between reports and saves */
+#endif
+
+#define MODEL_FNAME "bang.model"
+
+struct model_str {
+	double theta[MODEL_NUM_PARAMS];
+	double p[MODEL_NUM_PARAMS][MODEL_NUM_PARAMS];	/* covariance */
+	unsigned long samples;	/* updates since the model was new */
+	/* private */
+	bool primed;		/* filtered values, prev_time valid */
+	double temp_f;		/* filtered temperature */
+	double heat_f;		/* filtered heat */
+	time_t prev_time;
+	long settled;		/* seconds of continuous filtering */
+};
+
+/*
+ * public function prototypes
+ */
+
+/* no knowledge */
+void
+model_init(struct model_str *model);
+
+/*
+ * temp at control time now, heat the relay state over the second
+ * before it.  a gap in the samples restarts the filter.
+ */
+void
+model_update(struct model_str *model, double temp, bool heat, time_t now);
+
+/* the next sample is not continuous with the last */
+void
+model_break(struct model_str *model);
+
+/* enough samples, and physically sensible */
+bool
+model_valid(const struct model_str *model);
+
+/* 1 / tau, per second */
+double
+model_loss(const struct model_str *model);
+
+/* seconds */
+double
+model_tau(const struct model_str *model);
+
+/* deg C per second, heat on */
+double
+model_gain(const struct model_str *model);
+
+/* deg C, the temperature the room settles to with the heat off */
+double
+model_ambient(const struct model_str *model);
+
+/*
+ * seconds with the heat on to go from one temperature to another,
+ * zero if already there, INFINITY if the heat can't get there
+ */
+double
+model_recovery(const struct model_str *model, double from_degc,
+	       double to_degc);
+
+/*
+ * data_dir/bang.model.  load leaves the model alone on failure
+ * (ENOENT for none saved); save replaces it atomically.
+ */
+int
+model_load(struct model_str *model, const char *data_dir);
+
+int
+model_save(const struct model_str *model, const char *data_dir);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Header file for pid module: PID controller driving the relay by
+ * time-proportioning.  each window the relay is on for duty * window
+ * seconds, then off; at most one start per window.
+ */
+
+#ifndef PID_H_
+#define PID_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifndef PID_DFLT_KP
+#define PID_DFLT_KP 0.5		/* duty per deg C below setpoint */
+#endif
+
+#ifndef PID_DFLT_KI
+#define PID_DFLT_KI 0.0003	/* duty per deg C second */
+#endif
+
+#ifndef PID_DFLT_KD
+#define PID_DFLT_KD 0.0		/* duty per deg C/second of cooling */
+#endif
+
+#ifndef PID_DFLT_WINDOW
+#define PID_DFLT_WINDOW 600	/* seconds */
+#endif
+
+#ifndef PID_MIN_PULSE
+#define PID_MIN_PULSE 30	/* shorter on or off times are dropped */
+#endif
+
+/* from the config file */
+struct pid_cfg_str {
+	double kp;
+	double ki;
+	double kd;
+	int window;		/* seconds */
+};
+
+struct pid_str {
+	struct pid_cfg_str cfg;
+	/* private */
+	double integral;	/* deg C seconds */
+	double prev_temp;
+	time_t prev_time;
+	bool primed;		/* prev_temp, prev_time valid */
+	double duty;		/* latest output, 0 to 1 */
+	time_t window_start;
+	int on_sec;		/* of the current window */
+	double window_setpoint;
+	bool in_window;
+};
+
+/*
+ * public function prototypes
+ */
+
+/* cfg set by the caller; clears the controller state */
+void
+pid_init(struct pid_str *pid);
+
+/*
+ * one PID step at control time now, and the relay state the current
+ * window calls for.  a new window starts when the last one ends, or
+ * when the setpoint changes.  min_pulse: on or off times shorter than
+ * this round to none.
+ */
+bool
+pid_control(struct pid_str *pid, double setpoint, double temp, time_t now,
+	    int min_pulse);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Header file for rollup module: per-minute, per-hour and per-day
+ * aggregates maintained incrementally from the 1 Hz samples.
+ *
+ * the rollup files are the store: only the open bucket of each level
+ * is held in memory, and bang-stats --rollup reads the files.  a
+ * bucket open at stop is written part way and taken up again at the
+ * next start, so the same start time may appear twice: the later
+ * line includes the earlier one, and replaces it.
+ *
+ * hour lines also carry the thermal model's fit as the hour closed:
+ * time constant, heating gain and ambient, nan until it is fitted.
+ */
+
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "model.h"
+
+enum rollup_mode_enum {
+	ROLLUP_MODE_SCHED,
+	ROLLUP_MODE_HOLD,
+	ROLLUP_MODE_OVERRIDE,
+	ROLLUP_MODE_ADVANCE,
+	ROLLUP_NUM_MODES
+};
+
+enum rollup_level_enum {
+	ROLLUP_MINUTE,
+	ROLLUP_HOUR,
+	ROLLUP_DAY,
+	ROLLUP_NUM_LEVELS
+};
+
+struct rollup_bucket_str {
+	time_t start;			/* first second of bucket */
+	unsigned long count;		/* samples, one per second */
+	double temp_min_degc;
+	double temp_max_degc;
+	double temp_sum_degc;
+	unsigned long heat_sec;		/* seconds with heat on */
+	unsigned long heat_cycles;	/* off -> on transitions */
+	unsigned long mode_sec[ROLLUP_NUM_MODES];
+	/* hour lines read back, NAN: none */
+	double tau_hours;		/* model time constant */
+	double gain_per_hour;		/* heating gain, degrees */
+	double ambient;
+};
+
+struct rollup_level_str {
+	struct rollup_bucket_str bucket;	/* open bucket */
+	long key;			/* local period number of bucket */
+	bool open;
+};
+
+struct rollup_str {
+	const char *data_dir;		/* NULL: no rollup files */
+	const struct model_str *model;	/* for hour lines, NULL: none */
+	bool heat_prev;
+	struct rollup_level_str level[ROLLUP_NUM_LEVELS];
+};
+
+/*
+ * public function prototypes
+ */
+
+void
+rollup_init(struct rollup_str *rollup, const char *data_dir,
+	    const struct model_str *model);
+
+/*
+ * add one 1-second sample.  completed buckets are appended to
+ * YYYYMMDD.min, YYYYMMDD.hr and YYYY.day in data_dir, with
+ * temperatures in deg F if degf is set.  the first sample of each
+ * level resumes the bucket the last line of its file left open.
+ */
+int
+rollup_add(struct rollup_str *rollup, time_t sse, long gmtoff,
+	   double temp_degc, bool heat, enum rollup_mode_enum mode,
+	   bool degf);
+
+/* write the open (partial) buckets, e.g. at exit */
+int
+rollup_flush(struct rollup_str *rollup, bool degf);
+
+/* ".min", ".hr" or ".day" */
+const char *
+rollup_suffix(enum rollup_level_enum level);
+
+/* fold src into dst */
+void
+rollup_merge(struct rollup_bucket_str *dst,
+	     const struct rollup_bucket_str *src);
+
+/* one line of a rollup file, temperatures in its units */
+int
+rollup_parse_line(const char *line, struct rollup_bucket_str *bucket);
+
+#endif
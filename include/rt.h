@@ -0,0 +1,74 @@
+/*
+ * Header file for rt module: real-time setup of the control thread
+ * (SCHED_FIFO, mlockall, pre-faulting, CPU pinning) and tick jitter
+ * statistics
+ */
+
+#ifndef RT_H_
+#define RT_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef RT_STACK_PREFAULT
+#define RT_STACK_PREFAULT (256 * 1024)
+#endif
+
+#ifndef RT_HEAP_PREFAULT
+#define RT_HEAP_PREFAULT (1024 * 1024)
+#endif
+
+/* the I/O threads' stacks: all of each is resident under mlockall */
+#ifndef RT_THREAD_STACK
+#define RT_THREAD_STACK (128 * 1024)
+#endif
+
+#ifndef RT_JITTER_REPORT
+#define RT_JITTER_REPORT 3600	/* ticks between jitter reports */
+#endif
+
+struct rt_str {
+	int prio;		/* SCHED_FIFO priority, zero: leave alone */
+	bool mlock;		/* lock and pre-fault memory */
+	int cpu;		/* pin to this CPU, -1: don't */
+};
+
+/* wakeup latency, relative to the top of the second */
+struct rt_jitter_str {
+	unsigned long ticks;
+	long long sum_ns;
+	long min_ns;
+	long max_ns;
+};
+
+/*
+ * public function prototypes
+ */
+
+/*
+ * apply to the calling thread, after the I/O threads are started so
+ * they keep the default policy and affinity.  anything not permitted
+ * is logged and skipped.  mlock locks the whole process: the I/O
+ * threads' stacks (see rt_thread_create()), and the heap, which from
+ * then on is never trimmed and serves large blocks too, not mmap.
+ */
+void
+rt_setup(const struct rt_str *rt);
+
+/*
+ * pthread_create() with an RT_THREAD_STACK stack rather than the
+ * default (8 MB, typically), which mlockall would make resident
+ */
+int
+rt_thread_create(pthread_t *thread, void *(*start)(void *), void *arg);
+
+/* account for one tick stamped at now */
+void
+rt_jitter_add(struct rt_jitter_str *jitter, const struct timespec *now);
+
+/* log and reset */
+void
+rt_jitter_report(struct rt_jitter_str *jitter);
+
+#endif
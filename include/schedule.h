@@ -11,6 +11,25 @@
 
 #include "cfgfile.h"
 
+/*
+ * a wall clock step back by more than this starts the schedule over
+ * at the new time; smaller steps (and DST ending) wait for the clock
+ * to catch up, so no event fires twice
+ */
+#ifndef SCHED_STEP_MAX
+#define SCHED_STEP_MAX (2 * 60 * 60)
+#endif
+
+/* optimal start: preheat no earlier than this before an event */
+#ifndef SCHED_MAX_LEAD
+#define SCHED_MAX_LEAD (3 * 60 * 60)
+#endif
+
+/* optimal start: aim to arrive this much before the event */
+#ifndef SCHED_LEAD_MARGIN
+#define SCHED_LEAD_MARGIN 120
+#endif
+
 struct schedule_str {
 	struct cfg_data_str config;
 
@@ -19,15 +38,22 @@ struct schedule_str {
 	bool override_flag;
 	double override_temp_degc;
 	bool advance_flag;
-	/* control files: hold, override, advance, and resume */
+	/* active profile, NULL: the default (config.profile[0]) */
+	const struct profile_str *active;
+	long profile_sec;	/* to arm: revert after this, 0: never */
+	time_t profile_expires;	/* armed: revert at, 0: never */
+	/* control files: hold, override, advance, resume, and profile */
 	const char *ctrl_dir;
 	time_t hold_mtime;
 	time_t override_mtime;
 	time_t advance_mtime;
 	time_t resume_mtime;
+	time_t profile_mtime;
 
 	ssize_t curr_idx;	/* index of current scheduled event */
-	long curr_sow;		/* time of last setpoint calculation */
+	time_t curr_local;	/* latest local time the schedule reached */
+	                        /* (valid when curr_idx != -1) */
+	time_t next_local;	/* local time the next event fires */
 	                        /* (valid when curr_idx != -1) */
 };
 
@@ -38,4 +64,26 @@ struct schedule_str {
 double
 sched_get_setpoint(time_t sse, struct schedule_str *schedule);
 
+/*
+ * the event after the one in force, as of the last
+ * sched_get_setpoint(): seconds until it fires, and its setpoint.
+ * -1 before the first sched_get_setpoint().
+ */
+int
+sched_next_event(const struct schedule_str *schedule, long *until,
+		 double *setpoint_degc);
+
+/* the profile in force */
+const struct profile_str *
+sched_profile(const struct schedule_str *schedule);
+
+/*
+ * switch to the named profile, already compiled: no reparse.  revert
+ * to the default after sec seconds (0: stay).  -1 if there is no such
+ * profile.
+ */
+int
+sched_set_profile(struct schedule_str *schedule, const char *name,
+		  long sec);
+
 #endif
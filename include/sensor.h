@@ -0,0 +1,148 @@
+/*
+ * Header file for temperature sensor interface
+ */
+
+#ifndef SENSOR_H_
+#define SENSOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mcp9808.h"
+
+#ifndef SENSOR_RETRIES
+#define SENSOR_RETRIES 3	/* after a failed read, the last one reopens */
+#endif
+
+#ifndef SENSOR_BACKOFF_US
+#define SENSOR_BACKOFF_US 1000	/* before the first retry, then doubled */
+#endif
+
+#ifndef SENSOR_STALE_SEC
+#define SENSOR_STALE_SEC 30	/* default: hold the last reading this long */
+#endif
+
+#ifndef SENSOR_BURST_MAX
+#define SENSOR_BURST_MAX 16	/* samples per read */
+#endif
+
+#ifndef SENSOR_MAD_K
+#define SENSOR_MAD_K 3.0	/* reject beyond this many sigma, from MAD */
+#endif
+
+#ifndef SENSOR_BURST_TOL
+#define SENSOR_BURST_TOL 0.25	/* deg C, never reject closer than this */
+#endif
+
+#ifndef SENSOR_REPORT
+#define SENSOR_REPORT 3600	/* reads between rejection reports */
+#endif
+
+struct sensor_str;
+struct sensor_alert_str;
+
+/* backend operations */
+struct sensor_ops_str {
+	const char *name;
+	int (*read)(struct sensor_str *sensor, double *temp_degc);
+	int (*close)(struct sensor_str *sensor);
+	int (*reopen)(struct sensor_str *sensor);	/* NULL: can't */
+	/* n samples at once, NULL: n reads */
+	int (*read_burst)(struct sensor_str *sensor, double *temp_degc,
+			  int n);
+	/*
+	 * alert outside [lo, hi], NULL: no threshold hardware.  either
+	 * may be infinite; both are updated to the limits the hardware
+	 * compares the reading with.
+	 */
+	int (*set_band)(struct sensor_str *sensor, double *lo_degc,
+			double *hi_degc);
+};
+
+struct sensor_str {
+	const struct sensor_ops_str *ops;
+	int fd;
+	void *priv;		/* backend private data */
+	int stale_sec;		/* set by caller: hold last good reading */
+	int burst;		/* set by caller: samples per read, 1: plain */
+	struct sensor_alert_str *alert;	/* ALERT line, NULL: none */
+	unsigned long samples;	/* burst samples taken */
+	unsigned long rejected;	/* and thrown out as outliers */
+};
+
+/* inlines */
+
+static inline int sensor_read(struct sensor_str *sensor, double *temp_degc)
+{
+	return sensor->ops->read(sensor, temp_degc);
+}
+
+static inline int sensor_close(struct sensor_str *sensor)
+{
+	return sensor->ops->close(sensor);
+}
+
+static inline int sensor_set_band(struct sensor_str *sensor,
+				  double *lo_degc, double *hi_degc)
+{
+	return sensor->ops->set_band(sensor, lo_degc, hi_degc);
+}
+
+/*
+ * public function prototypes
+ */
+
+/* caller-set fields and counters, for the backend open functions */
+void
+sensor_defaults(struct sensor_str *sensor);
+
+/*
+ * read, retrying with exponential backoff and reopening the device
+ * before the last try.  a few milliseconds at worst, except in oneshot
+ * mode, where each try waits out a conversion (~260 ms): a read that
+ * fails every try costs over a second, and the ticks it spans are
+ * missed.  ENODATA (end of replay) is not retried.  with burst > 1,
+ * each try takes that many samples and returns the mean of those
+ * within the MAD test of the median.
+ */
+int
+sensor_read_retry(struct sensor_str *sensor, double *temp_degc);
+
+/* MCP9808 on /dev/<i2c_device>, oneshot: shut down between reads */
+int
+sensor_open_mcp9808(struct sensor_str *sensor,
+		    const char *i2c_device, uint8_t slave_addr,
+		    enum mcp9808_res_enum res, bool oneshot);
+
+/* sysfs/hwmon temperature file, in millidegrees C */
+int
+sensor_open_hwmon(struct sensor_str *sensor, const char *path);
+
+/* replay temperatures logged to a dayfile, one record per read */
+int
+sensor_open_replay(struct sensor_str *sensor, const char *path);
+
+/*
+ * watch the sensor's ALERT output on a gpio line, for backends with
+ * set_band.  the alert is armed by the first sensor_set_band().
+ */
+int
+sensor_alert_open(struct sensor_str *sensor,
+		  const char *gpio_device, unsigned offset);
+
+/* readable when ALERT asserts, -1: no alert line */
+int
+sensor_alert_fd(const struct sensor_str *sensor);
+
+/* consume pending edge events, so the fd polls quiet again */
+void
+sensor_alert_ack(struct sensor_str *sensor);
+
+void
+sensor_alert_close(struct sensor_str *sensor);
+
+/* log and reset the rejection counters */
+void
+sensor_report(struct sensor_str *sensor);
+
+#endif
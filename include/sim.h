@@ -0,0 +1,60 @@
+/*
+ * Header file for simulation module
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "sensor.h"
+#include "actuator.h"
+
+/* first-order thermal model of the room and heater */
+#ifndef SIM_OUTDOOR_DEGC
+#define SIM_OUTDOOR_DEGC 5.0	/* outdoor temperature */
+#endif
+
+#ifndef SIM_INITIAL_DEGC
+#define SIM_INITIAL_DEGC 18.0	/* room temperature at start */
+#endif
+
+#ifndef SIM_TAU_SEC
+#define SIM_TAU_SEC 14400.0	/* room time constant (4 hours) */
+#endif
+
+#ifndef SIM_HEAT_RISE_DEGC
+#define SIM_HEAT_RISE_DEGC 25.0	/* steady-state rise, heat on */
+#endif
+
+struct sim_str {
+	struct timespec now;	/* virtual clock */
+	time_t end;		/* end of simulation */
+	double temp_degc;	/* room temperature */
+	double outdoor_degc;
+	double tau_sec;
+	double heat_rise_degc;
+	bool heat_on;		/* fake relay */
+};
+
+/*
+ * public function prototypes
+ */
+
+void
+sim_init(struct sim_str *sim, time_t start, long duration);
+
+/* advance virtual clock one second, returns -1 at end of simulation */
+int
+sim_tick(struct sim_str *sim, struct timespec *timestamp);
+
+/* sensor reading room temperature, with MCP9808 resolution */
+int
+sim_sensor_open(struct sensor_str *sensor, struct sim_str *sim);
+
+/* fake relay driving the heater */
+int
+sim_actuator_open(struct actuator_str *actuator, struct sim_str *sim);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Header file for sink module: data log outputs.  each sink formats
+ * records straight into its own buffer and writes them out in
+ * batches with writev.
+ */
+
+#ifndef SINK_H_
+#define SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "iosync.h"
+
+#ifndef SINK_BUF_SIZE
+#define SINK_BUF_SIZE 8192
+#endif
+
+#ifndef SINK_MAX_BATCH
+#define SINK_MAX_BATCH 64	/* records per writev */
+#endif
+
+#define SINK_MAX_REC 256	/* longest formatted record */
+
+/* one sample, in logged units */
+struct sink_rec_str {
+	unsigned long sequence;
+	struct timespec timestamp;
+	const struct tm *bdt;	/* local time */
+	char units;		/* 'F' or 'C' */
+	double temp;
+	double temp_avg;
+	double setpoint;
+	bool heat;
+	bool hold;
+	bool override;
+	bool advance;
+};
+
+/* bin sink record, 32 bytes in host byte order */
+struct sink_bin_rec_str {
+	int64_t sec;
+	int32_t nsec;
+	uint32_t sequence;
+	float temp;
+	float temp_avg;
+	float setpoint;
+	uint8_t heat;
+	uint8_t hold;
+	uint8_t override;
+	uint8_t advance;
+};
+
+/* when to fdatasync */
+enum sink_sync_enum {
+	SINK_SYNC_NONE,		/* leave it to the kernel */
+	SINK_SYNC_RECORDS,	/* every sync_every records */
+	SINK_SYNC_SECONDS,	/* every sync_every seconds */
+	SINK_SYNC_CHANGE,	/* on each heat/hold/override/setpoint change */
+};
+
+struct sink_str;
+
+struct sink_ops_str {
+	const char *name;
+	const char *suffix;	/* daily files YYYYMMDD<suffix>, else NULL */
+	bool indexed;		/* maintain YYYYMMDD<suffix>.idx */
+	/* format rec at buf, returns bytes used or -1 */
+	int (*format)(const struct sink_rec_str *rec, char *buf, size_t len);
+};
+
+struct sink_str {
+	/* set by sink_init() from the spec, may be changed before open */
+	const struct sink_ops_str *ops;
+	int interval;		/* seconds between records, 0: default */
+	const char *path;	/* stream sinks, NULL: stdout */
+
+	/* set by the caller before sink_open() */
+	const char *data_dir;	/* daily sinks, NULL: stdout */
+	double delta;		/* change-only threshold, zero: all */
+	int keyframe;		/* seconds between full records, delta mode */
+	int batch;		/* records per write */
+	enum sink_sync_enum sync;
+	int sync_every;		/* records or seconds */
+	struct iosync_str *iosync;	/* runs the syncs, NULL: SYNC_NONE */
+
+	/* private */
+	int fd;
+	long day_key;		/* local day of the open daily file */
+	char day_name[32];	/* and its name, YYYYMMDD<suffix> */
+	long index_key;		/* local minute last marked in index */
+	off_t offset;		/* end of file, as written */
+	struct {		/* last record written, for delta mode */
+		time_t sec;
+		double temp;
+		double setpoint;
+		int flags;
+	} last;
+	int unsynced;		/* records written since the last sync */
+	time_t synced_sec;
+	size_t used;
+	int iovcnt;
+	struct iovec iov[SINK_MAX_BATCH];
+	struct {		/* per pending record, for the index */
+		size_t pos;	/* start in buf */
+		int minute;	/* of day to mark once written, -1: none */
+	} mark[SINK_MAX_BATCH];
+	char buf[SINK_BUF_SIZE];
+};
+
+/*
+ * public function prototypes
+ */
+
+/*
+ * set up from TYPE[@SEC][:FILE], where TYPE is dat (text dayfiles),
+ * bin (binary dayfiles), influx (line protocol) or json (JSON Lines).
+ * FILE is for influx and json only.
+ */
+int
+sink_init(struct sink_str *sink, const char *spec);
+
+int
+sink_open(struct sink_str *sink);
+
+/* is a record due at this second? */
+static inline bool
+sink_wants(const struct sink_str *sink, time_t sec)
+{
+	return (sink->interval != 0) && (sec % sink->interval == 0);
+}
+
+/*
+ * format and queue one record, writing the batch when full.  a sync
+ * point writes the batch early and hands the fdatasync to the iosync
+ * thread.
+ */
+int
+sink_put(struct sink_str *sink, const struct sink_rec_str *rec);
+
+/* write out queued records */
+int
+sink_flush(struct sink_str *sink);
+
+/* write out queued records and queue an fdatasync of them */
+int
+sink_sync(struct sink_str *sink, time_t now);
+
+int
+sink_close(struct sink_str *sink);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Header file for stage module: daily sink files and the rollups are
+ * written to a RAM-backed staging directory and copied to data_dir in
+ * large sequential chunks, sparing the flash from small appends.
+ *
+ * not staged: the journal (bang.jnl), which must survive a crash, so
+ * each of its few 32-byte records an hour is fdatasync'ed, and the thermal model
+ * (bang.model), replaced whole once an hour, which staging would not
+ * make any cheaper.
+ */
+
+#ifndef STAGE_H_
+#define STAGE_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "archive.h"
+
+#ifndef STAGE_SYNC_SEC
+#define STAGE_SYNC_SEC 300
+#endif
+
+#ifndef STAGE_CHUNK
+#define STAGE_CHUNK (256 * 1024)
+#endif
+
+struct stage_str {
+	const char *stage_dir;	/* tmpfs, NULL: no staging */
+	const char *data_dir;	/* persistent copies */
+	int sync_sec;		/* seconds between copies */
+	struct archive_str *archive;	/* told once closed days are copied */
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool pending;		/* day rolled over, copy now */
+	bool stop;
+	struct tm today;	/* date of the active dayfile */
+	char *buf;
+};
+
+/*
+ * public function prototypes
+ */
+
+/*
+ * copy anything left in stage_dir by an earlier run to data_dir, stage
+ * today's files from data_dir so appends continue where they left off,
+ * and start the copy thread.  nothing to do unless stage_dir is set.
+ */
+int
+stage_start(struct stage_str *stage, const struct tm *today);
+
+/* the active dayfile is now for today: copy out and drop older days */
+void
+stage_notify(struct stage_str *stage, const struct tm *today);
+
+/* copy everything to data_dir, empty stage_dir and join the thread */
+void
+stage_stop(struct stage_str *stage);
+
+#endif
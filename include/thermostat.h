@@ -5,17 +5,53 @@
 #ifndef THERMOSTAT_H_
 #define THERMOSTAT_H_
 
-#include <gpiod.h>
-
+#include "sensor.h"
+#include "actuator.h"
 #include "schedule.h"
+#include "sim.h"
+#include "archive.h"
+#include "sink.h"
+#include "stage.h"
+#include "iosync.h"
+#include "cycle.h"
+#include "model.h"
+
+#ifndef ALERT_POLL_SEC
+#define ALERT_POLL_SEC 10	/* with a sensor alert: seconds between reads */
+#endif
+
+/* data logging */
+struct datalog_str {
+	const char *data_dir;	/* rollups and journal, NULL: none */
+	struct sink_str *sinks;	/* opened by the caller */
+	size_t num_sinks;
+	struct archive_str *archive;	/* NULL: none */
+	struct stage_str *stage;	/* sinks write to stage_dir, NULL: none */
+	struct iosync_str *iosync;	/* syncs the journal, NULL: none */
+};
+
+/* heat control */
+struct control_str {
+	struct cycle_str cycle;	/* limits set by the caller */
+	struct model_str model;	/* thermal model, fitted as we go */
+};
 
 /*
  * public function prototypes
  */
 
+/*
+ * runs until a stop signal or the end of the simulation or replay (0),
+ * or a sensor, actuator or clock failure (-1).  either way the rollups,
+ * journal and sinks are flushed first.
+ */
 int
-tstat_control(struct gpiod_line *line, int mcp9808_fd,
-	      struct schedule_str *schedule,
-	      const char *data_dir, int data_interval);
+tstat_control(struct sensor_str *sensor, struct actuator_str *actuator,
+	      struct schedule_str *schedule, struct control_str *control,
+	      const struct datalog_str *datalog, struct sim_str *sim);
+
+/* have tstat_control() return at the next second, signal safe */
+void
+tstat_stop(void);
 
 #endif
@@ -0,0 +1,41 @@
+/*
+ * Header file for tick module: 1 Hz control loop timing.  ticks land
+ * on wall clock second boundaries; steps of the wall clock are
+ * detected with TFD_TIMER_CANCEL_ON_SET.  the wait can also end early,
+ * when a second descriptor (a sensor alert) becomes readable.
+ */
+
+#ifndef TICK_H_
+#define TICK_H_
+
+#include <time.h>
+
+struct tick_str {
+	int fd;			/* timerfd, -1: sleep instead */
+	struct timespec wall;	/* CLOCK_REALTIME at the last tick */
+	struct timespec mono;	/* CLOCK_MONOTONIC at the last tick */
+	long long step_ns;	/* wall clock step before this tick, or 0 */
+	unsigned long missed;	/* ticks overrun */
+	int wake_fd;		/* also end the wait, -1: none */
+};
+
+/*
+ * public function prototypes
+ */
+
+/* without a usable timerfd, falls back to wait_for_next_second() */
+int
+tick_open(struct tick_str *tick);
+
+/*
+ * wait for the next second and stamp it on both clocks.  returns 1,
+ * with the stamps untouched, if wake_fd became readable first.  an
+ * error on wake_fd is logged, and wake_fd set to -1.
+ */
+int
+tick_wait(struct tick_str *tick);
+
+void
+tick_close(struct tick_str *tick);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * heat relay backends
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <gpiod.h>
+#include <errno.h>
+
+#include "actuator.h"
+
+#define PGM_NAME program_invocation_short_name
+
+/*
+ * libgpiod
+ */
+
+struct gpio_line_priv_str {
+	struct gpiod_chip *chip;
+	struct gpiod_line *line;
+};
+
+static int
+gpio_line_set(struct actuator_str *actuator, bool on)
+{
+	struct gpio_line_priv_str *priv = actuator->priv;
+
+	return (gpiod_line_set_value(priv->line, on) == 0) ? 0 : -1;
+}
+
+static int
+gpio_line_close(struct actuator_str *actuator)
+{
+	struct gpio_line_priv_str *priv = actuator->priv;
+
+	gpiod_line_release(priv->line);
+	gpiod_chip_close(priv->chip);
+	free(priv);
+
+	return 0;
+}
+
+static const struct actuator_ops_str gpio_line_ops = {
+	.name = "gpiod",
+	.set = gpio_line_set,
+	.close = gpio_line_close,
+};
+
+static int
+open_gpio_line(struct gpiod_chip *chip,
+	       unsigned offset,
+	       bool active_low,
+	       struct gpiod_line **line)
+{
+	struct gpiod_line_request_config config;
+	int ret;
+
+	*line = gpiod_chip_get_line(chip, offset);
+	if (*line == NULL) {
+		fprintf(stderr,
+			"%s, gpiod get line(%u): %s\n",
+			PGM_NAME, offset, strerror(errno));
+		return -1;
+	}
+
+	config.consumer = PGM_NAME;
+	config.request_type = GPIOD_LINE_REQUEST_DIRECTION_OUTPUT;
+	config.flags = active_low * GPIOD_LINE_REQUEST_FLAG_ACTIVE_LOW;
+
+	/* set to output, initial value 0 */
+	ret = gpiod_line_request(*line, &config, 0);
+	if (ret == -1) {
+		fprintf(stderr,
+			"%s, gpiod line request: %s\n",
+			PGM_NAME, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+actuator_open_gpiod(struct actuator_str *actuator,
+		    const char *gpio_device, unsigned offset,
+		    bool active_low)
+{
+	struct gpio_line_priv_str *priv;
+
+	priv = malloc(sizeof *priv);
+	if (priv == NULL) {
+		fprintf(stderr, "%s, malloc: %s\n",
+			PGM_NAME, strerror(errno));
+		return -1;
+	}
+
+	priv->chip = gpiod_chip_open_by_name(gpio_device);
+	if (priv->chip == NULL) {
+		fprintf(stderr,
+			"%s, gpiod chip open(%s): %s\n",
+			PGM_NAME, gpio_device, strerror(errno));
+		free(priv);
+		return -1;
+	}
+
+	if (open_gpio_line(priv->chip, offset, active_low,
+			   &priv->line) == -1) {
+		gpiod_chip_close(priv->chip);
+		free(priv);
+		return -1;
+	}
+
+	actuator->ops = &gpio_line_ops;
+	actuator->state = false;
+	actuator->switch_count = 0;
+	actuator->priv = priv;
+
+	return 0;
+}
+
+/*
+ * fake relay: state is kept in the actuator itself
+ */
+
+static int
+fake_set(struct actuator_str *actuator, bool on)
+{
+	(void)actuator;
+	(void)on;
+
+	return 0;
+}
+
+static int
+fake_close(struct actuator_str *actuator)
+{
+	(void)actuator;
+
+	return 0;
+}
+
+static const struct actuator_ops_str fake_ops = {
+	.name = "fake",
+	.set = fake_set,
+	.close = fake_close,
+};
+
+int
+actuator_open_fake(struct actuator_str *actuator)
+{
+	actuator->ops = &fake_ops;
+	actuator->state = false;
+	actuator->switch_count = 0;
+	actuator->priv = NULL;
+
+	return 0;
+}
+
+/*
+ * public functions
+ */
+
+int
+actuator_set(struct actuator_str *actuator, bool on)
+{
+	if (actuator->ops->set(actuator, on) == -1)
+		return -1;
+
+	if (on != actuator->state)
+		actuator->switch_count++;
+	actuator->state = on;
+
+	return 0;
+}
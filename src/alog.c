@@ -0,0 +1,317 @@
+/*
+ * alog module: asynchronous, rate limited syslog
+ *
+ * the ring is a bounded multi-producer queue: each slot carries a
+ * sequence number, producers claim a slot by advancing head with a
+ * compare-and-swap and publish it by bumping the slot's sequence.
+ * the single consumer never takes a lock either.  producers wake it
+ * through an eventfd, which never blocks.
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "alog.h"
+#include "rt.h"
+
+#if (ALOG_RING & (ALOG_RING - 1)) != 0
+#error "ALOG_RING must be a power of 2"
+#endif
+
+struct slot_str {
+	unsigned long seq;	/* == pos: free, == pos + 1: full */
+	int prio;
+	char msg[ALOG_MSG_MAX];
+};
+
+static struct {
+	struct slot_str slot[ALOG_RING];
+	unsigned long head;	/* next slot to claim, producers */
+	unsigned long tail;	/* next slot to log, consumer only */
+	unsigned long dropped;	/* ring full */
+	struct alog_site_str *sites;	/* sites with suppressed messages */
+	int efd;
+	bool running;
+	bool stop;
+	pthread_t thread;
+} ring;
+
+/*
+ * private functions
+ */
+
+static time_t
+mono_sec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec;
+}
+
+/* false if the site is over its budget for this interval */
+static bool
+rate_ok(struct alog_site_str *site, int prio, time_t now)
+{
+	if (now - __atomic_load_n(&site->window, __ATOMIC_RELAXED)
+	    >= ALOG_INTERVAL) {
+		__atomic_store_n(&site->window, now, __ATOMIC_RELAXED);
+		site->count = 0;
+	}
+
+	if (site->count < ALOG_BURST) {
+		site->count++;
+		return true;
+	}
+
+	__atomic_store_n(&site->prio, prio, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+
+	/* first time over budget: put the site where the thread sees it */
+	if (!site->listed) {
+		site->listed = true;
+		site->next = __atomic_load_n(&ring.sites, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&ring.sites, &site->next,
+						    site, true,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+	}
+
+	return false;
+}
+
+/* claim a slot, or NULL if the ring is full */
+static struct slot_str *
+claim(unsigned long *pos_out)
+{
+	unsigned long pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+	struct slot_str *slot;
+	long diff;
+
+	for (;;) {
+		slot = &ring.slot[pos & (ALOG_RING - 1)];
+		diff = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+			      - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring.head, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*pos_out = pos;
+
+	return slot;
+}
+
+static void
+drain(void)
+{
+	struct slot_str *slot;
+
+	for (;;) {
+		slot = &ring.slot[ring.tail & (ALOG_RING - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+		    != ring.tail + 1)
+			break;
+
+		syslog(slot->prio, "%s", slot->msg);
+
+		/* free for the producer one lap ahead */
+		__atomic_store_n(&slot->seq, ring.tail + ALOG_RING,
+				 __ATOMIC_RELEASE);
+		ring.tail++;
+	}
+}
+
+/* log suppressed counts for finished intervals, true if any remain */
+static bool
+summarize(bool all)
+{
+	struct alog_site_str *site;
+	unsigned long n;
+	time_t now = mono_sec();
+	bool pending = false;
+
+	n = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED);
+	if (n != 0)
+		syslog(LOG_WARNING, "%lu messages dropped, log queue full", n);
+
+	for (site = __atomic_load_n(&ring.sites, __ATOMIC_ACQUIRE);
+	     site != NULL; site = site->next) {
+		if (__atomic_load_n(&site->suppressed, __ATOMIC_RELAXED) == 0)
+			continue;
+
+		if (!all
+		    && (now - __atomic_load_n(&site->window, __ATOMIC_RELAXED)
+			< ALOG_INTERVAL)) {
+			pending = true;
+			continue;
+		}
+
+		n = __atomic_exchange_n(&site->suppressed, 0,
+					__ATOMIC_RELAXED);
+		if (n != 0)
+			syslog(__atomic_load_n(&site->prio, __ATOMIC_RELAXED),
+			       "%s:%d: %lu similar messages suppressed",
+			       site->file, site->line, n);
+	}
+
+	return pending;
+}
+
+static void *
+alog_thread(void *arg)
+{
+	struct pollfd pfd = { .fd = ring.efd, .events = POLLIN };
+	uint64_t val;
+	bool pending;
+
+	(void)arg;
+
+	for (;;) {
+		drain();
+		pending = summarize(false);
+		if (__atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE))
+			break;
+
+		/* wake each second while a summary is due */
+		if ((poll(&pfd, 1, pending ? 1000 : -1) == 1)
+		    && (read(ring.efd, &val, sizeof val) == -1)
+		    && (errno != EAGAIN))
+			break;
+	}
+
+	drain();
+	summarize(true);
+
+	return NULL;
+}
+
+/*
+ * public functions
+ */
+
+int
+alog_start(void)
+{
+	unsigned long i;
+	int ret;
+
+	for (i = 0; i < ALOG_RING; i++)
+		ring.slot[i].seq = i;
+	ring.head = ring.tail = 0;
+	ring.stop = false;
+
+	ring.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring.efd == -1) {
+		syslog(LOG_ERR, "alog eventfd: %s", strerror(errno));
+		return -1;
+	}
+
+	ret = rt_thread_create(&ring.thread, alog_thread, NULL);
+	if (ret != 0) {
+		syslog(LOG_ERR, "alog pthread_create: %s", strerror(ret));
+		close(ring.efd);
+		return -1;
+	}
+
+	__atomic_store_n(&ring.running, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void
+alog_post(struct alog_site_str *site, int prio, const char *fmt, ...)
+{
+	struct slot_str *slot;
+	unsigned long pos;
+	uint64_t one = 1;
+	va_list ap;
+
+	if ((site != NULL) && !rate_ok(site, prio, mono_sec()))
+		return;
+
+	va_start(ap, fmt);
+
+	if (!__atomic_load_n(&ring.running, __ATOMIC_ACQUIRE)) {
+		vsyslog(prio, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	slot = claim(&pos);
+	if (slot == NULL) {
+		__atomic_fetch_add(&ring.dropped, 1, __ATOMIC_RELAXED);
+		va_end(ap);
+		return;
+	}
+
+	slot->prio = prio;
+	vsnprintf(slot->msg, sizeof slot->msg, fmt, ap);
+	va_end(ap);
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* a nonblocking eventfd: at worst the thread finds it later */
+	if (write(ring.efd, &one, sizeof one) == -1)
+		return;
+}
+
+void
+alog_stop(void)
+{
+	uint64_t one = 1;
+
+	if (!__atomic_load_n(&ring.running, __ATOMIC_ACQUIRE))
+		return;
+
+	/* later messages go straight to syslog */
+	__atomic_store_n(&ring.running, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring.stop, true, __ATOMIC_RELEASE);
+	if (write(ring.efd, &one, sizeof one) == -1)
+		syslog(LOG_ERR, "alog eventfd write: %s", strerror(errno));
+
+	pthread_join(ring.thread, NULL);
+	close(ring.efd);
+}
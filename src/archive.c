@@ -0,0 +1,477 @@
+/*
+ * archive module: a low-priority thread that gzips closed dayfiles
+ * and enforces the retention policy
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "archive.h"
+#include "rt.h"
+#include "journal.h"
+#include "model.h"
+#include "util.h"
+
+/* from linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+
+#define COPY_BUF_SIZE 65536
+
+/* closed daily files worth compressing: dayfiles and daily rollups */
+static const char *const compressed[] = { ".dat", ".bin", ".min", ".hr" };
+
+/* rollups, which size-based retention spares for ARCHIVE_ROLLUP_DAYS */
+static const char *const rollups[] = {
+	".min", ".hr", ".min.gz", ".hr.gz", ".day"
+};
+
+/* kept whatever the limits, but counted against keep_bytes */
+static const char *const kept[] = { JOURNAL_FNAME, MODEL_FNAME };
+
+/*
+ * private functions
+ */
+
+/* nice 19, idle I/O class: only runs when nothing else wants to */
+static void
+set_low_priority(void)
+{
+	pid_t tid = syscall(SYS_gettid);
+
+	if (setpriority(PRIO_PROCESS, tid, 19) == -1)
+		syslog(LOG_WARNING, "archive setpriority: %s",
+		       strerror(errno));
+
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+		    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1)
+		syslog(LOG_WARNING, "archive ioprio_set: %s",
+		       strerror(errno));
+}
+
+/* YYYYMMDD.*, or the year's rollup YYYY.day */
+static int
+is_day_file(const struct dirent *ent)
+{
+	const char *name = ent->d_name;
+	int i;
+
+	for (i = 0; isdigit((unsigned char)name[i]); i++)
+		;
+
+	return ((i == 8) && (name[8] == '.'))
+		|| ((i == 4) && (strcmp(name + 4, ".day") == 0));
+}
+
+/* YYYYMMDD of the last day a file holds, not terminated */
+static void
+file_day(const char *name, char day[8])
+{
+	if (name[4] == '.') {
+		memcpy(day, name, 4);	/* YYYY.day */
+		memcpy(day + 4, "1231", 4);
+	} else {
+		memcpy(day, name, 8);
+	}
+}
+
+/* oldest first, a day's files together */
+static int
+cmp_day(const struct dirent **a, const struct dirent **b)
+{
+	char day_a[8], day_b[8];
+	int ret;
+
+	file_day((*a)->d_name, day_a);
+	file_day((*b)->d_name, day_b);
+	ret = memcmp(day_a, day_b, 8);
+
+	return (ret != 0) ? ret : strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static bool
+has_suffix(const char *name, const char *suffix)
+{
+	size_t len = strlen(name);
+	size_t slen = strlen(suffix);
+
+	return (len >= slen) && (strcmp(name + len - slen, suffix) == 0);
+}
+
+static bool
+has_any_suffix(const char *name, const char *const *suffixes, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++)
+		if (has_suffix(name, suffixes[i]))
+			return true;
+
+	return false;
+}
+
+static int
+gzip_fd(int fd, const char *dst_path)
+{
+	char *buf;
+	gzFile gz;
+	ssize_t n;
+	int ret = 0;
+
+	buf = malloc(COPY_BUF_SIZE);
+	if (buf == NULL)
+		return -1;
+
+	gz = gzopen(dst_path, "wb");
+	if (gz == NULL) {
+		free(buf);
+		return -1;
+	}
+
+	while ((n = readn(fd, buf, COPY_BUF_SIZE)) > 0) {
+		if (gzwrite(gz, buf, n) != n) {
+			ret = -1;
+			break;
+		}
+	}
+	if (n == -1)
+		ret = -1;
+
+	if (gzclose(gz) != Z_OK)
+		ret = -1;
+
+	free(buf);
+
+	return ret;
+}
+
+/* YYYYMMDD.dat -> YYYYMMDD.dat.gz, replacing the original */
+static int
+compress_file(const char *data_dir, const char *name)
+{
+	char *src, *tmp, *dst;
+	int fd;
+	int ret = -1;
+
+	if (asprintf(&src, "%s/%s", data_dir, name) == -1)
+		return -1;
+	if (asprintf(&tmp, "%s.gz.tmp", src) == -1) {
+		free(src);
+		return -1;
+	}
+	if (asprintf(&dst, "%s.gz", src) == -1) {
+		free(tmp);
+		free(src);
+		return -1;
+	}
+
+	fd = open(src, O_RDONLY);
+	if (fd != -1) {
+		if ((gzip_fd(fd, tmp) == 0) && (rename(tmp, dst) == 0)
+		    && (unlink(src) == 0))
+			ret = 0;
+		else
+			unlink(tmp);
+		close(fd);
+	}
+
+	if (ret == -1)
+		syslog(LOG_ERR, "archive compress(%s): %s",
+		       src, strerror(errno));
+
+	free(dst);
+	free(tmp);
+	free(src);
+
+	return ret;
+}
+
+static int
+remove_file(const char *data_dir, const char *name)
+{
+	char *path;
+	int ret;
+
+	if (asprintf(&path, "%s/%s", data_dir, name) == -1)
+		return -1;
+
+	ret = unlink(path);
+	if (ret == -1)
+		syslog(LOG_ERR, "archive unlink(%s): %s",
+		       path, strerror(errno));
+	else
+		syslog(LOG_INFO, "archive: removed %s", path);
+
+	free(path);
+
+	return ret;
+}
+
+static off_t
+file_size(const char *data_dir, const char *name)
+{
+	struct stat statbuf;
+	char *path;
+	off_t size = 0;
+
+	if (asprintf(&path, "%s/%s", data_dir, name) == -1)
+		return 0;
+
+	if (stat(path, &statbuf) == 0)
+		size = statbuf.st_size;
+	free(path);
+
+	return size;
+}
+
+/* YYYYMMDD, keep_days before today */
+static void
+cutoff_date(const struct tm *today, int keep_days, char *buf, size_t len)
+{
+	struct tm bdt = *today;
+	time_t t;
+
+	bdt.tm_mday -= keep_days;
+	bdt.tm_hour = 12;	/* clear of DST transitions */
+	bdt.tm_isdst = -1;
+	t = mktime(&bdt);
+	localtime_r(&t, &bdt);
+
+	strftime(buf, len, "%Y%m%d", &bdt);
+}
+
+static void
+free_names(struct dirent **names, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+}
+
+static void
+do_archive(const struct archive_str *archive, const struct tm *today)
+{
+	const char *dir = archive->data_dir;
+	struct dirent **names;
+	char today_buf[12], cutoff_buf[12], rollup_buf[12];
+	char day[8];
+	off_t total;
+	size_t k;
+	int n, i, j;
+
+	strftime(today_buf, sizeof today_buf, "%Y%m%d", today);
+
+	/* compress closed daily files */
+	if (archive->compress) {
+		n = scandir(dir, &names, is_day_file, cmp_day);
+		if (n == -1) {
+			syslog(LOG_ERR, "archive scandir(%s): %s",
+			       dir, strerror(errno));
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			file_day(names[i]->d_name, day);
+			if ((memcmp(day, today_buf, 8) < 0)
+			    && has_any_suffix(names[i]->d_name, compressed,
+					      ARRAY_SIZE(compressed)))
+				compress_file(dir, names[i]->d_name);
+		}
+		free_names(names, n);
+	}
+
+	if ((archive->keep_days == 0) && (archive->keep_bytes == 0))
+		return;
+
+	n = scandir(dir, &names, is_day_file, cmp_day);
+	if (n == -1) {
+		syslog(LOG_ERR, "archive scandir(%s): %s",
+		       dir, strerror(errno));
+		return;
+	}
+
+	/* retention by age: every file for days before the cutoff */
+	if (archive->keep_days != 0) {
+		cutoff_date(today, archive->keep_days,
+			    cutoff_buf, sizeof cutoff_buf);
+		for (i = 0; i < n; i++) {
+			file_day(names[i]->d_name, day);
+			if (memcmp(day, cutoff_buf, 8) < 0) {
+				remove_file(dir, names[i]->d_name);
+				names[i]->d_name[0] = '\0';
+			}
+		}
+	}
+
+	/*
+	 * retention by size: oldest days first, never today, nor the
+	 * recent rollups.  the journal and model are counted, not removed.
+	 */
+	if (archive->keep_bytes != 0) {
+		cutoff_date(today, ARCHIVE_ROLLUP_DAYS,
+			    rollup_buf, sizeof rollup_buf);
+
+		total = 0;
+		for (k = 0; k < ARRAY_SIZE(kept); k++)
+			total += file_size(dir, kept[k]);
+		for (i = 0; i < n; i++)
+			if (names[i]->d_name[0] != '\0')
+				total += file_size(dir, names[i]->d_name);
+
+		/* names are sorted, so a day's files are adjacent */
+		for (i = 0; (i < n) && (total > archive->keep_bytes); i = j) {
+			char next[8];
+
+			if (names[i]->d_name[0] == '\0') {
+				j = i + 1;
+				continue;
+			}
+			file_day(names[i]->d_name, day);
+			if (memcmp(day, today_buf, 8) >= 0)
+				break;
+
+			for (j = i; j < n; j++) {
+				const char *name = names[j]->d_name;
+
+				if (name[0] == '\0')
+					continue;
+				file_day(name, next);
+				if (memcmp(next, day, 8) != 0)
+					break;
+				if ((memcmp(day, rollup_buf, 8) >= 0)
+				    && has_any_suffix(name, rollups,
+						      ARRAY_SIZE(rollups)))
+					continue;
+				total -= file_size(dir, name);
+				remove_file(dir, name);
+			}
+		}
+	}
+
+	free_names(names, n);
+}
+
+static void *
+archive_thread(void *arg)
+{
+	struct archive_str *archive = arg;
+	struct tm today;
+
+	set_low_priority();
+
+	pthread_mutex_lock(&archive->lock);
+	for (;;) {
+		while (!archive->pending && !archive->stop)
+			pthread_cond_wait(&archive->cond, &archive->lock);
+		if (!archive->pending)
+			break;	/* stopped, nothing left to do */
+
+		archive->pending = false;
+		today = archive->today;
+
+		pthread_mutex_unlock(&archive->lock);
+		do_archive(archive, &today);
+		pthread_mutex_lock(&archive->lock);
+	}
+	pthread_mutex_unlock(&archive->lock);
+
+	return NULL;
+}
+
+/*
+ * public functions
+ */
+
+int
+archive_start(struct archive_str *archive)
+{
+	int ret;
+
+	archive->pending = false;
+	archive->stop = false;
+
+	if (archive->data_dir == NULL)
+		return 0;
+
+	pthread_mutex_init(&archive->lock, NULL);
+	pthread_cond_init(&archive->cond, NULL);
+
+	ret = rt_thread_create(&archive->thread, archive_thread, archive);
+	if (ret != 0) {
+		syslog(LOG_ERR, "archive pthread_create: %s", strerror(ret));
+		archive->data_dir = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+archive_notify(struct archive_str *archive, const struct tm *today)
+{
+	if (archive->data_dir == NULL)
+		return;
+
+	pthread_mutex_lock(&archive->lock);
+	archive->today = *today;
+	archive->pending = true;
+	pthread_cond_signal(&archive->cond);
+	pthread_mutex_unlock(&archive->lock);
+}
+
+void
+archive_stop(struct archive_str *archive)
+{
+	if (archive->data_dir == NULL)
+		return;
+
+	pthread_mutex_lock(&archive->lock);
+	archive->stop = true;
+	pthread_cond_signal(&archive->cond);
+	pthread_mutex_unlock(&archive->lock);
+
+	pthread_join(archive->thread, NULL);
+
+	pthread_mutex_destroy(&archive->lock);
+	pthread_cond_destroy(&archive->cond);
+}
@@ -27,18 +27,27 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <syslog.h>
 #include <getopt.h>
-#include <gpiod.h>
+#include <signal.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 
-#include "mcp9808.h"
 #include "thermostat.h"
 #include "cfgfile.h"
 #include "schedule.h"
 #include "controls.h"
+#include "sim.h"
+#include "sensor.h"
+#include "actuator.h"
+#include "archive.h"
+#include "sink.h"
+#include "iosync.h"
+#include "stage.h"
+#include "alog.h"
+#include "rt.h"
+#include "cycle.h"
 #include "util.h"
 
 #define PGM_NAME program_invocation_short_name
@@ -52,6 +61,14 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 #define DFLT_CONFIG_FILE      "bang.cfg"
 #define DFLT_DATA_INTERVAL    60
 #define DFLT_CTRL_DIR         ".bang"
+#define DFLT_SENSOR           "mcp9808"
+#define DFLT_RELAY            "gpio"
+#define DFLT_KEYFRAME         10
+#define DFLT_SINK             "dat"
+#define DFLT_BATCH            1
+#define DFLT_SYNC             "none"
+
+#define MAX_SINKS 8
 
 #define MAX_EVENTS 100
 
@@ -61,10 +78,38 @@ struct options_str {
 	bool gpio_active_low;
 	const char *i2c_device;
 	uint8_t mcp9808_i2c_addr;
+	enum mcp9808_res_enum resolution;
+	bool oneshot;		/* shut the MCP9808 down between reads */
+	int alert_offset;	/* gpio of the MCP9808 ALERT, -1: none */
 	const char *data_dir;
 	int data_interval;
+	double log_delta;	/* zero: log every interval */
+	int keyframe;		/* minutes */
+	const char *sink[MAX_SINKS];
+	size_t num_sinks;
+	int batch;		/* records per write */
+	const char *sync_policy;
+	enum sink_sync_enum sync;
+	int sync_every;		/* records or seconds */
 	const char *config_file;
 	const char *ctrl_dir;
+	const char *sensor;
+	int stale_sec;		/* hold the last reading, then heat off */
+	int burst;		/* sensor samples per reading */
+	const char *relay;
+	int min_on;		/* seconds, zero: no limit */
+	int min_off;		/* seconds, zero: no limit */
+	int max_cycles;		/* relay starts per hour, zero: no limit */
+	long sim_days;		/* zero: run on real hardware */
+	time_t sim_start;
+	bool compress;
+	int keep_days;		/* zero: keep forever */
+	long keep_mb;		/* zero: no size limit */
+	const char *stage_dir;	/* NULL: sinks write to data_dir */
+	int stage_sync;		/* seconds between copies to data_dir */
+	int rt_prio;		/* SCHED_FIFO priority, zero: normal */
+	bool mlock;
+	int cpu;		/* -1: not pinned */
 	/* FIXME: consider removing these last two */
 	bool force;
 	bool test;
@@ -97,15 +142,82 @@ print_help(void)
 	printf("  -a, --i2c-addr=ADDR:\tslave address of MCP9808"
 	       " (default: 0x%02x)\n",
 		DFLT_MCP9808_I2C_ADDR);
+	printf("  -R, --resolution=DEG:\tMCP9808 resolution, 0.5, 0.25,"
+	       " 0.125\n");
+	printf("                     \tor 0.0625 (default), conversion"
+	       " takes\n");
+	printf("                     \t30, 65, 130 or 250 ms\n");
+	printf("  -O, --oneshot:\tshut the MCP9808 down between reads\n");
+	printf("  -A, --alert=OFST:\tgpio offset wired to MCP9808 ALERT,"
+	       " act on\n");
+	printf("                     \tthreshold crossings within the"
+	       " second, and\n");
+	printf("                     \tread the sensor every %d s"
+	       " otherwise\n", ALERT_POLL_SEC);
 	printf("  -d, --data-dir=DIR:\tdata directory (default: %s)\n",
 		"stdout");
 	printf("  -s, --data-int=SEC:\tdata logging interval (default: %d)\n",
 	       DFLT_DATA_INTERVAL);
 	printf("                     \t(zero to disable)\n");
+	printf("  -D, --delta=DEG:\tlog only when temperature moves DEG"
+	       " or\n");
+	printf("                     \tsetpoint, relay or mode changes\n");
+	printf("  -F, --keyframe=MIN:\tfull record at least every MIN in"
+	       " delta\n");
+	printf("                     \tmode (default: %d)\n",
+	       DFLT_KEYFRAME);
+	printf("  -o, --sink=TYPE[@SEC][:FILE]:\n");
+	printf("                     \tlog output, repeatable (default: %s)\n",
+	       DFLT_SINK);
+	printf("                     \tdat, bin: daily files in data-dir\n");
+	printf("                     \tinflux, json: FILE (default:"
+	       " stdout)\n");
+	printf("                     \tSEC overrides --data-int\n");
+	printf("  -b, --batch=N:\t\trecords per write (default: %d)\n",
+	       DFLT_BATCH);
+	printf("  -y, --sync=POLICY:\tfdatasync policy (default: %s)\n",
+	       DFLT_SYNC);
+	printf("                     \tnone, N records, Ns seconds, or"
+	       " change\n");
 	printf("  -c, --config=FILE:\tconfig file (default: %s)\n",
 	       DFLT_CONFIG_FILE);
 	printf("  -k, --ctrl-dir=DIR:\tdirectory for control files"
 	       " (default: %s)\n", DFLT_CTRL_DIR);
+	printf("  -e, --sensor=SPEC:\ttemperature sensor (default: %s)\n",
+	       DFLT_SENSOR);
+	printf("                     \t(mcp9808, hwmon:PATH"
+	       " or replay:DAYFILE)\n");
+	printf("  -E, --stale=SEC:\thold the last reading SEC through"
+	       " sensor\n");
+	printf("                     \tfaults, then heat off (default: %d)\n",
+	       SENSOR_STALE_SEC);
+	printf("  -B, --burst=K:\t\ttake K samples per reading, drop"
+	       " outliers\n");
+	printf("                     \t(default: 1, max: %d)\n",
+	       SENSOR_BURST_MAX);
+	printf("  -r, --relay=SPEC:\theat relay, gpio or fake"
+	       " (default: %s)\n", DFLT_RELAY);
+	printf("  -m, --min-on=SEC:\tkeep the heat on at least SEC\n");
+	printf("  -q, --min-off=SEC:\tkeep the heat off at least SEC\n");
+	printf("  -x, --max-cycles=N:\tat most N heat starts per hour"
+	       " (max: %d)\n", CYCLE_MAX_PER_HOUR);
+	printf("  -S, --simulate=DAYS:\trun simulated plant for DAYS,"
+	       " no hardware\n");
+	printf("  -t, --sim-start=SSE:\tsimulation start, seconds since"
+	       " epoch\n");
+	printf("                     \t(default: now)\n");
+	printf("  -z, --compress:\tgzip dayfiles once closed\n");
+	printf("  -K, --keep-days=DAYS:\tremove data older than DAYS\n");
+	printf("  -M, --keep-mb=MB:\tremove oldest data beyond MB total\n");
+	printf("  -w, --stage-dir=DIR:\twrite dayfiles and rollups to DIR"
+	       " (tmpfs),\n");
+	printf("                     \tcopy to data-dir periodically\n");
+	printf("  -W, --stage-sync=SEC:\tseconds between copies"
+	       " (default: %d)\n", STAGE_SYNC_SEC);
+	printf("  -P, --rt-prio=N:\trun the control loop SCHED_FIFO at"
+	       " priority N\n");
+	printf("  -L, --mlock:\t\tlock and pre-fault memory\n");
+	printf("  -C, --cpu=N:\t\tpin the control loop to CPU N\n");
 	printf("  -f, --force:\t\toverride option warnings\n");
 	printf("  -T, --test:\t\tperform hardware test\n");
 }
@@ -162,6 +274,21 @@ parse_options(int argc, char *argv[], struct options_str *options)
 			.flag = NULL,
 			.val = 'a',
 		},
+		{       .name = "resolution",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'R',
+		},
+		{       .name = "oneshot",
+			.has_arg = no_argument,
+			.flag = NULL,
+			.val = 'O',
+		},
+		{       .name = "alert",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'A',
+		},
 		{       .name = "data-dir",
 			.has_arg = required_argument,
 			.flag = NULL,
@@ -172,6 +299,31 @@ parse_options(int argc, char *argv[], struct options_str *options)
 			.flag = NULL,
 			.val = 's',
 		},
+		{       .name = "delta",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'D',
+		},
+		{       .name = "keyframe",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'F',
+		},
+		{       .name = "sink",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'o',
+		},
+		{       .name = "batch",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'b',
+		},
+		{       .name = "sync",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'y',
+		},
 		{       .name = "config",
 			.has_arg = required_argument,
 			.flag = NULL,
@@ -182,6 +334,91 @@ parse_options(int argc, char *argv[], struct options_str *options)
 			.flag = NULL,
 			.val = 'k',
 		},
+		{       .name = "sensor",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'e',
+		},
+		{       .name = "stale",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'E',
+		},
+		{       .name = "burst",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'B',
+		},
+		{       .name = "relay",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'r',
+		},
+		{       .name = "min-on",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'm',
+		},
+		{       .name = "min-off",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'q',
+		},
+		{       .name = "max-cycles",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'x',
+		},
+		{       .name = "simulate",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'S',
+		},
+		{       .name = "sim-start",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 't',
+		},
+		{       .name = "compress",
+			.has_arg = no_argument,
+			.flag = NULL,
+			.val = 'z',
+		},
+		{       .name = "keep-days",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'K',
+		},
+		{       .name = "keep-mb",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'M',
+		},
+		{       .name = "stage-dir",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'w',
+		},
+		{       .name = "stage-sync",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'W',
+		},
+		{       .name = "rt-prio",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'P',
+		},
+		{       .name = "mlock",
+			.has_arg = no_argument,
+			.flag = NULL,
+			.val = 'L',
+		},
+		{       .name = "cpu",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'C',
+		},
 		{       .name = "force",
 			.has_arg = no_argument,
 			.flag = NULL,
@@ -194,13 +431,31 @@ parse_options(int argc, char *argv[], struct options_str *options)
 		},
 		{ NULL, 0, NULL, 0 }  /* terminate */
 	};
-	static const char *const shortopts = ":hvg:n:p:i:a:d:s:c:k:fT";
+	static const char *const shortopts = ":hvg:n:p:i:a:R:OA:d:s:D:F:o:b:y:c:k:e:E:B:r:m:q:x:S:t:zK:M:w:W:P:LC:fT";
 	int optc, opti;
 	const char *n_arg = NULL;
 	const char *p_arg = NULL;
 	const char *a_arg = NULL;
+	const char *R_arg = NULL;
+	const char *A_arg = NULL;
 	const char *s_arg = NULL;
+	const char *D_arg = NULL;
+	const char *F_arg = NULL;
+	const char *b_arg = NULL;
+	const char *E_arg = NULL;
+	const char *B_arg = NULL;
+	const char *m_arg = NULL;
+	const char *q_arg = NULL;
+	const char *x_arg = NULL;
+	const char *S_arg = NULL;
+	const char *t_arg = NULL;
+	const char *K_arg = NULL;
+	const char *M_arg = NULL;
+	const char *W_arg = NULL;
+	const char *P_arg = NULL;
+	const char *C_arg = NULL;
 	long long val;
+	double dval;
 	char *endptr;
 
 	options->gpio_device = DFLT_GPIO_DEVICE;
@@ -208,10 +463,37 @@ parse_options(int argc, char *argv[], struct options_str *options)
 	options->gpio_active_low = DFLT_GPIO_ACTIVE_LOW;
 	options->i2c_device = DFLT_I2C_DEVICE;
 	options->mcp9808_i2c_addr = DFLT_MCP9808_I2C_ADDR;
+	options->resolution = MCP9808_RES_0_0625;
+	options->oneshot = false;
+	options->alert_offset = -1;
 	options->data_dir = NULL; /* stdout */
 	options->data_interval = DFLT_DATA_INTERVAL;
+	options->log_delta = 0.0;
+	options->keyframe = DFLT_KEYFRAME;
+	options->num_sinks = 0;
+	options->batch = DFLT_BATCH;
+	options->sync_policy = DFLT_SYNC;
+	options->sync = SINK_SYNC_NONE;
+	options->sync_every = 0;
 	options->config_file = DFLT_CONFIG_FILE;
 	options->ctrl_dir = DFLT_CTRL_DIR;
+	options->sensor = DFLT_SENSOR;
+	options->stale_sec = SENSOR_STALE_SEC;
+	options->burst = 1;
+	options->relay = DFLT_RELAY;
+	options->min_on = 0;
+	options->min_off = 0;
+	options->max_cycles = 0;
+	options->sim_days = 0;
+	options->sim_start = time(NULL);
+	options->compress = false;
+	options->keep_days = 0;
+	options->keep_mb = 0;
+	options->stage_dir = NULL;
+	options->stage_sync = STAGE_SYNC_SEC;
+	options->rt_prio = 0;
+	options->mlock = false;
+	options->cpu = -1;
 	options->force = false;
 	options->test = false;
 
@@ -249,6 +531,18 @@ parse_options(int argc, char *argv[], struct options_str *options)
 			a_arg = optarg;
 			break;
 
+		case 'R':
+			R_arg = optarg;
+			break;
+
+		case 'O':
+			options->oneshot = true;
+			break;
+
+		case 'A':
+			A_arg = optarg;
+			break;
+
 		case 'd':
 			options->data_dir = optarg;
 			break;
@@ -257,6 +551,31 @@ parse_options(int argc, char *argv[], struct options_str *options)
 			s_arg = optarg;
 			break;
 
+		case 'D':
+			D_arg = optarg;
+			break;
+
+		case 'F':
+			F_arg = optarg;
+			break;
+
+		case 'o':
+			if (options->num_sinks == MAX_SINKS) {
+				fprintf(stderr, "%s: too many sinks\n",
+					PGM_NAME);
+				return -1;
+			}
+			options->sink[options->num_sinks++] = optarg;
+			break;
+
+		case 'b':
+			b_arg = optarg;
+			break;
+
+		case 'y':
+			options->sync_policy = optarg;
+			break;
+
 		case 'c':
 			options->config_file = optarg;
 			break;
@@ -265,6 +584,74 @@ parse_options(int argc, char *argv[], struct options_str *options)
 			options->ctrl_dir = optarg;
 			break;
 
+		case 'e':
+			options->sensor = optarg;
+			break;
+
+		case 'E':
+			E_arg = optarg;
+			break;
+
+		case 'B':
+			B_arg = optarg;
+			break;
+
+		case 'r':
+			options->relay = optarg;
+			break;
+
+		case 'm':
+			m_arg = optarg;
+			break;
+
+		case 'q':
+			q_arg = optarg;
+			break;
+
+		case 'x':
+			x_arg = optarg;
+			break;
+
+		case 'S':
+			S_arg = optarg;
+			break;
+
+		case 't':
+			t_arg = optarg;
+			break;
+
+		case 'z':
+			options->compress = true;
+			break;
+
+		case 'K':
+			K_arg = optarg;
+			break;
+
+		case 'M':
+			M_arg = optarg;
+			break;
+
+		case 'w':
+			options->stage_dir = optarg;
+			break;
+
+		case 'W':
+			W_arg = optarg;
+			break;
+
+		case 'P':
+			P_arg = optarg;
+			break;
+
+		case 'L':
+			options->mlock = true;
+			break;
+
+		case 'C':
+			C_arg = optarg;
+			break;
+
 		case 'f':
 			options->force = true;
 			break;
@@ -324,6 +711,31 @@ parse_options(int argc, char *argv[], struct options_str *options)
 		options->mcp9808_i2c_addr = val;
 	}
 
+	if (R_arg != NULL) {
+		/* 0.5 deg C, halved per step: exact in binary */
+		dval = strtod(R_arg, &endptr);
+		for (val = 0; val < MCP9808_NUM_RES; val++)
+			if (dval == 0.5 / (1 << val))
+				break;
+		if ((val == MCP9808_NUM_RES) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: resolution %s invalid\n",
+				PGM_NAME, R_arg);
+			return -1;
+		}
+		options->resolution = val;
+	}
+
+	if (A_arg != NULL) {
+		val = strtoll(A_arg, &endptr, 0);
+		if ((val < 0) || (val > 0xFFFF) || (*endptr != '\0')) {
+			fprintf(stderr, "%s: alert gpio %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->alert_offset = val;
+	}
+
 	if (s_arg != NULL) {
 		val = strtoll(s_arg, &endptr, 0);
 		if ((val < 0) || (val > 86400) || (*endptr != '\0')) {
@@ -335,6 +747,197 @@ parse_options(int argc, char *argv[], struct options_str *options)
 		options->data_interval = val;
 	}
 
+	if (D_arg != NULL) {
+		dval = strtod(D_arg, &endptr);
+		if (!(dval > 0.0) || (dval > 10.0) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: delta %s invalid\n",
+				PGM_NAME, D_arg);
+			return -1;
+		}
+		options->log_delta = dval;
+	}
+
+	if (F_arg != NULL) {
+		val = strtoll(F_arg, &endptr, 0);
+		if ((val <= 0) || (val > 60) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: keyframe interval %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->keyframe = val;
+	}
+
+	if (b_arg != NULL) {
+		val = strtoll(b_arg, &endptr, 0);
+		if ((val <= 0) || (val > SINK_MAX_BATCH) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: batch %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->batch = val;
+	}
+
+	if (strcmp(options->sync_policy, "none") == 0) {
+		options->sync = SINK_SYNC_NONE;
+	} else if (strcmp(options->sync_policy, "change") == 0) {
+		options->sync = SINK_SYNC_CHANGE;
+	} else {
+		val = strtoll(options->sync_policy, &endptr, 0);
+		if (*endptr == 's') {
+			options->sync = SINK_SYNC_SECONDS;
+			endptr++;
+		} else {
+			options->sync = SINK_SYNC_RECORDS;
+		}
+		if ((val <= 0) || (val > 86400) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: sync policy %s invalid\n",
+				PGM_NAME, options->sync_policy);
+			return -1;
+		}
+		options->sync_every = val;
+	}
+
+	if (options->num_sinks == 0)
+		options->sink[options->num_sinks++] = DFLT_SINK;
+
+	if (E_arg != NULL) {
+		val = strtoll(E_arg, &endptr, 0);
+		if ((val < 0) || (val > 3600) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: staleness budget %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->stale_sec = val;
+	}
+
+	if (B_arg != NULL) {
+		val = strtoll(B_arg, &endptr, 0);
+		if ((val <= 0) || (val > SENSOR_BURST_MAX)
+		    || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: burst %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->burst = val;
+	}
+
+	if (m_arg != NULL) {
+		val = strtoll(m_arg, &endptr, 0);
+		if ((val < 0) || (val > 3600) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: minimum on time %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->min_on = val;
+	}
+
+	if (q_arg != NULL) {
+		val = strtoll(q_arg, &endptr, 0);
+		if ((val < 0) || (val > 3600) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: minimum off time %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->min_off = val;
+	}
+
+	if (x_arg != NULL) {
+		val = strtoll(x_arg, &endptr, 0);
+		if ((val < 0) || (val > CYCLE_MAX_PER_HOUR)
+		    || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: cycles per hour %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->max_cycles = val;
+	}
+
+	if (S_arg != NULL) {
+		val = strtoll(S_arg, &endptr, 0);
+		if ((val <= 0) || (val > 3660) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: simulation days %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->sim_days = val;
+	}
+
+	if (t_arg != NULL) {
+		val = strtoll(t_arg, &endptr, 0);
+		if ((val < 0) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: simulation start %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->sim_start = val;
+	}
+
+	if (K_arg != NULL) {
+		val = strtoll(K_arg, &endptr, 0);
+		if ((val <= 0) || (val > 36600) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: keep days %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->keep_days = val;
+	}
+
+	if (M_arg != NULL) {
+		val = strtoll(M_arg, &endptr, 0);
+		if ((val <= 0) || (val > 1048576) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: keep megabytes %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->keep_mb = val;
+	}
+
+	if (W_arg != NULL) {
+		val = strtoll(W_arg, &endptr, 0);
+		if ((val <= 0) || (val > 86400) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: stage sync interval %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->stage_sync = val;
+	}
+
+	if (P_arg != NULL) {
+		val = strtoll(P_arg, &endptr, 0);
+		if ((val <= 0) || (val > 99) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: real-time priority %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->rt_prio = val;
+	}
+
+	if (C_arg != NULL) {
+		val = strtoll(C_arg, &endptr, 0);
+		if ((val < 0) || (val >= CPU_SETSIZE) || (*endptr != '\0')) {
+			fprintf(stderr,
+				"%s: cpu %lld invalid\n",
+				PGM_NAME, val);
+			return -1;
+		}
+		options->cpu = val;
+	}
+
 	return 0;
 }
 
@@ -360,121 +963,94 @@ validate_options(const struct options_str *options)
 		return -1;
 	}
 
-	return 0;
-}
-
-/*
- * GPIO
- */
+	/* the comparator only runs while converting */
+	if ((options->alert_offset != -1) && options->oneshot) {
+		fprintf(stderr, "%s: alert and oneshot are exclusive\n",
+			PGM_NAME);
+		return -1;
+	}
 
-static int
-open_gpio_chip(const char *device_name,
-	struct gpiod_chip **chip)
-{
-	*chip = gpiod_chip_open_by_name(device_name);
-	if (*chip == NULL) {
-		fprintf(stderr,
-			"%s, gpiod chip open(%s): %s\n",
-			PGM_NAME, device_name, strerror(errno));
+	if ((options->stage_dir != NULL) && (options->data_dir == NULL)) {
+		fprintf(stderr, "%s: stage-dir requires data-dir\n",
+			PGM_NAME);
 		return -1;
 	}
 
 	return 0;
 }
 
+/*
+ * hardware backends
+ *     sensor: mcp9808, hwmon:PATH or replay:DAYFILE
+ *     relay:  gpio or fake
+ */
+
 static int
-open_gpio_line(struct gpiod_chip *chip,
-	       unsigned offset,
-	       bool active_low,
-	       struct gpiod_line **line)
+open_sensor(const struct options_str *options, struct sensor_str *sensor)
 {
-	struct gpiod_line_request_config config;
-	int ret;
-
-	*line = gpiod_chip_get_line(chip, offset);
-	if (*line == NULL) {
-		fprintf(stderr,
-			"%s, gpiod get line(%u): %s\n",
-			PGM_NAME, offset, strerror(errno));
-		return -1;
-	}
-
-	config.consumer = PGM_NAME;
-	config.request_type = GPIOD_LINE_REQUEST_DIRECTION_OUTPUT;
-	config.flags = active_low * GPIOD_LINE_REQUEST_FLAG_ACTIVE_LOW;
-
-	/* set to output, initial value 0 */
-	ret = gpiod_line_request(*line, &config, 0);
-	if (ret == -1) {
-		fprintf(stderr,
-			"%s, gpiod line request: %s\n",
-			PGM_NAME, strerror(errno));
-		return -1;
-	}
-
-	return 0;
+	const char *spec = options->sensor;
+
+	if (strcmp(spec, "mcp9808") == 0)
+		return sensor_open_mcp9808(sensor, options->i2c_device,
+					   options->mcp9808_i2c_addr,
+					   options->resolution, options->oneshot);
+	if (strncmp(spec, "hwmon:", 6) == 0)
+		return sensor_open_hwmon(sensor, spec + 6);
+	if (strncmp(spec, "replay:", 7) == 0)
+		return sensor_open_replay(sensor, spec + 7);
+
+	fprintf(stderr, "%s: unrecognized sensor: %s\n", PGM_NAME, spec);
+	return -1;
 }
 
 static int
-open_gpio(const struct options_str *options,
-	  struct gpiod_chip **chip,
-	  struct gpiod_line **line)
+open_relay(const struct options_str *options, struct actuator_str *actuator)
 {
-	if (open_gpio_chip(options->gpio_device, chip) == -1)
-		return -1;
-
-	if (open_gpio_line(*chip, options->gpio_offset,
-			   options->gpio_active_low,
-			   line) == -1)
-		return -1;
+	const char *spec = options->relay;
 
-	return 0;
-}
+	if (strcmp(spec, "gpio") == 0)
+		return actuator_open_gpiod(actuator, options->gpio_device,
+					   options->gpio_offset,
+					   options->gpio_active_low);
+	if (strcmp(spec, "fake") == 0)
+		return actuator_open_fake(actuator);
 
-static void
-close_gpio(struct gpiod_chip *chip,
-	   struct gpiod_line *line)
-{
-	gpiod_line_release(line);
-	gpiod_chip_close(chip);
+	fprintf(stderr, "%s: unrecognized relay: %s\n", PGM_NAME, spec);
+	return -1;
 }
 
-/*
- * I2C
- */
 static int
-open_i2c(const struct options_str *options)
+open_sinks(const struct options_str *options, struct sink_str *sinks,
+	   struct iosync_str *iosync)
 {
-	char *path;
-	int ret;
-	int fd;
-
-	ret = asprintf(&path, "/dev/%s", options->i2c_device);
-	if (ret == -1) {
-		fprintf(stderr,
-			"%s, asprintf(%s): %s\n",
-			PGM_NAME, options->i2c_device, strerror(errno));
-		return -1;
-	}
+	size_t i;
 
-	fd = open(path, O_RDWR);
-	if (fd == -1)
-		fprintf(stderr,
-			"%s, open(%s): %s\n",
-			PGM_NAME, path, strerror(errno));
-
-	free(path);
+	for (i = 0; i < options->num_sinks; i++) {
+		struct sink_str *sink = &sinks[i];
 
-	return fd;
-}
+		if (sink_init(sink, options->sink[i]) == -1) {
+			fprintf(stderr, "%s: unrecognized sink: %s\n",
+				PGM_NAME, options->sink[i]);
+			return -1;
+		}
 
-static int
-close_i2c(int i2c_fd)
-{
-	if (close(i2c_fd) == -1) {
-		syslog(LOG_ERR, "I2C close: %s",
-		       strerror(errno));
-		return -1;
+		if (sink->interval == 0)
+			sink->interval = options->data_interval;
+		/* staged files are copied to data_dir behind their back */
+		sink->data_dir = (options->stage_dir != NULL)
+			? options->stage_dir : options->data_dir;
+		sink->delta = options->log_delta;
+		sink->keyframe = options->keyframe * 60;
+		sink->batch = options->batch;
+		sink->sync = options->sync;
+		sink->sync_every = options->sync_every;
+		sink->iosync = iosync;
+
+		if (sink_open(sink) == -1) {
+			fprintf(stderr, "%s: %s sink: %s\n",
+				PGM_NAME, options->sink[i], strerror(errno));
+			return -1;
+		}
 	}
 
 	return 0;
@@ -483,30 +1059,102 @@ close_i2c(int i2c_fd)
 static void
 log_options(const struct options_str *options)
 {
+	size_t i;
+
 	syslog(LOG_INFO, "options:");
 	syslog(LOG_INFO, "    gpio-dvc: %s", options->gpio_device);
 	syslog(LOG_INFO, "    gpio-num: %u", options->gpio_offset);
 	syslog(LOG_INFO, "    gpio-pol: %d", !options->gpio_active_low);
 	syslog(LOG_INFO, "    i2c-dvc: %s", options->i2c_device);
 	syslog(LOG_INFO, "    i2c-addr: 0x%02X", options->mcp9808_i2c_addr);
+	syslog(LOG_INFO, "    resolution: %g",
+	       0.5 / (1 << options->resolution));
+	syslog(LOG_INFO, "    oneshot: %s",
+	       options->oneshot ? "true" : "false");
+	syslog(LOG_INFO, "    alert: %d", options->alert_offset);
 	syslog(LOG_INFO, "    data-dir: %s",
 	       (options->data_dir == NULL) ? "stdout" : options->data_dir);
 	syslog(LOG_INFO, "    data-int: %d", options->data_interval);
+	syslog(LOG_INFO, "    delta: %.2f", options->log_delta);
+	syslog(LOG_INFO, "    keyframe: %d", options->keyframe);
+	for (i = 0; i < options->num_sinks; i++)
+		syslog(LOG_INFO, "    sink: %s", options->sink[i]);
+	syslog(LOG_INFO, "    batch: %d", options->batch);
+	syslog(LOG_INFO, "    sync: %s", options->sync_policy);
 	syslog(LOG_INFO, "    config: %s", options->config_file);
 	syslog(LOG_INFO, "    ctrl-dir: %s", options->ctrl_dir);
+	syslog(LOG_INFO, "    sensor: %s", options->sensor);
+	syslog(LOG_INFO, "    stale: %d", options->stale_sec);
+	syslog(LOG_INFO, "    burst: %d", options->burst);
+	syslog(LOG_INFO, "    relay: %s", options->relay);
+	syslog(LOG_INFO, "    min-on: %d", options->min_on);
+	syslog(LOG_INFO, "    min-off: %d", options->min_off);
+	syslog(LOG_INFO, "    max-cycles: %d", options->max_cycles);
+	syslog(LOG_INFO, "    simulate: %ld", options->sim_days);
+	if (options->sim_days != 0)
+		syslog(LOG_INFO, "    sim-start: %ld",
+		       (long)options->sim_start);
+	syslog(LOG_INFO, "    compress: %s",
+	       options->compress ? "true" : "false");
+	syslog(LOG_INFO, "    keep-days: %d", options->keep_days);
+	syslog(LOG_INFO, "    keep-mb: %ld", options->keep_mb);
+	syslog(LOG_INFO, "    stage-dir: %s",
+	       (options->stage_dir == NULL) ? "none" : options->stage_dir);
+	syslog(LOG_INFO, "    stage-sync: %d", options->stage_sync);
+	syslog(LOG_INFO, "    rt-prio: %d", options->rt_prio);
+	syslog(LOG_INFO, "    mlock: %s", options->mlock ? "true" : "false");
+	syslog(LOG_INFO, "    cpu: %d", options->cpu);
 	syslog(LOG_INFO, "    force: %s", options->force ? "true" : "false");
 	syslog(LOG_INFO, "    test: %s", options->test ? "true" : "false");
 }
 
+static void
+handle_stop(int sig)
+{
+	(void)sig;
+	tstat_stop();
+}
+
+/* SIGTERM, SIGINT: leave the control loop and shut down cleanly */
+static int
+catch_stop_signals(void)
+{
+	struct sigaction act;
+
+	memset(&act, 0, sizeof act);
+	act.sa_handler = handle_stop;
+	sigemptyset(&act.sa_mask);
+
+	if ((sigaction(SIGTERM, &act, NULL) == -1)
+	    || (sigaction(SIGINT, &act, NULL) == -1)) {
+		syslog(LOG_ERR, "sigaction: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 /* M A I N */
 int
 main(int argc, char *argv[])
 {
 	struct options_str options;
-	struct gpiod_chip *chip;
-	struct gpiod_line *line;
-	int i2c_fd;
+	struct sensor_str sensor;
+	struct actuator_str actuator;
 	struct schedule_str schedule;
+	struct sim_str sim;
+	struct sim_str *simp = NULL;
+	struct archive_str archive;
+	struct stage_str stage;
+	struct rt_str rt;
+	struct control_str control;
+	struct tm today;
+	time_t now;
+	int status;
+	struct datalog_str datalog;
+	static struct sink_str sinks[MAX_SINKS];
+	static struct iosync_str iosync;
+	size_t i;
 
 	if ((parse_options(argc, argv, &options) == -1)
 	    || (validate_options(&options) == -1))
@@ -515,25 +1163,34 @@ main(int argc, char *argv[])
 	/* set control directory from options */
 	schedule.ctrl_dir = options.ctrl_dir;
 
-	if (open_gpio(&options, &chip, &line) == -1)
-		exit(EXIT_FAILURE);
-
-	i2c_fd = open_i2c(&options);
-	if (i2c_fd == -1)
-		exit(EXIT_FAILURE);
-
-	if (mcp9808_config(i2c_fd, options.mcp9808_i2c_addr) == -1)
-		exit(EXIT_FAILURE);
-
-	/* test communications to MCP9808 */
-	if (mcp9808_read_temp(i2c_fd, NULL, NULL) == -1) {
-		fprintf(stderr, "read temp: %s\n", strerror(errno));
-		exit(EXIT_FAILURE);
+	if (options.sim_days != 0) {
+		/* virtual clock, thermal model and fake relay */
+		sim_init(&sim, options.sim_start, options.sim_days * 86400L);
+		simp = &sim;
+		sim_sensor_open(&sensor, &sim);
+		sim_actuator_open(&actuator, &sim);
+	} else {
+		if (open_relay(&options, &actuator) == -1)
+			exit(EXIT_FAILURE);
+
+		if (open_sensor(&options, &sensor) == -1)
+			exit(EXIT_FAILURE);
+
+		if ((options.alert_offset != -1)
+		    && (sensor_alert_open(&sensor, options.gpio_device,
+					  options.alert_offset) == -1))
+			exit(EXIT_FAILURE);
 	}
+	sensor.stale_sec = options.stale_sec;
+	sensor.burst = options.burst;
 
 	openlog(program_invocation_short_name, LOG_ODELAY, LOG_USER);
 	syslog(LOG_INFO, "started");
 
+	/* from here on, the control loop's syslog goes through a thread */
+	if (alog_start() == -1)
+		exit(EXIT_FAILURE);
+
 	log_options(&options);
 
 	/* load config file */
@@ -544,15 +1201,86 @@ main(int argc, char *argv[])
 	if (ctrls_init(&schedule) == -1)
 		exit(EXIT_FAILURE);
 
-	tstat_control(line, i2c_fd, &schedule,
-		      options.data_dir, options.data_interval);
-	/* should never get here */
+	/* compression and retention of closed dayfiles */
+	archive.data_dir = NULL;
+	if ((options.data_dir != NULL)
+	    && (options.compress || (options.keep_days != 0)
+		|| (options.keep_mb != 0))) {
+		archive.data_dir = options.data_dir;
+		archive.compress = options.compress;
+		archive.keep_days = options.keep_days;
+		archive.keep_bytes = options.keep_mb * 1024LL * 1024;
+	}
+	if (archive_start(&archive) == -1)
+		exit(EXIT_FAILURE);
+
+	/* dayfiles in RAM, copied to data_dir in large chunks */
+	stage.stage_dir = options.stage_dir;
+	stage.data_dir = options.data_dir;
+	stage.sync_sec = options.stage_sync;
+	stage.archive = &archive;
+	now = (simp != NULL) ? options.sim_start : time(NULL);
+	if ((localtime_r(&now, &today) == NULL)
+	    || (stage_start(&stage, &today) == -1))
+		exit(EXIT_FAILURE);
+
+	/*
+	 * fdatasync runs on its own thread, off the control loop: for
+	 * the sinks, by policy, and for each journal record
+	 */
+	if (((options.sync != SINK_SYNC_NONE) || (options.data_dir != NULL))
+	    && (iosync_start(&iosync) == -1))
+		exit(EXIT_FAILURE);
+
+	if (open_sinks(&options, sinks, &iosync) == -1)
+		exit(EXIT_FAILURE);
+
+	datalog.data_dir = options.data_dir;
+	datalog.sinks = sinks;
+	datalog.num_sinks = options.num_sinks;
+	datalog.archive = &archive;
+	datalog.stage = (options.stage_dir != NULL) ? &stage : NULL;
+	datalog.iosync = (options.data_dir != NULL) ? &iosync : NULL;
+
+	if (catch_stop_signals() == -1)
+		exit(EXIT_FAILURE);
+
+	/* last, so the I/O threads started above stay unpinned */
+	rt.prio = options.rt_prio;
+	rt.mlock = options.mlock;
+	rt.cpu = options.cpu;
+	rt_setup(&rt);
+
+	control.cycle.min_on = options.min_on;
+	control.cycle.min_off = options.min_off;
+	control.cycle.max_per_hour = options.max_cycles;
+
+	status = (tstat_control(&sensor, &actuator, &schedule, &control,
+				&datalog, simp) == -1)
+		? EXIT_FAILURE : EXIT_SUCCESS;
+
+	for (i = 0; i < datalog.num_sinks; i++)
+		if (sink_close(&sinks[i]) == -1)
+			syslog(LOG_ERR, "%s sink: %s",
+			       sinks[i].ops->name, strerror(errno));
+
+	iosync_stop(&iosync);
+
+	/* staged data reaches data_dir before the archive finishes */
+	stage_stop(&stage);
+
+	archive_stop(&archive);
+
+	sensor_alert_close(&sensor);
+	if (sensor_close(&sensor) == -1)
+		syslog(LOG_ERR, "%s close: %s",
+		       sensor.ops->name, strerror(errno));
+	actuator_close(&actuator);
 
-	close_i2c(i2c_fd);
-	close_gpio(chip, line);
+	alog_stop();
 
 	syslog(LOG_INFO, "exiting");
 	closelog();
 
-	exit(EXIT_SUCCESS);
+	exit(status);
 }
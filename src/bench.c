@@ -0,0 +1,437 @@
+/*
+ * microbenchmarks for schedule, parser and logging hot paths
+ *
+ * output is one JSON object per line:
+ *     {"name": ..., "iters": ..., "ns_per_op": ..., "allocs_per_op": ...}
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * white-box: the private functions under test are static,
+ * so their modules are compiled into this translation unit
+ */
+#include "cfgfile.c"
+#include "schedule.c"
+#include "thermostat.c"
+
+#include "benchutil.h"
+
+/* minimum measured run per benchmark */
+#ifndef BENCH_MIN_NS
+#define BENCH_MIN_NS 200000000LL
+#endif
+
+#define BENCH_MAX_ITERS (1UL << 30)
+
+/* 2023-11-05 06:00 UTC, EDT -> EST */
+#define DST_END_SSE 1699164000L
+
+/* Saturday 2023-11-11 23:00 EST */
+#define WEEK_WRAP_SSE 1699761600L
+
+struct bench_str {
+	unsigned long n;		/* iterations requested */
+	struct timespec start;
+	unsigned long start_allocs;
+};
+
+static char tmp_dir[] = "/tmp/bang-bench-XXXXXX";
+
+/*
+ * timing
+ */
+
+/* call after per-run setup, immediately before the timed loop */
+static void
+bench_start(struct bench_str *b)
+{
+	b->start_allocs = bench_alloc_count();
+	clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void
+run_bench(const char *name, const char *filter,
+	  void (*fn)(struct bench_str *b))
+{
+	struct bench_str b;
+	long long ns;
+	unsigned long allocs;
+
+	if ((filter != NULL) && (strstr(name, filter) == NULL))
+		return;
+
+	/* double iterations until the run is long enough to trust */
+	for (b.n = 1; ; b.n *= 2) {
+		b.start_allocs = bench_alloc_count();
+		clock_gettime(CLOCK_MONOTONIC, &b.start);
+		fn(&b);
+		ns = bench_elapsed_ns(&b.start);
+		allocs = bench_alloc_count() - b.start_allocs;
+		if ((ns >= BENCH_MIN_NS) || (b.n >= BENCH_MAX_ITERS))
+			break;
+	}
+
+	printf("{\"name\": \"%s\", \"iters\": %lu, \"ns_per_op\": %.1f,"
+	       " \"allocs_per_op\": %.3f}\n",
+	       name, b.n, (double)ns / b.n, (double)allocs / b.n);
+	fflush(stdout);
+}
+
+/*
+ * schedule
+ */
+
+static struct schedule_str schedule;
+
+/* default schedule from bang.cfg, 22 events */
+static void
+load_default_events(struct schedule_str *sched)
+{
+	struct profile_str *profile = &sched->config.profile[0];
+	long day;
+
+	sched->config.num_profiles = 1;
+	profile->num_events = 0;
+	for (day = 0; day < 7; day++) {
+		update_events(profile, 1 << day, 5, 50, 18.0);
+		update_events(profile, 1 << day, 21, 30, 14.5);
+		if ((day >= 1) && (day <= 5)) {
+			update_events(profile, 1 << day, 8, 0, 10.0);
+			update_events(profile, 1 << day, 19, 0, 18.0);
+		}
+	}
+	qsort(profile->event, profile->num_events,
+	      sizeof profile->event[0],
+	      (int (*)(const void *, const void *))compare_events);
+	sched->curr_idx = -1;
+	sched->override_flag = sched->advance_flag = false;
+}
+
+/* evenly spaced events over the week */
+static void
+load_spaced_events(struct schedule_str *sched, size_t num_events)
+{
+	struct profile_str *profile = &sched->config.profile[0];
+	size_t i;
+
+	for (i = 0; i < num_events; i++) {
+		profile->event[i].sow = (long)(i * (SEC_PER_WEEK
+						    / num_events));
+		profile->event[i].setpoint_degc = 15.0 + i % 7;
+	}
+	sched->config.num_profiles = 1;
+	profile->num_events = num_events;
+	sched->curr_idx = -1;
+	sched->override_flag = sched->advance_flag = false;
+}
+
+/* one call per second, as in the control loop */
+static void
+step_setpoint(struct bench_str *b, time_t start)
+{
+	volatile double setpoint;
+	unsigned long i;
+
+	load_default_events(&schedule);
+	sched_get_setpoint(start, &schedule);
+
+	bench_start(b);
+	for (i = 0; i < b->n; i++)
+		setpoint = sched_get_setpoint(start + 1 + i, &schedule);
+	(void)setpoint;
+}
+
+static void
+bench_setpoint_week_wrap(struct bench_str *b)
+{
+	step_setpoint(b, WEEK_WRAP_SSE);
+}
+
+static void
+bench_setpoint_dst(struct bench_str *b)
+{
+	step_setpoint(b, DST_END_SSE - 3600);
+}
+
+/* init_index runs whenever curr_idx is reset */
+static void
+init_index_n(struct bench_str *b, size_t num_events)
+{
+	volatile double setpoint;
+	unsigned long i;
+
+	load_spaced_events(&schedule, num_events);
+
+	bench_start(b);
+	for (i = 0; i < b->n; i++) {
+		schedule.curr_idx = -1;
+		setpoint = sched_get_setpoint(
+			WEEK_WRAP_SSE + (time_t)((i * 7919) % SEC_PER_WEEK),
+			&schedule);
+	}
+	(void)setpoint;
+}
+
+static void
+bench_init_index_100(struct bench_str *b)
+{
+	init_index_n(b, 100);
+}
+
+static void
+bench_init_index_1000(struct bench_str *b)
+{
+	init_index_n(b, 1000);
+}
+
+static void
+bench_init_index_10000(struct bench_str *b)
+{
+	init_index_n(b, 10000);
+}
+
+/*
+ * config parser
+ */
+
+static void
+parse_day_spec(struct bench_str *b, const char *spec)
+{
+	uint8_t mask;
+	unsigned long i;
+
+	bench_start(b);
+	for (i = 0; i < b->n; i++)
+		if (parse_day(spec, &mask) == -1)
+			abort();
+}
+
+static void
+bench_parse_day_single(struct bench_str *b)
+{
+	parse_day_spec(b, "tue");
+}
+
+static void
+bench_parse_day_list(struct bench_str *b)
+{
+	parse_day_spec(b, "mon, wed, fri-sun");
+}
+
+static void
+bench_parse_day_long(struct bench_str *b)
+{
+	parse_day_spec(b, "Monday - Friday, Saturday,Sunday");
+}
+
+/* write a config file with num_events single-day events */
+static char *
+gen_config(size_t num_events)
+{
+	static const char *const days[] =
+		{ "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+	char *path;
+	FILE *out;
+	size_t i;
+
+	if (asprintf(&path, "%s/bench%zu.cfg", tmp_dir, num_events) == -1)
+		return NULL;
+
+	out = fopen(path, "w");
+	if (out == NULL) {
+		free(path);
+		return NULL;
+	}
+
+	fprintf(out, "units = \"F\"\nschedule:\n(\n");
+	for (i = 0; i < num_events; i++)
+		fprintf(out,
+			"\t{\n\t\ttime:\n\t\t{\n\t\t\tday = \"%s\"\n"
+			"\t\t\thour = %zu\n\t\t\tmin = %zu\n\t\t}\n"
+			"\t\tsetpoint = %zu.5\n\t}%s\n",
+			days[i % 7], (i / 7) % 24, (i / 168) % 60,
+			55 + i % 15, (i + 1 < num_events) ? "," : "");
+	fprintf(out, ")\n");
+
+	if (fclose(out) == EOF) {
+		free(path);
+		return NULL;
+	}
+
+	return path;
+}
+
+static void
+cfg_load_n(struct bench_str *b, size_t num_events)
+{
+	static struct cfg_data_str cfg_data;
+	char *path;
+	unsigned long i;
+
+	path = gen_config(num_events);
+	if (path == NULL)
+		abort();
+
+	bench_start(b);
+	for (i = 0; i < b->n; i++)
+		if (cfg_load(path, &cfg_data) == -1)
+			abort();
+
+	unlink(path);
+	free(path);
+}
+
+static void
+bench_cfg_load_100(struct bench_str *b)
+{
+	cfg_load_n(b, 100);
+}
+
+static void
+bench_cfg_load_1000(struct bench_str *b)
+{
+	cfg_load_n(b, 1000);
+}
+
+static void
+bench_cfg_load_10000(struct bench_str *b)
+{
+	cfg_load_n(b, 10000);
+}
+
+/*
+ * logging and controls
+ */
+
+static void
+bench_log_data(struct bench_str *b)
+{
+	struct state_str state = {
+		.sequence = 1234567,
+		.timestamp = { .tv_sec = WEEK_WRAP_SSE, .tv_nsec = 271828 },
+		.temp_degc = 20.0625,
+		.temp_avg = 20.0312,
+		.heat_req = true,
+		.setpoint_degc = 20.5,
+	};
+	static struct sink_str sink;
+	struct datalog_str datalog = {
+		.data_dir = tmp_dir,
+		.sinks = &sink,
+		.num_sinks = 1,
+		.archive = NULL,
+	};
+	unsigned long i;
+
+	load_default_events(&schedule);
+	schedule.config.units = UNITS_DEGF;
+
+	if (sink_init(&sink, "dat@1") == -1)
+		abort();
+	sink.data_dir = tmp_dir;
+	if (sink_open(&sink) == -1)
+		abort();
+
+	bench_start(b);
+	for (i = 0; i < b->n; i++)
+		if (log_data(&state, &schedule, &datalog) == -1)
+			abort();
+	sink_close(&sink);
+}
+
+static void
+bench_ctrls_check(struct bench_str *b)
+{
+	unsigned long i;
+
+	schedule.ctrl_dir = tmp_dir;
+	if (ctrls_init(&schedule) == -1)
+		abort();
+
+	bench_start(b);
+	for (i = 0; i < b->n; i++)
+		if (ctrls_check(&schedule) == -1)
+			abort();
+}
+
+/* remove the dayfile written by bench_log_data */
+static void
+cleanup(void)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/20231111.dat", tmp_dir) != -1) {
+		unlink(path);
+		free(path);
+	}
+	if (asprintf(&path, "%s/20231111.dat.idx", tmp_dir) != -1) {
+		unlink(path);
+		free(path);
+	}
+	rmdir(tmp_dir);
+}
+
+/* M A I N */
+int
+main(int argc, char *argv[])
+{
+	const char *filter = (argc > 1) ? argv[1] : NULL;
+
+	/* fixed zone with DST, independent of host configuration */
+	setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+	tzset();
+
+	if (mkdtemp(tmp_dir) == NULL) {
+		fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	run_bench("sched_get_setpoint/week_wrap", filter,
+		  bench_setpoint_week_wrap);
+	run_bench("sched_get_setpoint/dst", filter,
+		  bench_setpoint_dst);
+	run_bench("init_index/100", filter, bench_init_index_100);
+	run_bench("init_index/1000", filter, bench_init_index_1000);
+	run_bench("init_index/10000", filter, bench_init_index_10000);
+	run_bench("parse_day/single", filter, bench_parse_day_single);
+	run_bench("parse_day/list", filter, bench_parse_day_list);
+	run_bench("parse_day/long", filter, bench_parse_day_long);
+	run_bench("cfg_load/100", filter, bench_cfg_load_100);
+	run_bench("cfg_load/1000", filter, bench_cfg_load_1000);
+	run_bench("cfg_load/10000", filter, bench_cfg_load_10000);
+	run_bench("log_data", filter, bench_log_data);
+	run_bench("ctrls_check", filter, bench_ctrls_check);
+
+	cleanup();
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,83 @@
+/*
+ * benchmark support: allocation counting and timing
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "benchutil.h"
+
+/*
+ * allocation counting: wrap the glibc allocator
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* the I/O threads allocate too */
+static unsigned long alloc_count;
+
+void *
+malloc(size_t size)
+{
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+/*
+ * public functions
+ */
+
+unsigned long
+bench_alloc_count(void)
+{
+	return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
+
+long long
+bench_elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000000LL
+		+ (now.tv_nsec - start->tv_nsec);
+}
@@ -17,6 +17,7 @@
 #include "cfgfile.h"
 #include "schedule.h"
 #include "util.h"
+#include "alog.h"
 
 /*
  * finite state machine for parsing day specs in the form:
@@ -185,7 +186,7 @@ parse_day(const char *day_spec, uint8_t *mask)
 			break;
 
 		default:
-			syslog(LOG_ERR, "state machine error");
+			ALOG(LOG_ERR, "state machine error");
 			return -1;
 		}
 
@@ -209,20 +210,20 @@ load_time(config_setting_t *time_setting,
 	const char *day;
 
 	if (!config_setting_lookup_string(time_setting, "day", &day)) {
-		syslog(LOG_ERR, "failed to find day for event, line %d",
+		ALOG(LOG_ERR, "failed to find day for event, line %d",
 			config_setting_source_line(time_setting));
 		return -1;
 	}
 
 	if (parse_day(day, day_mask) == -1) {
-		syslog(LOG_ERR, "syntax error, day spec %s, line %d",
+		ALOG(LOG_ERR, "syntax error, day spec %s, line %d",
 			day,
 			config_setting_source_line(time_setting));
 		return -1;
 	}
 
 	if (!config_setting_lookup_int(time_setting, "hour", hour)) {
-		syslog(LOG_ERR, "failed to find hour for event, line %d",
+		ALOG(LOG_ERR, "failed to find hour for event, line %d",
 			config_setting_source_line(time_setting));
 		return -1;
 	}
@@ -231,13 +232,13 @@ load_time(config_setting_t *time_setting,
 		*minute = 0; 	/* default to top of hour */
 
 	if ((*hour < 0) || (*hour >= 24)) {
-		syslog(LOG_ERR, "hour %d invalid, line %d", *hour,
+		ALOG(LOG_ERR, "hour %d invalid, line %d", *hour,
 			config_setting_source_line(time_setting));
 		return -1;
 	}
 
 	if ((*minute < 0) || (*minute >= 60)) {
-		syslog(LOG_ERR, "minute %d invalid, line %d", *minute,
+		ALOG(LOG_ERR, "minute %d invalid, line %d", *minute,
 			config_setting_source_line(time_setting));
 		return -1;
 	}
@@ -248,7 +249,7 @@ load_time(config_setting_t *time_setting,
 }
 
 static int
-update_events(struct cfg_data_str *cfg_data, uint8_t day_mask,
+update_events(struct profile_str *profile, uint8_t day_mask,
 	      int hour, int minute, double setpoint)
 {
 	uint8_t mask;
@@ -260,15 +261,15 @@ update_events(struct cfg_data_str *cfg_data, uint8_t day_mask,
 	 */
 	for (day = 0, mask = 0x01; mask != 0x80; day++, mask <<= 1) {
 		if (mask & day_mask) {
-			if (cfg_data->num_events == ARRAY_SIZE(cfg_data->event))
+			if (profile->num_events == ARRAY_SIZE(profile->event))
 				/* FIXME: this should be logged */
 				return -1;
 
-			cfg_data->event[cfg_data->num_events].sow
+			profile->event[profile->num_events].sow
 				= (((day * 24) + hour) * 60 + minute) * 60;
-			cfg_data->event[cfg_data->num_events].setpoint_degc
+			profile->event[profile->num_events].setpoint_degc
 				= setpoint;
-			cfg_data->num_events++;
+			profile->num_events++;
 		}
 	}
 
@@ -287,7 +288,8 @@ to_degc(double temp, enum units_enum units)
 }
 
 static int
-load_event(config_setting_t *event_setting, struct cfg_data_str *cfg_data)
+load_event(config_setting_t *event_setting, enum units_enum units,
+	   struct profile_str *profile)
 {
 	config_setting_t *time_setting;
 	uint8_t day_mask;
@@ -297,7 +299,7 @@ load_event(config_setting_t *event_setting, struct cfg_data_str *cfg_data)
 
 	time_setting = config_setting_get_member(event_setting, "time");
 	if (time_setting == NULL) {
-		syslog(LOG_ERR, "failed to find time for event, line %d",
+		ALOG(LOG_ERR, "failed to find time for event, line %d",
 			config_setting_source_line(event_setting));
 		return -1;
 	}
@@ -312,13 +314,13 @@ load_event(config_setting_t *event_setting, struct cfg_data_str *cfg_data)
 		/* libconfig won't parse a float without a decimal pt */
 		setpoint = setpt_int;
 	} else {
-		syslog(LOG_ERR, "failed fo find setpoint for event, line %d",
-		       config_setting_source_line(event_setting));
+		ALOG(LOG_ERR, "failed fo find setpoint for event, line %d",
+		     config_setting_source_line(event_setting));
 		return -1;
 	}
-	setpoint = to_degc(setpoint, cfg_data->units);
+	setpoint = to_degc(setpoint, units);
 
-	if (update_events(cfg_data, day_mask, hour, minute, setpoint) == -1)
+	if (update_events(profile, day_mask, hour, minute, setpoint) == -1)
 		return -1;
 
 	//printf("%f deg\n", setpoint);
@@ -326,6 +328,93 @@ load_event(config_setting_t *event_setting, struct cfg_data_str *cfg_data)
 	return 0;
 }
 
+/* float or int: libconfig won't parse a float without a decimal pt */
+static int
+lookup_number(config_setting_t *setting, const char *name, double *val)
+{
+	int ival;
+
+	if (config_setting_lookup_float(setting, name, val))
+		return 1;
+
+	if (config_setting_lookup_int(setting, name, &ival)) {
+		*val = ival;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* optional control group: mode and PID tuning, defaults if absent */
+static int
+load_control(config_t *cfg, struct cfg_data_str *cfg_data)
+{
+	config_setting_t *control_setting;
+	const char *mode;
+	int optimal_start;
+	int max_lead;
+
+	cfg_data->mode = CTRL_BANG;
+	cfg_data->pid.kp = PID_DFLT_KP;
+	cfg_data->pid.ki = PID_DFLT_KI;
+	cfg_data->pid.kd = PID_DFLT_KD;
+	cfg_data->pid.window = PID_DFLT_WINDOW;
+	cfg_data->optimal_start = false;
+	cfg_data->max_lead = SCHED_MAX_LEAD;
+
+	control_setting = config_lookup(cfg, "control");
+	if (control_setting == NULL)
+		return 0;
+
+	if (config_setting_lookup_string(control_setting, "mode", &mode)) {
+		if (strcmp(mode, "pid") == 0) {
+			cfg_data->mode = CTRL_PID;
+		} else if (strcmp(mode, "bang") != 0) {
+			ALOG(LOG_ERR, "control mode %s invalid, line %d",
+			     mode, config_setting_source_line(control_setting));
+			return -1;
+		}
+	}
+
+	lookup_number(control_setting, "kp", &cfg_data->pid.kp);
+	lookup_number(control_setting, "ki", &cfg_data->pid.ki);
+	lookup_number(control_setting, "kd", &cfg_data->pid.kd);
+	config_setting_lookup_int(control_setting, "window",
+				  &cfg_data->pid.window);
+
+	if ((cfg_data->pid.kp < 0.0) || (cfg_data->pid.ki < 0.0)
+	    || (cfg_data->pid.kd < 0.0)) {
+		ALOG(LOG_ERR, "PID gains must not be negative, line %d",
+		     config_setting_source_line(control_setting));
+		return -1;
+	}
+
+	if ((cfg_data->pid.window < 60) || (cfg_data->pid.window > 3600)) {
+		ALOG(LOG_ERR, "window %d invalid (60 - 3600 s), line %d",
+		     cfg_data->pid.window,
+		     config_setting_source_line(control_setting));
+		return -1;
+	}
+
+	if (config_setting_lookup_bool(control_setting, "optimal_start",
+				       &optimal_start))
+		cfg_data->optimal_start = optimal_start;
+
+	/* minutes in the file */
+	if (config_setting_lookup_int(control_setting, "max_lead",
+				      &max_lead)) {
+		if ((max_lead < 1) || (max_lead > 24 * 60)) {
+			ALOG(LOG_ERR, "max_lead %d invalid (1 - 1440 min),"
+			     " line %d", max_lead,
+			     config_setting_source_line(control_setting));
+			return -1;
+		}
+		cfg_data->max_lead = max_lead * 60;
+	}
+
+	return 0;
+}
+
 /* callback for qsort */
 static int
 compare_events(const struct event_str *event1,
@@ -339,22 +428,137 @@ compare_events(const struct event_str *event1,
 		return 0;
 }
 
-/* record schedule to syslog */
+/* compile a list of events into the next profile */
+static int
+load_profile(config_setting_t *list_setting, const char *name,
+	     struct cfg_data_str *cfg_data)
+{
+	struct profile_str *profile;
+	int i, count;
+
+	if (cfg_data->num_profiles == ARRAY_SIZE(cfg_data->profile)) {
+		ALOG(LOG_ERR, "too many profiles (max %zu), line %d",
+		     ARRAY_SIZE(cfg_data->profile),
+		     config_setting_source_line(list_setting));
+		return -1;
+	}
+
+	if (strlen(name) >= sizeof profile->name) {
+		ALOG(LOG_ERR, "profile name %s too long, line %d", name,
+		     config_setting_source_line(list_setting));
+		return -1;
+	}
+
+	profile = &cfg_data->profile[cfg_data->num_profiles];
+	strcpy(profile->name, name);
+	profile->num_events = 0;
+
+	count = config_setting_length(list_setting);
+	if (count == 0) {
+		ALOG(LOG_ERR, "file %s: schedule %s is empty",
+		     cfg_data->fname, name);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		config_setting_t *event_setting;
+
+		event_setting = config_setting_get_elem(list_setting, i);
+		if (load_event(event_setting, cfg_data->units, profile) == -1)
+			return -1;
+	}
+
+	qsort(profile->event, profile->num_events,
+	      sizeof profile->event[0],
+	      (int (*)(const void *, const void *))compare_events);
+
+	cfg_data->num_profiles++;
+
+	return 0;
+}
+
+/* optional profiles group: named schedules, each a list of events */
+static int
+load_profiles(config_t *cfg, struct cfg_data_str *cfg_data)
+{
+	config_setting_t *profiles_setting;
+	int i, count;
+
+	profiles_setting = config_lookup(cfg, "profiles");
+	if (profiles_setting == NULL)
+		return 0;
+
+	count = config_setting_length(profiles_setting);
+	for (i = 0; i < count; i++) {
+		config_setting_t *list_setting;
+		const char *name;
+
+		list_setting = config_setting_get_elem(profiles_setting, i);
+		name = config_setting_name(list_setting);
+		if (strcmp(name, PROFILE_DEFAULT) == 0) {
+			ALOG(LOG_ERR, "profile name %s is reserved, line %d",
+			     name, config_setting_source_line(list_setting));
+			return -1;
+		}
+
+		if (load_profile(list_setting, name, cfg_data) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * record schedule to syslog.  directly, not through the log queue: a
+ * listing can run to hundreds of lines, and it is written once per
+ * load, not every second.
+ */
 static void
 log_schedule(const struct cfg_data_str *cfg_data)
 {
-	size_t i;
+	size_t i, j;
 	char *units;
 
 	units = (cfg_data->units == UNITS_DEGC) ? "deg C"
 		: (cfg_data->units == UNITS_DEGF) ? "deg F" : "auto";
 	syslog(LOG_INFO, "units: %s", units);
 
-	for (i = 0; i < cfg_data->num_events; i++)
-		syslog(LOG_INFO,
-		       "%3zu %6ld %4.1f",
-		       i, cfg_data->event[i].sow,
-		       cfg_data->event[i].setpoint_degc);
+	if (cfg_data->mode == CTRL_PID)
+		syslog(LOG_INFO, "control: pid, kp %g, ki %g, kd %g,"
+		       " window %d s", cfg_data->pid.kp, cfg_data->pid.ki,
+		       cfg_data->pid.kd, cfg_data->pid.window);
+	else
+		syslog(LOG_INFO, "control: bang");
+	if (cfg_data->optimal_start)
+		syslog(LOG_INFO, "optimal start, up to %d min early",
+		       cfg_data->max_lead / 60);
+
+	for (i = 0; i < cfg_data->num_profiles; i++) {
+		const struct profile_str *profile = &cfg_data->profile[i];
+		double lo, hi;
+
+		if (profile->num_events == 0) {
+			syslog(LOG_INFO, "profile %s: no events",
+			       profile->name);
+			continue;
+		}
+
+		lo = hi = profile->event[0].setpoint_degc;
+		for (j = 1; j < profile->num_events; j++) {
+			if (profile->event[j].setpoint_degc < lo)
+				lo = profile->event[j].setpoint_degc;
+			if (profile->event[j].setpoint_degc > hi)
+				hi = profile->event[j].setpoint_degc;
+		}
+
+		syslog(LOG_INFO, "profile %s: %zu events, %.1f - %.1f deg C",
+		       profile->name, profile->num_events, lo, hi);
+		for (j = 0; j < profile->num_events; j++)
+			syslog(LOG_INFO,
+			       "%3zu %6ld %4.1f",
+			       j, profile->event[j].sow,
+			       profile->event[j].setpoint_degc);
+	}
 }
 
 /*
@@ -366,22 +570,21 @@ cfg_load(const char *fname, struct cfg_data_str *cfg_data)
 {
 	config_t cfg;
 	config_setting_t *schedule_setting;
-	int i, count;
 	const char *units;
 
 	cfg_data->fname = fname;
 
 	/* initialize config file modification time */
 	if (get_mtime(fname, &cfg_data->mtime) == -1) {
-		syslog(LOG_ERR, "cfg_load - get_mtime(%s): %s",
-		       fname, strerror(errno));
+		ALOG(LOG_ERR, "cfg_load - get_mtime(%s): %s",
+		     fname, strerror(errno));
 		return -1;
 	}
 
 	config_init(&cfg);
 
 	if (!config_read_file(&cfg, fname)) {
-		syslog(LOG_ERR, "%s:%d - %s", config_error_file(&cfg),
+		ALOG(LOG_ERR, "%s:%d - %s", config_error_file(&cfg),
 			config_error_line(&cfg), config_error_text(&cfg));
 		config_destroy(&cfg);
 		return -1;
@@ -399,38 +602,29 @@ cfg_load(const char *fname, struct cfg_data_str *cfg_data)
 		cfg_data->units = UNITS_AUTO; /* defaults to AUTO */
 	}
 
-	schedule_setting = config_lookup(&cfg, "schedule");
-	if (schedule_setting == NULL) {
-		syslog(LOG_ERR, "no schedule setting found in %s",
-			fname);
+	if (load_control(&cfg, cfg_data) == -1) {
 		config_destroy(&cfg);
 		return -1;
 	}
 
-	cfg_data->num_events = 0;
-        count = config_setting_length(schedule_setting);
-	if (count == 0) {
-		syslog(LOG_ERR, "file %s: schedule is empty",
+	schedule_setting = config_lookup(&cfg, "schedule");
+	if (schedule_setting == NULL) {
+		ALOG(LOG_ERR, "no schedule setting found in %s",
 			fname);
+		config_destroy(&cfg);
 		return -1;
 	}
 
-	for (i = 0; i < count; i++) {
-		config_setting_t *event_setting;
-
-		event_setting = config_setting_get_elem(schedule_setting, i);
-		if (load_event(event_setting, cfg_data) == -1) {
-			config_destroy(&cfg);
-			return -1;
-		}
+	/* all compiled now, so switching profiles needs no reparse */
+	cfg_data->num_profiles = 0;
+	if ((load_profile(schedule_setting, PROFILE_DEFAULT, cfg_data) == -1)
+	    || (load_profiles(&cfg, cfg_data) == -1)) {
+		config_destroy(&cfg);
+		return -1;
 	}
 
 	config_destroy(&cfg);
 
-	qsort(cfg_data->event, cfg_data->num_events,
-	      sizeof cfg_data->event[0],
-	      (int (*)(const void *, const void *))compare_events);
-
 	log_schedule(cfg_data);
 
 	return 0;
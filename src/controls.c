@@ -17,6 +17,7 @@
 #include "controls.h"
 #include "schedule.h"
 #include "util.h"
+#include "alog.h"
 
 #ifndef CTRL_FNAME_HOLD
 #define CTRL_FNAME_HOLD    "hold"
@@ -34,6 +35,10 @@
 #define CTRL_FNAME_RESUME  "resume"
 #endif
 
+#ifndef CTRL_FNAME_PROFILE
+#define CTRL_FNAME_PROFILE "profile"
+#endif
+
 /*
  * private functions
  */
@@ -45,9 +50,9 @@ get_modtime(const char *ctrl_dir, const char *fname, time_t *mtime)
 	struct stat statbuf;
 
 	if (asprintf(&path, "%s/%s", ctrl_dir, fname) == -1) {
-		syslog(LOG_ERR,
-		       "asprintf(%s/%s): %s",
-		       ctrl_dir, fname, strerror(errno));
+		ALOG(LOG_ERR,
+		     "asprintf(%s/%s): %s",
+		     ctrl_dir, fname, strerror(errno));
 		return -1;
 	}
 
@@ -76,24 +81,24 @@ read_temp_degc(struct schedule_str *schedule, const char *fname,
 
 	if (asprintf(&path, "%s/%s",
 		     schedule->ctrl_dir, fname) == -1) {
-		syslog(LOG_ERR,
-		       "asprintf(%s/%s): %s",
-		       schedule->ctrl_dir, fname, strerror(errno));
+		ALOG(LOG_ERR,
+		     "asprintf(%s/%s): %s",
+		     schedule->ctrl_dir, fname, strerror(errno));
 		return -1;
 	}
 
 	infile = fopen(path, "r");
 	if (infile == NULL) {
-		syslog(LOG_ERR, "read temp, fopen(%s): %s",
-		       path, strerror(errno));
+		ALOG(LOG_ERR, "read temp, fopen(%s): %s",
+		     path, strerror(errno));
 		free(path);
 		return -1;
 	}
 
 	ret = fscanf(infile, " %f", &temp);
 	if (ret != 1) {
-		syslog(LOG_INFO, "failed to read temp from %s",
-		       path);
+		ALOG(LOG_INFO, "failed to read temp from %s",
+		     path);
 		free(path);
 		return 0;
 	}
@@ -139,7 +144,7 @@ check_hold(struct schedule_str *schedule)
 	 */
 	schedule->curr_idx = -1;
 
-	syslog(LOG_INFO, "HOLD: %.2f", schedule->hold_temp_degc);
+	ALOG(LOG_INFO, "HOLD: %.2f", schedule->hold_temp_degc);
 
 	/* this overrides any OVERRIDE, ADVANCE in effect */
 	schedule->override_flag = false;
@@ -169,7 +174,7 @@ check_override(struct schedule_str *schedule)
 
 	schedule->override_flag = true;
 
-	syslog(LOG_INFO, "OVERRIDE: %.2f", schedule->override_temp_degc);
+	ALOG(LOG_INFO, "OVERRIDE: %.2f", schedule->override_temp_degc);
 
 	/* this overrides any HOLD, ADVANCE in effect */
 	schedule->hold_flag = false;
@@ -191,7 +196,7 @@ check_advance(struct schedule_str *schedule)
 
 	schedule->advance_mtime = mtime;
 
-	syslog(LOG_INFO, "ADVANCE");
+	ALOG(LOG_INFO, "ADVANCE");
 
 	schedule->advance_flag = true;
 
@@ -215,7 +220,7 @@ check_resume(struct schedule_str *schedule)
 
 	schedule->resume_mtime = mtime;
 
-	syslog(LOG_INFO, "RESUME");
+	ALOG(LOG_INFO, "RESUME");
 
 	schedule->hold_flag = false;
 	schedule->override_flag = false;
@@ -224,6 +229,65 @@ check_resume(struct schedule_str *schedule)
 	return 0;
 }
 
+/* profile file: name, and optionally minutes until back to default */
+static int
+check_profile(struct schedule_str *schedule)
+{
+	time_t mtime;
+	char *path;
+	FILE *infile;
+	char name[PROFILE_NAME_MAX];
+	int minutes = 0;
+	int ret;
+
+	if (get_modtime(schedule->ctrl_dir, CTRL_FNAME_PROFILE, &mtime) == -1)
+		return -1;
+
+	if (mtime <= schedule->profile_mtime)
+		return 0;
+
+	/* update mtime so we don't do it again */
+	schedule->profile_mtime = mtime;
+
+	if (asprintf(&path, "%s/%s",
+		     schedule->ctrl_dir, CTRL_FNAME_PROFILE) == -1) {
+		ALOG(LOG_ERR,
+		     "asprintf(%s/%s): %s",
+		     schedule->ctrl_dir, CTRL_FNAME_PROFILE, strerror(errno));
+		return -1;
+	}
+
+	infile = fopen(path, "r");
+	if (infile == NULL) {
+		ALOG(LOG_ERR, "read profile, fopen(%s): %s",
+		     path, strerror(errno));
+		free(path);
+		return -1;
+	}
+
+	ret = fscanf(infile, " %31s %d", name, &minutes);
+	fclose(infile);
+	if ((ret < 1) || (minutes < 0)) {
+		ALOG(LOG_INFO, "failed to read profile from %s", path);
+		free(path);
+		return 0;
+	}
+
+	free(path);
+
+	if (sched_set_profile(schedule, name, minutes * 60L) == -1) {
+		ALOG(LOG_ERR, "PROFILE: no profile %s", name);
+		return 0;
+	}
+
+	if (minutes != 0)
+		ALOG(LOG_INFO, "PROFILE: %s for %d min", name, minutes);
+	else
+		ALOG(LOG_INFO, "PROFILE: %s", name);
+
+	return 0;
+}
+
 /*
  * public functions
  */
@@ -247,6 +311,14 @@ ctrls_init(struct schedule_str *schedule)
 		    &schedule->resume_mtime) == -1)
 		return -1;
 
+	if (get_modtime(schedule->ctrl_dir, CTRL_FNAME_PROFILE,
+		    &schedule->profile_mtime) == -1)
+		return -1;
+
+	schedule->active = NULL;
+	schedule->profile_sec = 0;
+	schedule->profile_expires = 0;
+
 	schedule->hold_flag = schedule->override_flag
 		= schedule->advance_flag = false;
 
@@ -268,5 +340,8 @@ ctrls_check(struct schedule_str *schedule)
 	if (check_resume(schedule) == -1)
 		return -1;
 
+	if (check_profile(schedule) == -1)
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,134 @@
+/*
+ * cycle module: minimum on/off times and starts per hour for the relay
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "cycle.h"
+#include "alog.h"
+
+/*
+ * private functions
+ */
+
+/* seconds until the switch may happen, zero if now */
+static long
+wait_sec(const struct cycle_str *cycle, bool want, time_t now,
+	 const char **why)
+{
+	time_t oldest;
+	long wait = 0;
+
+	if (cycle->switched) {
+		if (want && (now - cycle->last_switch < cycle->min_off)) {
+			wait = cycle->min_off - (now - cycle->last_switch);
+			*why = "min off";
+		} else if (!want
+			   && (now - cycle->last_switch < cycle->min_on)) {
+			wait = cycle->min_on - (now - cycle->last_switch);
+			*why = "min on";
+		}
+	}
+
+	/* the ring holds the last max_per_hour starts */
+	if (want && (wait == 0) && (cycle->max_per_hour != 0)
+	    && (cycle->num_starts >= (unsigned)cycle->max_per_hour)) {
+		oldest = cycle->starts[cycle->num_starts
+				       % cycle->max_per_hour];
+		if (now - oldest < 3600) {
+			wait = 3600 - (now - oldest);
+			*why = "cycle limit";
+		}
+	}
+
+	return wait;
+}
+
+/*
+ * public functions
+ */
+
+void
+cycle_init(struct cycle_str *cycle)
+{
+	cycle->switched = false;
+	cycle->last_switch = 0;
+	memset(cycle->starts, 0, sizeof cycle->starts);
+	cycle->num_starts = 0;
+	cycle->deferring = false;
+	cycle->deferred = 0;
+}
+
+bool
+cycle_allow(struct cycle_str *cycle, bool on, bool want, time_t now)
+{
+	const char *why = NULL;
+	long wait;
+
+	if (want == on) {
+		cycle->deferring = false;
+		return true;
+	}
+
+	wait = wait_sec(cycle, want, now, &why);
+	if (wait == 0)
+		return true;
+
+	/* count each held-back switch once, not each second of it */
+	if (!cycle->deferring) {
+		cycle->deferring = true;
+		cycle->deferred++;
+		ALOG(LOG_INFO, "heat %s deferred %ld s: %s",
+		     want ? "on" : "off", wait, why);
+	}
+
+	return false;
+}
+
+void
+cycle_switched(struct cycle_str *cycle, bool on, time_t now)
+{
+	cycle->switched = true;
+	cycle->last_switch = now;
+	cycle->deferring = false;
+
+	if (on && (cycle->max_per_hour != 0)) {
+		cycle->starts[cycle->num_starts % cycle->max_per_hour] = now;
+		cycle->num_starts++;
+	}
+}
+
+void
+cycle_report(struct cycle_str *cycle)
+{
+	if (cycle->deferred == 0)
+		return;
+
+	ALOG(LOG_INFO, "%lu relay switches deferred", cycle->deferred);
+
+	cycle->deferred = 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * dayfile reader: hand-written parser for the fixed log_data() layout
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "dayfile.h"
+#include "sink.h"
+
+#define STREAM_BUF_SIZE 65536
+
+/* log_data() writes at most 4 decimal places */
+static const double pow10_neg[] = {
+	1.0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9
+};
+
+/*
+ * private functions
+ *     each returns the position after the field, or NULL on error
+ */
+
+static const char *
+skip_blanks(const char *p, const char *end)
+{
+	while ((p < end) && ((*p == ' ') || (*p == '\t')))
+		p++;
+	return p;
+}
+
+static const char *
+parse_ull(const char *p, const char *end, unsigned long long *val)
+{
+	const char *start;
+	unsigned long long v = 0;
+
+	p = skip_blanks(p, end);
+	start = p;
+	while ((p < end) && ((unsigned)(*p - '0') < 10))
+		v = v * 10 + (unsigned)(*p++ - '0');
+
+	if (p == start)
+		return NULL;
+
+	*val = v;
+	return p;
+}
+
+static const char *
+parse_ll(const char *p, const char *end, long long *val)
+{
+	unsigned long long v;
+	bool neg = false;
+
+	p = skip_blanks(p, end);
+	if ((p < end) && (*p == '-')) {
+		neg = true;
+		p++;
+	}
+
+	p = parse_ull(p, end, &v);
+	if (p == NULL)
+		return NULL;
+
+	*val = neg ? -(long long)v : (long long)v;
+	return p;
+}
+
+/* fixed-point decimal, e.g. -12.3456 */
+static const char *
+parse_fixed(const char *p, const char *end, double *val)
+{
+	unsigned long long mant = 0;
+	unsigned frac = 0;
+	bool neg = false;
+	bool digits = false;
+
+	p = skip_blanks(p, end);
+	if ((p < end) && (*p == '-')) {
+		neg = true;
+		p++;
+	}
+
+	while ((p < end) && ((unsigned)(*p - '0') < 10)) {
+		mant = mant * 10 + (unsigned)(*p++ - '0');
+		digits = true;
+	}
+
+	if ((p < end) && (*p == '.')) {
+		p++;
+		while ((p < end) && ((unsigned)(*p - '0') < 10)) {
+			if (frac < sizeof pow10_neg / sizeof pow10_neg[0] - 1) {
+				mant = mant * 10 + (unsigned)(*p - '0');
+				frac++;
+			}
+			p++;
+			digits = true;
+		}
+	}
+
+	if (!digits)
+		return NULL;
+
+	*val = (neg ? -(double)mant : (double)mant) * pow10_neg[frac];
+	return p;
+}
+
+static const char *
+parse_flag(const char *p, const char *end, bool *val)
+{
+	p = skip_blanks(p, end);
+	if ((p == end) || ((*p != '0') && (*p != '1')))
+		return NULL;
+
+	*val = (*p == '1');
+	return p + 1;
+}
+
+/*
+ * public functions
+ */
+
+int
+dayfile_parse_line(const char **pos, const char *end, struct dayrec_str *rec)
+{
+	const char *p = *pos;
+	const char *eol;
+	unsigned long long u;
+	long long l;
+
+	eol = memchr(p, '\n', end - p);
+	if (eol == NULL)
+		eol = end;
+	*pos = (eol < end) ? eol + 1 : end;
+
+	if ((p = parse_ull(p, eol, &u)) == NULL)
+		return -1;
+	rec->sequence = u;
+	if ((p = parse_ll(p, eol, &l)) == NULL)
+		return -1;
+	rec->sec = l;
+	if ((p = parse_ll(p, eol, &l)) == NULL)
+		return -1;
+	rec->nsec = l;
+	if ((p = parse_ull(p, eol, &u)) == NULL)
+		return -1;
+	rec->wday = u;
+	if ((p = parse_ull(p, eol, &u)) == NULL)
+		return -1;
+	rec->datetime = u;
+
+	if (((p = parse_fixed(p, eol, &rec->temp)) == NULL)
+	    || ((p = parse_fixed(p, eol, &rec->temp_avg)) == NULL)
+	    || ((p = parse_fixed(p, eol, &rec->setpoint)) == NULL))
+		return -1;
+
+	if (((p = parse_flag(p, eol, &rec->heat)) == NULL)
+	    || ((p = parse_flag(p, eol, &rec->hold)) == NULL)
+	    || ((p = parse_flag(p, eol, &rec->override)) == NULL)
+	    || ((p = parse_flag(p, eol, &rec->advance)) == NULL))
+		return -1;
+
+	/* nothing but blanks may follow */
+	if (skip_blanks(p, eol) != eol)
+		return -1;
+
+	return 0;
+}
+
+int
+dayfile_parse_bin(const char **pos, const char *end, struct dayrec_str *rec)
+{
+	struct sink_bin_rec_str bin;
+	struct tm bdt;
+	time_t sec;
+
+	if ((size_t)(end - *pos) < sizeof bin) {
+		*pos = end;
+		return -1;
+	}
+	memcpy(&bin, *pos, sizeof bin);	/* may be unaligned */
+	*pos += sizeof bin;
+
+	sec = bin.sec;
+	if (localtime_r(&sec, &bdt) == NULL)
+		return -1;
+
+	rec->sequence = bin.sequence;
+	rec->sec = sec;
+	rec->nsec = bin.nsec;
+	rec->wday = bdt.tm_wday;
+	rec->datetime = (bdt.tm_year + 1900) * 10000000000LL
+		+ (bdt.tm_mon + 1) * 100000000LL + bdt.tm_mday * 1000000LL
+		+ bdt.tm_hour * 10000 + bdt.tm_min * 100 + bdt.tm_sec;
+	rec->temp = bin.temp;
+	rec->temp_avg = bin.temp_avg;
+	rec->setpoint = bin.setpoint;
+	rec->heat = bin.heat;
+	rec->hold = bin.hold;
+	rec->override = bin.override;
+	rec->advance = bin.advance;
+
+	return 0;
+}
+
+bool
+dayfile_is_bin(const char *path)
+{
+	size_t len = strlen(path);
+
+	if ((len > 3) && (strcmp(path + len - 3, ".gz") == 0))
+		len -= 3;
+
+	return (len > 4) && (strncmp(path + len - 4, ".bin", 4) == 0);
+}
+
+int
+dayfile_stream(const char *path, off_t start, size_t rec_size,
+	       int (*chunk)(const char *buf, size_t len, off_t base,
+			    void *arg),
+	       void *arg)
+{
+	gzFile in;
+	char *buf;
+	const char *eol;
+	size_t have = 0;
+	size_t len;
+	off_t base = start;
+	int n;
+	int ret = 0;
+
+	/* zlib reads uncompressed files transparently */
+	in = gzopen(path, "r");
+	if (in == NULL)
+		return -1;
+
+	if ((start != 0) && (gzseek(in, start, SEEK_SET) == -1)) {
+		gzclose(in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	buf = malloc(STREAM_BUF_SIZE);
+	if (buf == NULL) {
+		gzclose(in);
+		return -1;
+	}
+
+	for (;;) {
+		n = gzread(in, buf + have, STREAM_BUF_SIZE - have);
+		if (n < 0) {
+			errno = EIO;
+			ret = -1;
+			break;
+		}
+		if (n == 0) {
+			/* unterminated last line, or torn record */
+			if (have != 0)
+				chunk(buf, have, base, arg);
+			break;
+		}
+		have += n;
+
+		/* carry a partial line or record over to the next read */
+		if (rec_size != 0)
+			len = have / rec_size * rec_size;
+		else if ((eol = memrchr(buf, '\n', have)) != NULL)
+			len = eol + 1 - buf;
+		else if (have == STREAM_BUF_SIZE)
+			len = have;	/* no newline in sight, give up on it */
+		else
+			continue;
+		if (len == 0)
+			continue;
+
+		if (chunk(buf, len, base, arg) != 0)
+			break;
+
+		base += len;
+		have -= len;
+		memmove(buf, buf + len, have);
+	}
+
+	free(buf);
+	gzclose(in);
+
+	return ret;
+}
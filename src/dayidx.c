@@ -0,0 +1,301 @@
+/*
+ * dayfile index: one byte offset per minute of the day
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "dayidx.h"
+#include "dayfile.h"
+#include "sink.h"
+#include "util.h"
+
+#define DAYIDX_SIZE (DAYIDX_ENTRIES * sizeof(uint32_t))
+
+/*
+ * private functions
+ */
+
+static void
+fill_none(uint32_t idx[DAYIDX_ENTRIES])
+{
+	memset(idx, 0xFF, DAYIDX_SIZE);
+}
+
+/* YYYYMMDD.dat or YYYYMMDD.dat.gz -> YYYYMMDD.dat.idx, likewise .bin */
+static char *
+idx_path_for(const char *dayfile_path)
+{
+	size_t len = strlen(dayfile_path);
+	char *path;
+
+	if ((len > 3) && (strcmp(dayfile_path + len - 3, ".gz") == 0))
+		len -= 3;
+
+	if (asprintf(&path, "%.*s.idx", (int)len, dayfile_path) == -1)
+		return NULL;
+
+	return path;
+}
+
+static int
+read_idx(const char *path, uint32_t idx[DAYIDX_ENTRIES])
+{
+	int fd;
+	ssize_t n;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	n = readn(fd, idx, DAYIDX_SIZE);
+	close(fd);
+
+	if (n != (ssize_t)DAYIDX_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+mark_fd(int fd, int minute, uint32_t offset)
+{
+	struct stat statbuf;
+	off_t pos;
+	uint32_t entry;
+
+	if (fstat(fd, &statbuf) == -1)
+		return -1;
+
+	if (statbuf.st_size != (off_t)DAYIDX_SIZE) {
+		/* new (or damaged): start with no entries */
+		uint32_t none[DAYIDX_ENTRIES];
+
+		fill_none(none);
+		if (pwrite(fd, none, DAYIDX_SIZE, 0) != (ssize_t)DAYIDX_SIZE)
+			return -1;
+		if (ftruncate(fd, DAYIDX_SIZE) == -1)
+			return -1;
+	}
+
+	pos = minute * sizeof entry;
+
+	if (pread(fd, &entry, sizeof entry, pos) != sizeof entry)
+		return -1;
+
+	/* keep the first record of the minute, e.g. across restarts */
+	if ((entry == DAYIDX_NONE)
+	    && (pwrite(fd, &offset, sizeof offset, pos) != sizeof offset))
+		return -1;
+
+	return 0;
+}
+
+/* save for next time, not fatal if the directory is read-only */
+static void
+save_idx(const char *path, const uint32_t idx[DAYIDX_ENTRIES])
+{
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		if (writen(fd, idx, DAYIDX_SIZE) == -1)
+			unlink(path);
+		close(fd);
+	}
+}
+
+static bool
+is_gzip_path(const char *path)
+{
+	size_t len = strlen(path);
+
+	return (len > 3) && (strcmp(path + len - 3, ".gz") == 0);
+}
+
+static void
+index_chunk(const char *buf, size_t len, off_t base, bool bin,
+	    uint32_t idx[DAYIDX_ENTRIES])
+{
+	const char *pos = buf;
+	const char *end = buf + len;
+
+	while (pos < end) {
+		const char *line = pos;
+		struct dayrec_str rec;
+		int minute;
+
+		if ((bin ? dayfile_parse_bin(&pos, end, &rec)
+		     : dayfile_parse_line(&pos, end, &rec)) == -1)
+			continue;
+
+		/* datetime is YYYYMMDDhhmmss */
+		minute = (rec.datetime / 10000 % 100) * 60
+			+ rec.datetime / 100 % 100;
+		if ((minute < DAYIDX_ENTRIES) && (idx[minute] == DAYIDX_NONE))
+			idx[minute] = base + (line - buf);
+	}
+}
+
+struct build_str {
+	uint32_t *idx;
+	bool bin;
+};
+
+static int
+index_stream_chunk(const char *buf, size_t len, off_t base, void *arg)
+{
+	struct build_str *build = arg;
+
+	index_chunk(buf, len, base, build->bin, build->idx);
+	return 0;
+}
+
+/*
+ * public functions
+ */
+
+int
+dayidx_mark(const char *data_dir, const char *dayfile_name, int minute,
+	    uint32_t offset)
+{
+	char *path;
+	int fd;
+	int ret;
+
+	if (asprintf(&path, "%s/%s.idx", data_dir, dayfile_name) == -1)
+		return -1;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	free(path);
+	if (fd == -1)
+		return -1;
+
+	ret = mark_fd(fd, minute, offset);
+
+	if (close(fd) == -1)
+		return -1;
+
+	return ret;
+}
+
+void
+dayidx_build(const char *buf, size_t len, bool bin,
+	     uint32_t idx[DAYIDX_ENTRIES])
+{
+	fill_none(idx);
+	index_chunk(buf, len, 0, bin, idx);
+}
+
+int
+dayidx_load(const char *dayfile_path, uint32_t idx[DAYIDX_ENTRIES])
+{
+	struct stat statbuf;
+	bool bin = dayfile_is_bin(dayfile_path);
+	char *path;
+	void *map;
+	int fd;
+
+	path = idx_path_for(dayfile_path);
+	if (path == NULL)
+		return -1;
+
+	if (read_idx(path, idx) == 0) {
+		free(path);
+		return 0;
+	}
+
+	/* missing or damaged: rebuild from the dayfile */
+	if (is_gzip_path(dayfile_path)) {
+		struct build_str build = { .idx = idx, .bin = bin };
+
+		fill_none(idx);
+		if (dayfile_stream(dayfile_path, 0,
+				   bin ? sizeof(struct sink_bin_rec_str) : 0,
+				   index_stream_chunk, &build) == -1) {
+			free(path);
+			return -1;
+		}
+		save_idx(path, idx);
+		free(path);
+		return 0;
+	}
+
+	fd = open(dayfile_path, O_RDONLY);
+	if ((fd == -1) || (fstat(fd, &statbuf) == -1)) {
+		if (fd != -1)
+			close(fd);
+		free(path);
+		return -1;
+	}
+
+	if (statbuf.st_size == 0) {
+		fill_none(idx);
+	} else {
+		map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE,
+			   fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			free(path);
+			return -1;
+		}
+		dayidx_build(map, statbuf.st_size, bin, idx);
+		munmap(map, statbuf.st_size);
+	}
+	close(fd);
+
+	save_idx(path, idx);
+	free(path);
+
+	return 0;
+}
+
+uint32_t
+dayidx_seek(const uint32_t idx[DAYIDX_ENTRIES], int minute)
+{
+	int m;
+
+	if (minute >= DAYIDX_ENTRIES)
+		minute = DAYIDX_ENTRIES - 1;
+
+	/* latest indexed minute not after the one requested */
+	for (m = minute; m >= 0; m--)
+		if (idx[m] != DAYIDX_NONE)
+			return idx[m];
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * iosync module: fdatasync on an I/O thread
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "iosync.h"
+#include "rt.h"
+
+/*
+ * private functions
+ */
+
+static void
+do_sync(const struct iosync_req_str *req)
+{
+	/* pipes and terminals cannot be synced, and need not be */
+	if ((fdatasync(req->fd) == -1) && (errno != EINVAL)
+	    && (errno != EROFS))
+		syslog(LOG_ERR, "fdatasync: %s", strerror(errno));
+
+	if (req->close && (req->fd != STDOUT_FILENO))
+		close(req->fd);
+}
+
+static void *
+iosync_thread(void *arg)
+{
+	struct iosync_str *iosync = arg;
+	struct iosync_req_str req;
+
+	pthread_mutex_lock(&iosync->lock);
+	for (;;) {
+		while ((iosync->len == 0) && !iosync->stop)
+			pthread_cond_wait(&iosync->cond, &iosync->lock);
+		if (iosync->len == 0)
+			break;	/* stopped and drained */
+
+		req = iosync->req[iosync->head];
+		iosync->head = (iosync->head + 1) % IOSYNC_QUEUE;
+		iosync->len--;
+
+		pthread_mutex_unlock(&iosync->lock);
+		do_sync(&req);
+		pthread_mutex_lock(&iosync->lock);
+	}
+	pthread_mutex_unlock(&iosync->lock);
+
+	return NULL;
+}
+
+/*
+ * public functions
+ */
+
+int
+iosync_start(struct iosync_str *iosync)
+{
+	int ret;
+
+	iosync->head = iosync->len = 0;
+	iosync->stop = false;
+	iosync->dropped = 0;
+
+	pthread_mutex_init(&iosync->lock, NULL);
+	pthread_cond_init(&iosync->cond, NULL);
+
+	ret = rt_thread_create(&iosync->thread, iosync_thread, iosync);
+	if (ret != 0) {
+		syslog(LOG_ERR, "iosync pthread_create: %s", strerror(ret));
+		iosync->running = false;
+		return -1;
+	}
+	iosync->running = true;
+
+	return 0;
+}
+
+void
+iosync_request(struct iosync_str *iosync, int fd, bool close_after)
+{
+	unsigned i;
+
+	if (!iosync->running) {
+		if (close_after && (fd != STDOUT_FILENO))
+			close(fd);
+		return;
+	}
+
+	pthread_mutex_lock(&iosync->lock);
+
+	/* one sync of an fd covers every write queued before it */
+	for (i = 0; i < iosync->len; i++) {
+		struct iosync_req_str *req =
+			&iosync->req[(iosync->head + i) % IOSYNC_QUEUE];
+
+		if ((req->fd == fd) && !req->close) {
+			req->close = close_after;
+			pthread_mutex_unlock(&iosync->lock);
+			return;
+		}
+	}
+
+	if (iosync->len == IOSYNC_QUEUE) {
+		/* never wait for the disk: skip the sync */
+		iosync->dropped++;
+		pthread_mutex_unlock(&iosync->lock);
+		if (close_after && (fd != STDOUT_FILENO))
+			close(fd);
+		return;
+	}
+
+	iosync->req[(iosync->head + iosync->len) % IOSYNC_QUEUE] =
+		(struct iosync_req_str){ .fd = fd, .close = close_after };
+	iosync->len++;
+	pthread_cond_signal(&iosync->cond);
+
+	pthread_mutex_unlock(&iosync->lock);
+}
+
+void
+iosync_stop(struct iosync_str *iosync)
+{
+	if (!iosync->running)
+		return;
+
+	pthread_mutex_lock(&iosync->lock);
+	iosync->stop = true;
+	pthread_cond_signal(&iosync->cond);
+	pthread_mutex_unlock(&iosync->lock);
+
+	pthread_join(iosync->thread, NULL);
+	iosync->running = false;
+
+	if (iosync->dropped != 0)
+		syslog(LOG_WARNING, "iosync: %lu syncs skipped, queue full",
+		       iosync->dropped);
+
+	pthread_mutex_destroy(&iosync->lock);
+	pthread_cond_destroy(&iosync->cond);
+}
@@ -0,0 +1,225 @@
+/*
+ * journal module: append-only binary log of state transitions
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "journal.h"
+#include "util.h"
+
+static const char *const type_name[JOURNAL_NUM_TYPES] = {
+	[JOURNAL_START] = "START",
+	[JOURNAL_STOP] = "STOP",
+	[JOURNAL_HEAT_ON] = "HEAT_ON",
+	[JOURNAL_HEAT_OFF] = "HEAT_OFF",
+	[JOURNAL_HOLD] = "HOLD",
+	[JOURNAL_OVERRIDE] = "OVERRIDE",
+	[JOURNAL_ADVANCE] = "ADVANCE",
+	[JOURNAL_RESUME] = "RESUME",
+	[JOURNAL_SCHED_EVENT] = "EVENT",
+	[JOURNAL_CONFIG] = "CONFIG",
+	[JOURNAL_CLOCK] = "CLOCK",
+	[JOURNAL_SENSOR] = "SENSOR",
+	[JOURNAL_PROFILE] = "PROFILE",
+};
+
+/*
+ * public functions
+ */
+
+int
+journal_open(struct journal_str *journal, const char *data_dir)
+{
+	struct stat statbuf;
+	char *path;
+
+	journal->fd = -1;
+	journal->torn = 0;
+
+	if (data_dir == NULL)
+		return 0;
+
+	if (asprintf(&path, "%s/%s", data_dir, JOURNAL_FNAME) == -1)
+		return -1;
+
+	journal->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	free(path);
+	if (journal->fd == -1)
+		return -1;
+
+	/*
+	 * a crash mid-write leaves part of a record: cut it off, or
+	 * every record appended after it would be misaligned
+	 */
+	if (fstat(journal->fd, &statbuf) == -1)
+		goto err;
+	journal->torn = statbuf.st_size % sizeof(struct journal_rec_str);
+	if ((journal->torn != 0)
+	    && (ftruncate(journal->fd, statbuf.st_size - journal->torn) == -1))
+		goto err;
+
+	return 0;
+
+err:
+	close(journal->fd);
+	journal->fd = -1;
+
+	return -1;
+}
+
+int
+journal_append(struct journal_str *journal,
+	       const struct journal_rec_str *rec)
+{
+	if (journal->fd == -1)
+		return 0;
+
+	/* one write per record, O_APPEND keeps records whole */
+	if (write(journal->fd, rec, sizeof *rec) != sizeof *rec)
+		return -1;
+
+	return 0;
+}
+
+int
+journal_close(struct journal_str *journal)
+{
+	int ret = 0;
+
+	if (journal->fd != -1)
+		ret = close(journal->fd);
+	journal->fd = -1;
+
+	return ret;
+}
+
+int
+journal_read(const char *path, struct journal_rec_str **recs, size_t *num)
+{
+	struct stat statbuf;
+	ssize_t n;
+	int fd;
+
+	*recs = NULL;
+	*num = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &statbuf) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	*num = statbuf.st_size / sizeof **recs;
+	if (*num == 0) {
+		close(fd);
+		return 0;
+	}
+
+	*recs = malloc(*num * sizeof **recs);
+	if (*recs == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	n = readn(fd, *recs, *num * sizeof **recs);
+	close(fd);
+	if (n == -1) {
+		free(*recs);
+		*recs = NULL;
+		return -1;
+	}
+
+	/* still being appended to: keep what is complete */
+	*num = n / sizeof **recs;
+
+	return 0;
+}
+
+void
+journal_replay(const struct journal_rec_str *recs, size_t num,
+	       struct journal_summary_str *summary)
+{
+	size_t i;
+
+	memset(summary, 0, sizeof *summary);
+
+	if (num == 0)
+		return;
+
+	summary->first_ns = recs[0].realtime_ns;
+	summary->last_ns = recs[num - 1].realtime_ns;
+
+	for (i = 0; i < num; i++) {
+		const struct journal_rec_str *rec = &recs[i];
+		const struct journal_rec_str *prev;
+		double dt;
+
+		if (rec->type < JOURNAL_NUM_TYPES)
+			summary->count[rec->type]++;
+
+		if (rec->type == JOURNAL_HEAT_ON)
+			summary->cycles++;
+		if ((rec->type == JOURNAL_SENSOR) && (rec->arg != 0))
+			summary->sensor_faults++;
+
+		/*
+		 * state holds until the next record, within a run.
+		 * the end of a run without a STOP is unknown.
+		 */
+		if ((i == 0) || (rec->type == JOURNAL_START))
+			continue;
+
+		prev = &recs[i - 1];
+		dt = (rec->monotonic_ns - prev->monotonic_ns) * 1e-9;
+		if (dt <= 0.0)
+			continue;
+
+		summary->covered_sec += dt;
+		if (prev->heat)
+			summary->heat_sec += dt;
+		if (prev->mode < ROLLUP_NUM_MODES)
+			summary->mode_sec[prev->mode] += dt;
+	}
+}
+
+const char *
+journal_type_name(int type)
+{
+	if ((type < 0) || (type >= JOURNAL_NUM_TYPES))
+		return "?";
+
+	return type_name[type];
+}
@@ -0,0 +1,304 @@
+/*
+ * end-to-end control loop benchmark
+ *
+ * drives tstat_control() against the in-memory sensor and relay
+ * with a virtual clock, as fast as possible.  output is one JSON
+ * object per line: logging disabled, logging at the requested
+ * interval, and change-only (delta) logging at that interval.
+ *
+ * usage: bang-loopbench [TICKS [DATA_INT]]
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "thermostat.h"
+#include "schedule.h"
+#include "cfgfile.h"
+#include "controls.h"
+#include "sim.h"
+#include "benchutil.h"
+
+#define DFLT_TICKS    100000L
+#define DFLT_DATA_INT 1
+#define DELTA         0.5	/* deg F, as in the generated config */
+#define KEYFRAME      600
+
+/* syscall counting runs under ptrace, so use fewer ticks */
+#define MAX_TRACED_TICKS 20000L
+
+/* Saturday 2023-11-11 23:00 EST */
+#define START_SSE 1699761600L
+
+static char tmp_dir[] = "/tmp/bang-loopbench-XXXXXX";
+static char *cfg_path;
+
+static const char default_cfg[] =
+	"units = \"F\"\n"
+	"schedule:\n"
+	"(\n"
+	"\t{ time: { day = \"all\"\n hour = 5\n min = 50 }\n"
+	"\t  setpoint = 65.0 },\n"
+	"\t{ time: { day = \"mon-fri\"\n hour = 8 }\n"
+	"\t  setpoint = 50.0 },\n"
+	"\t{ time: { day = \"mon-fri\"\n hour = 19 }\n"
+	"\t  setpoint = 65.0 },\n"
+	"\t{ time: { day = \"all\"\n hour = 21\n min = 30 }\n"
+	"\t  setpoint = 58.0 }\n"
+	")\n";
+
+/*
+ * private functions
+ */
+
+static int
+write_config(void)
+{
+	FILE *out;
+
+	if (asprintf(&cfg_path, "%s/bench.cfg", tmp_dir) == -1)
+		return -1;
+
+	out = fopen(cfg_path, "w");
+	if (out == NULL)
+		return -1;
+
+	fputs(default_cfg, out);
+
+	return (fclose(out) == EOF) ? -1 : 0;
+}
+
+/* run the real control loop for the given number of ticks */
+static int
+run_loop(long ticks, const struct datalog_str *datalog)
+{
+	static struct schedule_str schedule;
+	struct sim_str sim;
+	struct sensor_str sensor;
+	struct actuator_str actuator;
+	struct control_str control = { .cycle = { .min_on = 0 } };
+
+	schedule.ctrl_dir = tmp_dir;
+	if (cfg_load(cfg_path, &schedule.config) == -1)
+		return -1;
+	if (ctrls_init(&schedule) == -1)
+		return -1;
+
+	sim_init(&sim, START_SSE, ticks);
+	sim_sensor_open(&sensor, &sim);
+	sim_actuator_open(&actuator, &sim);
+
+	return tstat_control(&sensor, &actuator, &schedule, &control, datalog,
+			     &sim);
+}
+
+/* count syscalls made by the loop in a traced child, -1 if unavailable */
+static long
+count_syscalls(long ticks, const struct datalog_str *datalog)
+{
+	pid_t pid;
+	int status;
+	long stops = 0;
+
+	pid = fork();
+	if (pid == -1)
+		return -1;
+
+	if (pid == 0) {
+		/* child: stop until the tracer is ready, then run */
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+			_exit(EXIT_FAILURE);
+		raise(SIGSTOP);
+		_exit((run_loop(ticks, datalog) == -1)
+		      ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	if ((waitpid(pid, &status, 0) == -1) || !WIFSTOPPED(status))
+		return -1;
+
+	if (ptrace(PTRACE_SETOPTIONS, pid, NULL,
+		   (void *)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)) == -1) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		return -1;
+	}
+
+	for (;;) {
+		if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == -1)
+			break;
+		if (waitpid(pid, &status, 0) == -1)
+			return -1;
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+		if (WIFSTOPPED(status) && (WSTOPSIG(status) == (SIGTRAP | 0x80)))
+			stops++;
+	}
+
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+		return -1;
+
+	/* one stop on syscall entry, one on exit */
+	return stops / 2;
+}
+
+static double
+tv_to_ns(const struct timeval *tv)
+{
+	return tv->tv_sec * 1e9 + tv->tv_usec * 1e3;
+}
+
+static int
+bench_loop(long ticks, int data_interval, double delta)
+{
+	static struct sink_str sink;
+	struct datalog_str datalog = {
+		.data_dir = tmp_dir,
+		.sinks = &sink,
+		.num_sinks = 1,
+		.archive = NULL,
+	};
+	struct rusage ru0, ru1;
+	struct timespec start;
+	unsigned long allocs;
+	long long ns;
+	long traced_ticks, syscalls;
+	double user_ns, sys_ns;
+
+	if (sink_init(&sink, "dat") == -1)
+		return -1;
+	sink.interval = data_interval;
+	sink.data_dir = tmp_dir;
+	sink.delta = delta;
+	sink.keyframe = KEYFRAME;
+	if (sink_open(&sink) == -1)
+		return -1;
+
+	getrusage(RUSAGE_SELF, &ru0);
+	allocs = bench_alloc_count();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (run_loop(ticks, &datalog) == -1)
+		return -1;
+
+	ns = bench_elapsed_ns(&start);
+	allocs = bench_alloc_count() - allocs;
+	getrusage(RUSAGE_SELF, &ru1);
+
+	user_ns = tv_to_ns(&ru1.ru_utime) - tv_to_ns(&ru0.ru_utime);
+	sys_ns = tv_to_ns(&ru1.ru_stime) - tv_to_ns(&ru0.ru_stime);
+
+	traced_ticks = (ticks < MAX_TRACED_TICKS) ? ticks : MAX_TRACED_TICKS;
+	syscalls = count_syscalls(traced_ticks, &datalog);
+	sink_close(&sink);
+
+	printf("{\"name\": \"tstat_control\", \"data_int\": %d,"
+	       " \"delta\": %.2f, \"ticks\": %ld, \"ticks_per_sec\": %.0f,"
+	       " \"wall_ns_per_tick\": %.1f, \"cpu_ns_per_tick\": %.1f,"
+	       " \"user_ns_per_tick\": %.1f, \"sys_ns_per_tick\": %.1f,",
+	       data_interval, delta, ticks, ticks * 1e9 / ns,
+	       (double)ns / ticks, (user_ns + sys_ns) / ticks,
+	       user_ns / ticks, sys_ns / ticks);
+	if (syscalls == -1)
+		printf(" \"syscalls_per_tick\": null,");
+	else
+		printf(" \"syscalls_per_tick\": %.2f,",
+		       (double)syscalls / traced_ticks);
+	printf(" \"ctx_switches_per_tick\": %.4f,"
+	       " \"minflt_per_tick\": %.4f, \"allocs_per_tick\": %.3f}\n",
+	       (double)(ru1.ru_nvcsw - ru0.ru_nvcsw
+			+ ru1.ru_nivcsw - ru0.ru_nivcsw) / ticks,
+	       (double)(ru1.ru_minflt - ru0.ru_minflt) / ticks,
+	       (double)allocs / ticks);
+	fflush(stdout);
+
+	return 0;
+}
+
+/* remove files written into the scratch directory */
+static void
+cleanup(void)
+{
+	char *cmd;
+
+	if (asprintf(&cmd, "rm -rf '%s'", tmp_dir) != -1) {
+		if (system(cmd) == -1)
+			perror("system");
+		free(cmd);
+	}
+}
+
+/* M A I N */
+int
+main(int argc, char *argv[])
+{
+	long ticks = DFLT_TICKS;
+	int data_interval = DFLT_DATA_INT;
+	int ret;
+
+	if (argc > 1)
+		ticks = strtol(argv[1], NULL, 0);
+	if (argc > 2)
+		data_interval = strtol(argv[2], NULL, 0);
+	if ((ticks <= 0) || (data_interval < 0)) {
+		fprintf(stderr, "usage: %s [TICKS [DATA_INT]]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* fixed zone, independent of host configuration */
+	setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+	tzset();
+
+	if (mkdtemp(tmp_dir) == NULL) {
+		fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (write_config() == -1) {
+		fprintf(stderr, "write config: %s\n", strerror(errno));
+		cleanup();
+		exit(EXIT_FAILURE);
+	}
+
+	ret = bench_loop(ticks, 0, 0.0);
+	if ((ret == 0) && (data_interval != 0))
+		ret = bench_loop(ticks, data_interval, 0.0);
+	if ((ret == 0) && (data_interval != 0))
+		ret = bench_loop(ticks, data_interval, DELTA);
+
+	cleanup();
+	free(cfg_path);
+
+	exit((ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
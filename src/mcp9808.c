@@ -26,14 +26,108 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <errno.h>
 
 #include "mcp9808.h"
 #include "util.h"
 
+/* register pointers */
+#define REG_CONFIG	0x01
+#define REG_T_UPPER	0x02
+#define REG_T_LOWER	0x03
+#define REG_T_CRIT	0x04
+#define REG_T_AMB	0x05
+#define REG_RESOLUTION	0x08
+
+#define CONFIG_SHDN	0x0100
+#define CONFIG_ALERT	0x000F	/* mode, polarity, select, control */
+#define CONFIG_ALT_CNT	0x0008	/* output enabled */
+
+#define LIMIT_MAX	0x0FFC	/* +255.75 deg C */
+
+/* limit register range, quarter degrees */
+#define QUARTERS_MIN	-1024.0
+#define QUARTERS_MAX	1023.0
+
+static const int conv_ms[MCP9808_NUM_RES] = {
+	[MCP9808_RES_0_5] = 30,
+	[MCP9808_RES_0_25] = 65,
+	[MCP9808_RES_0_125] = 130,
+	[MCP9808_RES_0_0625] = 250,
+};
+
+/*
+ * private functions
+ */
+
+/*
+ * 13-bit signed, in 16ths of degree C (big-endian)
+ * first 3 bits are flags, ignored
+ */
+static double
+decode_t_amb(const uint8_t rbuf[2])
+{
+	uint16_t ut;
+	int st;
+
+	ut = ((rbuf[0] & 0x1F) << 8) | rbuf[1];
+	if (rbuf[0] & 0x10)
+		st = (int)ut - (1U << 13); /* negative */
+	else
+		st = ut;                   /* positive */
+
+	return (double)st / 16.0;
+}
+
+/* 16-bit registers are big-endian */
+static int
+read_reg16(int fd, uint8_t reg, uint16_t *val)
+{
+	uint8_t rbuf[2];
+
+	if ((writen(fd, &reg, sizeof reg) == -1)
+	    || (readn(fd, rbuf, sizeof rbuf) == -1))
+		return -1;
+
+	*val = (rbuf[0] << 8) | rbuf[1];
+
+	return 0;
+}
+
+static int
+write_reg16(int fd, uint8_t reg, uint16_t val)
+{
+	uint8_t wbuf[3] = { reg, val >> 8, val & 0xFF };
+
+	return (writen(fd, wbuf, sizeof wbuf) == -1) ? -1 : 0;
+}
+
+/* limit registers: 13-bit two's complement, 16ths, low 2 bits zero */
+static uint16_t
+limit_raw(double quarters)
+{
+	return (uint16_t)((long)quarters * 4) & 0x1FFC;
+}
+
+/* whole quarters, within what the limit registers hold */
+static double
+clamp_quarters(double quarters)
+{
+	if (quarters < QUARTERS_MIN)
+		return QUARTERS_MIN;
+	if (quarters > QUARTERS_MAX)
+		return QUARTERS_MAX;
+
+	return quarters;
+}
+
 /*
  * public functions
  */
@@ -41,19 +135,13 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 int
 mcp9808_config(int fd, uint8_t slave_addr)
 {
-	if (ioctl(fd, I2C_SLAVE, slave_addr) == -1) {
-		fprintf(stderr,
-			"ioctl(I2C_SLAVE, 0x%02X): %s\n",
-			slave_addr, strerror(errno));
-		return -1;
-	}
-	return 0;
+	return ioctl(fd, I2C_SLAVE, slave_addr);
 }
 
 int
 mcp9808_read_temp(int fd, uint16_t *raw, double *temp)
 {
-	static const uint8_t addr_t_amb = 0x05;
+	static const uint8_t addr_t_amb = REG_T_AMB;
 	uint8_t rbuf[2];
 
 	/* write command */
@@ -67,22 +155,138 @@ mcp9808_read_temp(int fd, uint16_t *raw, double *temp)
 	if (raw != NULL)
 		*raw = (rbuf[0] << 8) | rbuf[1];
 
-	if (temp != NULL) {
-		uint16_t ut;
-		int st;
-
-		/*
-		 * 13-bit signed, in 16ths of degree C (big-endian)
-		 * first 3 bits are flags, ignored
-		 */
-		ut = ((rbuf[0] & 0x1F) << 8) | rbuf[1];
-		if (rbuf[0] & 0x10)
-			st = (int)ut - (1U << 13); /* negative */
-		else
-			st = ut;                   /* positive */
-
-		*temp = (double)st / 16.0;
+	if (temp != NULL)
+		*temp = decode_t_amb(rbuf);
+
+	return 0;
+}
+
+bool
+mcp9808_can_burst(int fd)
+{
+	unsigned long funcs;
+
+	if (ioctl(fd, I2C_FUNCS, &funcs) == -1)
+		return false;
+
+	return (funcs & I2C_FUNC_I2C) != 0;
+}
+
+int
+mcp9808_read_burst(int fd, uint8_t slave_addr, double *temp, int n)
+{
+	static uint8_t addr_t_amb = REG_T_AMB;
+	struct i2c_msg msgs[2 * MCP9808_BURST_MAX];
+	struct i2c_rdwr_ioctl_data xfer = { .msgs = msgs, .nmsgs = 0 };
+	uint8_t rbuf[MCP9808_BURST_MAX][2];
+	int i;
+
+	if ((n < 1) || (n > MCP9808_BURST_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* pointer write, repeated start, 2-byte read; n times, one ioctl */
+	for (i = 0; i < n; i++) {
+		msgs[xfer.nmsgs++] = (struct i2c_msg){
+			.addr = slave_addr, .flags = 0,
+			.len = sizeof addr_t_amb, .buf = &addr_t_amb };
+		msgs[xfer.nmsgs++] = (struct i2c_msg){
+			.addr = slave_addr, .flags = I2C_M_RD,
+			.len = sizeof rbuf[i], .buf = rbuf[i] };
 	}
 
+	if (ioctl(fd, I2C_RDWR, &xfer) == -1)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		temp[i] = decode_t_amb(rbuf[i]);
+
 	return 0;
 }
+
+int
+mcp9808_set_resolution(int fd, enum mcp9808_res_enum res)
+{
+	uint8_t wbuf[2] = { REG_RESOLUTION, res };
+
+	if (res >= MCP9808_NUM_RES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return (writen(fd, wbuf, sizeof wbuf) == -1) ? -1 : 0;
+}
+
+int
+mcp9808_set_shutdown(int fd, bool shutdown)
+{
+	uint16_t config;
+
+	/* leave the alert and hysteresis bits as they are */
+	if (read_reg16(fd, REG_CONFIG, &config) == -1)
+		return -1;
+
+	if (shutdown)
+		config |= CONFIG_SHDN;
+	else
+		config &= ~CONFIG_SHDN;
+
+	return write_reg16(fd, REG_CONFIG, config);
+}
+
+int
+mcp9808_conv_ms(enum mcp9808_res_enum res)
+{
+	return (res < MCP9808_NUM_RES) ? conv_ms[res] : conv_ms[0];
+}
+
+int
+mcp9808_wake(int fd, enum mcp9808_res_enum res)
+{
+	struct timespec delay;
+	int ms = mcp9808_conv_ms(res) + MCP9808_CONV_SLACK_MS;
+
+	if (mcp9808_set_shutdown(fd, false) == -1)
+		return -1;
+
+	delay.tv_sec = ms / 1000;
+	delay.tv_nsec = (ms % 1000) * 1000000L;
+	while ((nanosleep(&delay, &delay) == -1) && (errno == EINTR))
+		;
+
+	return 0;
+}
+
+int
+mcp9808_set_limits(int fd, double *lower, double *upper)
+{
+	double lower_q = clamp_quarters(ceil(*lower * 4.0));
+	double upper_q = clamp_quarters(floor(*upper * 4.0));
+
+	if ((write_reg16(fd, REG_T_CRIT, LIMIT_MAX) == -1)
+	    || (write_reg16(fd, REG_T_LOWER, limit_raw(lower_q)) == -1)
+	    || (write_reg16(fd, REG_T_UPPER, limit_raw(upper_q)) == -1))
+		return -1;
+
+	*lower = lower_q / 4.0;
+	*upper = upper_q / 4.0;
+
+	return 0;
+}
+
+int
+mcp9808_set_alert(int fd, bool enable)
+{
+	uint16_t config;
+
+	if (read_reg16(fd, REG_CONFIG, &config) == -1)
+		return -1;
+
+	/* comparator mode, active low, T_UPPER/T_LOWER/T_CRIT */
+	config &= ~CONFIG_ALERT;
+	if (enable)
+		config |= CONFIG_ALT_CNT;
+
+	return write_reg16(fd, REG_CONFIG, config);
+}
@@ -0,0 +1,303 @@
+/*
+ * model module: online fit of a first-order thermal model
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "model.h"
+
+#define MODEL_MAGIC "bang-model"
+#define MODEL_VERSION 2	/* 1: fitted on the unfiltered average */
+
+/*
+ * private functions
+ */
+
+/* forgetting factor for MODEL_MEMORY */
+static double
+lambda(void)
+{
+	return 1.0 - 1.0 / MODEL_MEMORY;
+}
+
+/* one-second step of the MODEL_FILTER low-pass */
+static double
+low_pass(double filtered, double sample)
+{
+	return filtered + (sample - filtered) / MODEL_FILTER;
+}
+
+/* one recursive least squares step: y = theta . x + noise */
+static void
+rls(struct model_str *model, const double x[MODEL_NUM_PARAMS], double y)
+{
+	double px[MODEL_NUM_PARAMS], k[MODEL_NUM_PARAMS];
+	double denom, err, trace;
+	double lam = lambda();
+	int i, j;
+
+	denom = lam;
+	err = y;
+	for (i = 0; i < MODEL_NUM_PARAMS; i++) {
+		px[i] = 0.0;
+		for (j = 0; j < MODEL_NUM_PARAMS; j++)
+			px[i] += model->p[i][j] * x[j];
+		denom += x[i] * px[i];
+		err -= model->theta[i] * x[i];
+	}
+
+	for (i = 0; i < MODEL_NUM_PARAMS; i++) {
+		k[i] = px[i] / denom;
+		model->theta[i] += k[i] * err;
+	}
+
+	/*
+	 * without excitation (heat off all day, temperature flat) the
+	 * covariance would grow by 1 / lambda each second: stop
+	 * forgetting once it is back to where it started
+	 */
+	trace = 0.0;
+	for (i = 0; i < MODEL_NUM_PARAMS; i++)
+		trace += model->p[i][i];
+	if (trace >= MODEL_NUM_PARAMS * MODEL_P0)
+		lam = 1.0;
+
+	for (i = 0; i < MODEL_NUM_PARAMS; i++)
+		for (j = i; j < MODEL_NUM_PARAMS; j++) {
+			model->p[i][j] = (model->p[i][j] - k[i] * px[j]) / lam;
+			model->p[j][i] = model->p[i][j];	/* symmetric */
+		}
+}
+
+/*
+ * public functions
+ */
+
+void
+model_init(struct model_str *model)
+{
+	int i, j;
+
+	for (i = 0; i < MODEL_NUM_PARAMS; i++) {
+		model->theta[i] = 0.0;
+		for (j = 0; j < MODEL_NUM_PARAMS; j++)
+			model->p[i][j] = (i == j) ? MODEL_P0 : 0.0;
+	}
+	model->samples = 0;
+	model_break(model);
+}
+
+void
+model_update(struct model_str *model, double temp, bool heat, time_t now)
+{
+	double x[MODEL_NUM_PARAMS];
+	double temp_f, heat_f;
+
+	if (!model->primed || (now - model->prev_time != 1)) {
+		/* start the filter as if it had always been here */
+		model->primed = true;
+		model->temp_f = temp;
+		model->heat_f = heat ? 1.0 : 0.0;
+		model->prev_time = now;
+		model->settled = 0;
+		return;
+	}
+
+	temp_f = low_pass(model->temp_f, temp);
+	heat_f = low_pass(model->heat_f, heat ? 1.0 : 0.0);
+
+	/* until the made-up start has filtered out */
+	if (model->settled >= MODEL_SETTLE) {
+		x[0] = 1.0;
+		x[1] = model->temp_f;
+		x[2] = heat_f;
+		rls(model, x, temp_f - model->temp_f);
+		model->samples++;
+	} else {
+		model->settled++;
+	}
+
+	model->temp_f = temp_f;
+	model->heat_f = heat_f;
+	model->prev_time = now;
+}
+
+void
+model_break(struct model_str *model)
+{
+	model->primed = false;
+	model->temp_f = 0.0;
+	model->heat_f = 0.0;
+	model->prev_time = 0;
+	model->settled = 0;
+}
+
+bool
+model_valid(const struct model_str *model)
+{
+	return (model->samples >= MODEL_MIN_SAMPLES)
+		&& (model_loss(model) > 0.0) && (model_gain(model) > 0.0);
+}
+
+double
+model_loss(const struct model_str *model)
+{
+	return -model->theta[1];
+}
+
+double
+model_tau(const struct model_str *model)
+{
+	return 1.0 / model_loss(model);
+}
+
+double
+model_gain(const struct model_str *model)
+{
+	return model->theta[2];
+}
+
+double
+model_ambient(const struct model_str *model)
+{
+	return model->theta[0] / model_loss(model);
+}
+
+double
+model_recovery(const struct model_str *model, double from_degc,
+	       double to_degc)
+{
+	double top;		/* where the heat on settles */
+
+	if (from_degc >= to_degc)
+		return 0.0;
+
+	/* T(t) = top - (top - from) * exp(-t / tau) */
+	top = model_ambient(model) + model_gain(model) * model_tau(model);
+	if (!model_valid(model) || (top <= to_degc))
+		return INFINITY;
+
+	return model_tau(model) * log((top - from_degc) / (top - to_degc));
+}
+
+int
+model_load(struct model_str *model, const char *data_dir)
+{
+	struct model_str tmp;
+	char magic[16];
+	char *path;
+	FILE *in;
+	int version;
+	int i, j;
+	int n;
+
+	if (asprintf(&path, "%s/%s", data_dir, MODEL_FNAME) == -1)
+		return -1;
+	in = fopen(path, "r");
+	free(path);
+	if (in == NULL)
+		return -1;
+
+	model_init(&tmp);
+	n = fscanf(in, "%15s %d %lu", magic, &version, &tmp.samples);
+	for (i = 0; i < MODEL_NUM_PARAMS; i++)
+		n += fscanf(in, "%lf", &tmp.theta[i]);
+	for (i = 0; i < MODEL_NUM_PARAMS; i++)
+		for (j = 0; j < MODEL_NUM_PARAMS; j++)
+			n += fscanf(in, "%lf", &tmp.p[i][j]);
+	fclose(in);
+
+	/* a torn or foreign file is no model at all */
+	if ((n != 3 + MODEL_NUM_PARAMS * (MODEL_NUM_PARAMS + 1))
+	    || (strcmp(magic, MODEL_MAGIC) != 0)
+	    || (version != MODEL_VERSION)) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < MODEL_NUM_PARAMS; i++) {
+		if (!isfinite(tmp.theta[i])) {
+			errno = EINVAL;
+			return -1;
+		}
+		for (j = 0; j < MODEL_NUM_PARAMS; j++)
+			if (!isfinite(tmp.p[i][j])) {
+				errno = EINVAL;
+				return -1;
+			}
+	}
+
+	*model = tmp;
+
+	return 0;
+}
+
+int
+model_save(const struct model_str *model, const char *data_dir)
+{
+	char *path, *tmp_path;
+	FILE *out;
+	int i, j;
+	int ret = -1;
+
+	if (asprintf(&path, "%s/%s", data_dir, MODEL_FNAME) == -1)
+		return -1;
+	if (asprintf(&tmp_path, "%s.tmp", path) == -1)
+		goto out_path;
+
+	out = fopen(tmp_path, "w");
+	if (out == NULL)
+		goto out_tmp;
+
+	fprintf(out, "%s %d %lu\n", MODEL_MAGIC, MODEL_VERSION,
+		model->samples);
+	for (i = 0; i < MODEL_NUM_PARAMS; i++)
+		fprintf(out, "%.17g%c", model->theta[i],
+			(i == MODEL_NUM_PARAMS - 1) ? '\n' : ' ');
+	for (i = 0; i < MODEL_NUM_PARAMS; i++)
+		for (j = 0; j < MODEL_NUM_PARAMS; j++)
+			fprintf(out, "%.17g%c", model->p[i][j],
+				(j == MODEL_NUM_PARAMS - 1) ? '\n' : ' ');
+
+	/* not synced: a torn file after a crash loads as no model */
+	if ((fclose(out) == EOF) || (rename(tmp_path, path) == -1)) {
+		unlink(tmp_path);
+		goto out_tmp;
+	}
+	ret = 0;
+
+out_tmp:
+	free(tmp_path);
+out_path:
+	free(path);
+
+	return ret;
+}
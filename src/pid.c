@@ -0,0 +1,127 @@
+/*
+ * pid module: PID controller with time-proportioning relay output
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "pid.h"
+#include "alog.h"
+
+/*
+ * private functions
+ */
+
+static double
+clamp(double val, double lo, double hi)
+{
+	return (val < lo) ? lo : (val > hi) ? hi : val;
+}
+
+/* update the output from this sample */
+static void
+step(struct pid_str *pid, double setpoint, double temp, time_t now)
+{
+	double err = setpoint - temp;
+	double dt, p, d, out;
+
+	if (!pid->primed) {
+		pid->prev_temp = temp;
+		pid->prev_time = now;
+		pid->primed = true;
+	}
+
+	/* a step back on the control clock can't happen, but be safe */
+	dt = (double)(now - pid->prev_time);
+	if (dt < 0.0)
+		dt = 0.0;
+
+	p = pid->cfg.kp * err;
+	/* on the measurement: no kick when the setpoint changes */
+	d = (dt > 0.0) ? -pid->cfg.kd * (temp - pid->prev_temp) / dt : 0.0;
+
+	/*
+	 * anti-windup: integrate only while the output isn't pinned in
+	 * the direction the error pushes, and keep the I term in [0, 1]
+	 */
+	out = p + pid->cfg.ki * pid->integral + d;
+	if (!((out >= 1.0) && (err > 0.0)) && !((out <= 0.0) && (err < 0.0)))
+		pid->integral += err * dt;
+	if (pid->cfg.ki > 0.0)
+		pid->integral = clamp(pid->integral, 0.0, 1.0 / pid->cfg.ki);
+	else
+		pid->integral = 0.0;
+
+	pid->duty = clamp(p + pid->cfg.ki * pid->integral + d, 0.0, 1.0);
+	pid->prev_temp = temp;
+	pid->prev_time = now;
+}
+
+/*
+ * public functions
+ */
+
+void
+pid_init(struct pid_str *pid)
+{
+	pid->integral = 0.0;
+	pid->prev_temp = 0.0;
+	pid->prev_time = 0;
+	pid->primed = false;
+	pid->duty = 0.0;
+	pid->window_start = 0;
+	pid->on_sec = 0;
+	pid->window_setpoint = NAN;
+	pid->in_window = false;
+}
+
+bool
+pid_control(struct pid_str *pid, double setpoint, double temp, time_t now,
+	    int min_pulse)
+{
+	int window = pid->cfg.window;
+
+	step(pid, setpoint, temp, now);
+
+	if (!pid->in_window || (now - pid->window_start >= window)
+	    || (setpoint != pid->window_setpoint)) {
+		pid->in_window = true;
+		pid->window_start = now;
+		pid->window_setpoint = setpoint;
+
+		/* no slivers: they cost a relay cycle for nothing */
+		pid->on_sec = lround(pid->duty * window);
+		if (pid->on_sec < min_pulse)
+			pid->on_sec = 0;
+		else if (window - pid->on_sec < min_pulse)
+			pid->on_sec = window;
+
+		ALOG(LOG_DEBUG, "pid window: duty %.3f, on %d of %d s",
+		     pid->duty, pid->on_sec, window);
+	}
+
+	return now - pid->window_start < pid->on_sec;
+}
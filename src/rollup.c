@@ -0,0 +1,360 @@
+/*
+ * rollup module: incremental per-minute, per-hour and per-day aggregates
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+
+#include "rollup.h"
+#include "util.h"
+
+static const long period_sec[ROLLUP_NUM_LEVELS] = { 60, 3600, 86400 };
+
+/* rollup file names, strftime format of bucket start */
+static const char *const fname_fmt[ROLLUP_NUM_LEVELS] = {
+	"%Y%m%d.min", "%Y%m%d.hr", "%Y.day"
+};
+
+static const char *const suffix[ROLLUP_NUM_LEVELS] = {
+	".min", ".hr", ".day"
+};
+
+/* longer than any line write_bucket() writes */
+#define LINE_MAX_LEN 160
+
+/*
+ * private functions
+ */
+
+static void
+bucket_reset(struct rollup_bucket_str *bucket, time_t start)
+{
+	memset(bucket, 0, sizeof *bucket);
+	bucket->start = start;
+	bucket->tau_hours = NAN;
+	bucket->gain_per_hour = NAN;
+	bucket->ambient = NAN;
+}
+
+/* data_dir/<bucket file>, caller frees */
+static char *
+bucket_path(const char *data_dir, enum rollup_level_enum level,
+	    time_t start)
+{
+	struct tm bdt;
+	char fname[20];
+	char *path;
+
+	if (localtime_r(&start, &bdt) == NULL)
+		return NULL;
+
+	if (strftime(fname, sizeof fname, fname_fmt[level], &bdt) == 0) {
+		errno = EOVERFLOW;
+		return NULL;
+	}
+
+	if (asprintf(&path, "%s/%s", data_dir, fname) == -1)
+		return NULL;
+
+	return path;
+}
+
+/* append one completed bucket to its rollup file */
+static int
+write_bucket(const char *data_dir, enum rollup_level_enum level,
+	     const struct rollup_bucket_str *bucket,
+	     const struct model_str *model, bool degf)
+{
+	struct tm bdt;
+	char date_buf[20];
+	char *path;
+	FILE *out;
+	double tmin, tmax, tmean;
+
+	if ((data_dir == NULL) || (bucket->count == 0))
+		return 0;
+
+	if (localtime_r(&bucket->start, &bdt) == NULL)
+		return -1;
+
+	if (strftime(date_buf, sizeof date_buf, "%Y%m%d%H%M", &bdt) == 0) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	path = bucket_path(data_dir, level, bucket->start);
+	if (path == NULL)
+		return -1;
+
+	out = fopen(path, "a");
+	free(path);
+	if (out == NULL)
+		return -1;
+
+	tmin = bucket->temp_min_degc;
+	tmax = bucket->temp_max_degc;
+	tmean = bucket->temp_sum_degc / bucket->count;
+	if (degf) {
+		tmin = degc_to_degf(tmin);
+		tmax = degc_to_degf(tmax);
+		tmean = degc_to_degf(tmean);
+	}
+
+	fprintf(out, "%10ld %s %5lu %7.4f %7.4f %7.4f %5lu %4lu"
+		" %5lu %5lu %5lu %5lu",
+		(long)bucket->start, date_buf, bucket->count,
+		tmin, tmax, tmean, bucket->heat_sec, bucket->heat_cycles,
+		bucket->mode_sec[ROLLUP_MODE_SCHED],
+		bucket->mode_sec[ROLLUP_MODE_HOLD],
+		bucket->mode_sec[ROLLUP_MODE_OVERRIDE],
+		bucket->mode_sec[ROLLUP_MODE_ADVANCE]);
+
+	if ((level == ROLLUP_HOUR) && (model != NULL)) {
+		double tau = NAN, gain = NAN, ambient = NAN;
+
+		if (model_valid(model)) {
+			tau = model_tau(model) / 3600;
+			gain = model_gain(model) * 3600;
+			ambient = model_ambient(model);
+			if (degf) {
+				gain *= 1.8;	/* a difference */
+				ambient = degc_to_degf(ambient);
+			}
+		}
+		fprintf(out, " %6.2f %7.3f %7.2f", tau, gain, ambient);
+	}
+	fputc('\n', out);
+
+	return (fclose(out) == EOF) ? -1 : 0;
+}
+
+/*
+ * take up the bucket a stop left part way: the last line of its file,
+ * if it has the same start
+ */
+static int
+resume_bucket(const char *data_dir, enum rollup_level_enum level,
+	      struct rollup_bucket_str *bucket, bool degf)
+{
+	struct rollup_bucket_str last;
+	char buf[2 * LINE_MAX_LEN + 1];
+	char *path, *line;
+	FILE *in;
+	long size;
+	size_t len;
+
+	if (data_dir == NULL)
+		return 0;
+
+	path = bucket_path(data_dir, level, bucket->start);
+	if (path == NULL)
+		return -1;
+	in = fopen(path, "r");
+	free(path);
+	if (in == NULL)
+		return (errno == ENOENT) ? 0 : -1;
+
+	/* the tail holds the last whole line */
+	len = 0;
+	if ((fseek(in, 0, SEEK_END) == 0) && ((size = ftell(in)) != -1)
+	    && (fseek(in, (size > (long)sizeof buf - 1)
+		      ? size - (long)(sizeof buf - 1) : 0, SEEK_SET) == 0))
+		len = fread(buf, 1, sizeof buf - 1, in);
+	fclose(in);
+	buf[len] = '\0';
+
+	/* a torn last line is no bucket */
+	if ((len == 0) || (buf[len - 1] != '\n'))
+		return 0;
+	buf[len - 1] = '\0';
+	line = strrchr(buf, '\n');
+	line = (line == NULL) ? buf : line + 1;
+
+	if ((rollup_parse_line(line, &last) == -1)
+	    || (last.start != bucket->start))
+		return 0;
+
+	if (degf) {
+		last.temp_min_degc = degf_to_degc(last.temp_min_degc);
+		last.temp_max_degc = degf_to_degc(last.temp_max_degc);
+		last.temp_sum_degc = degf_to_degc(last.temp_sum_degc
+						  / last.count) * last.count;
+	}
+	rollup_merge(bucket, &last);
+
+	return 0;
+}
+
+/*
+ * public functions
+ */
+
+void
+rollup_init(struct rollup_str *rollup, const char *data_dir,
+	    const struct model_str *model)
+{
+	int level;
+
+	rollup->data_dir = data_dir;
+	rollup->model = model;
+	rollup->heat_prev = false;
+
+	for (level = 0; level < ROLLUP_NUM_LEVELS; level++)
+		rollup->level[level].open = false;
+}
+
+int
+rollup_add(struct rollup_str *rollup, time_t sse, long gmtoff,
+	   double temp_degc, bool heat, enum rollup_mode_enum mode,
+	   bool degf)
+{
+	int level;
+	int ret = 0;
+	bool cycle;
+
+	cycle = heat && !rollup->heat_prev;
+	rollup->heat_prev = heat;
+
+	for (level = 0; level < ROLLUP_NUM_LEVELS; level++) {
+		struct rollup_level_str *lvl = &rollup->level[level];
+		struct rollup_bucket_str *bucket = &lvl->bucket;
+		long key;
+
+		/* period number in local time */
+		key = (sse + gmtoff) / period_sec[level];
+
+		if (!lvl->open) {
+			/* first sample: pick up where a stop left off */
+			lvl->open = true;
+			lvl->key = key;
+			bucket_reset(bucket, key * period_sec[level] - gmtoff);
+			if (resume_bucket(rollup->data_dir, level, bucket,
+					  degf) == -1)
+				ret = -1;
+		} else if (key != lvl->key) {
+			/* boundary: close current bucket, open the next */
+			if (write_bucket(rollup->data_dir, level, bucket,
+					 rollup->model, degf) == -1)
+				ret = -1;
+			lvl->key = key;
+			bucket_reset(bucket, key * period_sec[level] - gmtoff);
+		}
+
+		if ((bucket->count == 0) || (temp_degc < bucket->temp_min_degc))
+			bucket->temp_min_degc = temp_degc;
+		if ((bucket->count == 0) || (temp_degc > bucket->temp_max_degc))
+			bucket->temp_max_degc = temp_degc;
+		bucket->count++;
+		bucket->temp_sum_degc += temp_degc;
+		bucket->heat_sec += heat;
+		bucket->heat_cycles += cycle;
+		bucket->mode_sec[mode]++;
+	}
+
+	return ret;
+}
+
+int
+rollup_flush(struct rollup_str *rollup, bool degf)
+{
+	int level;
+	int ret = 0;
+
+	for (level = 0; level < ROLLUP_NUM_LEVELS; level++) {
+		struct rollup_level_str *lvl = &rollup->level[level];
+
+		if (!lvl->open)
+			continue;
+		if (write_bucket(rollup->data_dir, level, &lvl->bucket,
+				 rollup->model, degf) == -1)
+			ret = -1;
+		lvl->open = false;
+	}
+
+	return ret;
+}
+
+const char *
+rollup_suffix(enum rollup_level_enum level)
+{
+	return suffix[level];
+}
+
+void
+rollup_merge(struct rollup_bucket_str *dst,
+	     const struct rollup_bucket_str *src)
+{
+	int i;
+
+	if (src->count == 0)
+		return;
+
+	if ((dst->count == 0) || (src->temp_min_degc < dst->temp_min_degc))
+		dst->temp_min_degc = src->temp_min_degc;
+	if ((dst->count == 0) || (src->temp_max_degc > dst->temp_max_degc))
+		dst->temp_max_degc = src->temp_max_degc;
+	dst->count += src->count;
+	dst->temp_sum_degc += src->temp_sum_degc;
+	dst->heat_sec += src->heat_sec;
+	dst->heat_cycles += src->heat_cycles;
+	for (i = 0; i < ROLLUP_NUM_MODES; i++)
+		dst->mode_sec[i] += src->mode_sec[i];
+}
+
+int
+rollup_parse_line(const char *line, struct rollup_bucket_str *bucket)
+{
+	long start;
+	double tmean;
+	int n;
+
+	bucket_reset(bucket, 0);
+	n = sscanf(line, "%ld %*s %lu %lf %lf %lf %lu %lu %lu %lu %lu %lu"
+		   " %lf %lf %lf",
+		   &start, &bucket->count, &bucket->temp_min_degc,
+		   &bucket->temp_max_degc, &tmean, &bucket->heat_sec,
+		   &bucket->heat_cycles,
+		   &bucket->mode_sec[ROLLUP_MODE_SCHED],
+		   &bucket->mode_sec[ROLLUP_MODE_HOLD],
+		   &bucket->mode_sec[ROLLUP_MODE_OVERRIDE],
+		   &bucket->mode_sec[ROLLUP_MODE_ADVANCE],
+		   &bucket->tau_hours, &bucket->gain_per_hour,
+		   &bucket->ambient);
+	/* the model columns are for hour lines only */
+	if (((n != 11) && (n != 14)) || (bucket->count == 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	bucket->start = start;
+	bucket->temp_sum_degc = tmean * bucket->count;
+
+	return 0;
+}
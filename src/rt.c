@@ -0,0 +1,176 @@
+/*
+ * rt module: real-time setup of the control thread
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "rt.h"
+#include "alog.h"
+
+/*
+ * private functions
+ */
+
+/* touch the stack the loop will use, so it is resident */
+static void
+prefault_stack(void)
+{
+	volatile char stack[RT_STACK_PREFAULT];
+	size_t i;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (i = 0; i < sizeof stack; i += page)
+		stack[i] = 0;
+}
+
+/* keep freed heap in the process, then grow and touch it once */
+static void
+prefault_heap(void)
+{
+	char *heap;
+	size_t i;
+	long page = sysconf(_SC_PAGESIZE);
+
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	heap = malloc(RT_HEAP_PREFAULT);
+	if (heap == NULL)
+		return;
+	for (i = 0; i < RT_HEAP_PREFAULT; i += page)
+		heap[i] = 0;
+	free(heap);
+}
+
+/*
+ * public functions
+ */
+
+int
+rt_thread_create(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	int ret;
+
+	ret = pthread_attr_init(&attr);
+	if (ret != 0)
+		return ret;
+
+	ret = pthread_attr_setstacksize(&attr, RT_THREAD_STACK);
+	if (ret == 0)
+		ret = pthread_create(thread, &attr, start, arg);
+
+	pthread_attr_destroy(&attr);
+
+	return ret;
+}
+
+void
+rt_setup(const struct rt_str *rt)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int ret;
+
+	if (rt->mlock) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+			syslog(LOG_WARNING, "mlockall: %s", strerror(errno));
+		} else {
+			prefault_heap();
+			prefault_stack();
+			syslog(LOG_INFO, "memory locked");
+		}
+	}
+
+	if (rt->cpu != -1) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rt->cpu, &cpus);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof cpus,
+					     &cpus);
+		if (ret != 0)
+			syslog(LOG_WARNING, "pin to cpu %d: %s", rt->cpu,
+			       strerror(ret));
+		else
+			syslog(LOG_INFO, "pinned to cpu %d", rt->cpu);
+	}
+
+	if (rt->prio != 0) {
+		memset(&param, 0, sizeof param);
+		param.sched_priority = rt->prio;
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+					    &param);
+		if (ret != 0)
+			syslog(LOG_WARNING, "SCHED_FIFO %d: %s", rt->prio,
+			       strerror(ret));
+		else
+			syslog(LOG_INFO, "SCHED_FIFO priority %d", rt->prio);
+	}
+}
+
+void
+rt_jitter_add(struct rt_jitter_str *jitter, const struct timespec *now)
+{
+	long lat = now->tv_nsec;
+
+	/* woke before the second: negative latency */
+	if (lat >= 500000000L)
+		lat -= 1000000000L;
+
+	if (jitter->ticks == 0) {
+		jitter->min_ns = LONG_MAX;
+		jitter->max_ns = LONG_MIN;
+	}
+	jitter->ticks++;
+	jitter->sum_ns += lat;
+	if (lat < jitter->min_ns)
+		jitter->min_ns = lat;
+	if (lat > jitter->max_ns)
+		jitter->max_ns = lat;
+}
+
+void
+rt_jitter_report(struct rt_jitter_str *jitter)
+{
+	if (jitter->ticks == 0)
+		return;
+
+	ALOG(LOG_INFO, "tick latency over %lu s: min %ld us, mean %lld us,"
+	     " max %ld us", jitter->ticks, jitter->min_ns / 1000,
+	     jitter->sum_ns / (long long)jitter->ticks / 1000,
+	     jitter->max_ns / 1000);
+
+	memset(jitter, 0, sizeof *jitter);
+}
@@ -25,47 +25,74 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "schedule.h"
+#include "util.h"
+#include "alog.h"
 
 #define SEC_PER_DAY (24 * 60 * 60)
 #define SEC_PER_WEEK (7 * SEC_PER_DAY)
 
-/* calculate seconds-of-week, in local time */
-static long
-sse_to_sow(time_t sse)
+/* seconds since the epoch, as the local wall clock reads them */
+static time_t
+sse_to_local(time_t sse)
 {
 	struct tm bdt;		/* broken-down time */
 
 	localtime_r(&sse, &bdt); /* for tm_gmtoff */
 
-	sse -= 3 * SEC_PER_DAY;	/* January 1 1970 was a Thursday */
-	sse += bdt.tm_gmtoff;	/* adjust to local time */
-	return sse % SEC_PER_WEEK;
+	return sse + bdt.tm_gmtoff;
+}
+
+/* calculate seconds-of-week, from local time */
+static long
+local_to_sow(time_t local)
+{
+	/* January 1 1970 was a Thursday */
+	return (local - 3 * SEC_PER_DAY) % SEC_PER_WEEK;
 }
 
 /* find event containing current setpoint, set curr_idx */
 static void
 init_index(long now_sow, struct schedule_str *schedule)
 {
+	const struct profile_str *profile = sched_profile(schedule);
 	size_t i;
 
 	/* find next (upcoming) event */
-	for (i = 0; i < schedule->config.num_events; i++)
-		if (schedule->config.event[i].sow > now_sow)
+	for (i = 0; i < profile->num_events; i++)
+		if (profile->event[i].sow > now_sow)
 			break;
 	/* i is now 0..num_events */
 
 	/* back up one (0 wraps back to last) */
 	if (i == 0)
-		i = schedule->config.num_events - 1;
+		i = profile->num_events - 1;
 	else
 		i--;
 
 	schedule->curr_idx = i;
 }
 
+/* cache when the event after curr_idx fires, for the lookahead */
+static void
+set_next(time_t now_local, struct schedule_str *schedule)
+{
+	const struct profile_str *profile = sched_profile(schedule);
+	size_t next_idx;
+	long until;
+
+	next_idx = (schedule->curr_idx + 1) % profile->num_events;
+	until = profile->event[next_idx].sow
+		- local_to_sow(now_local);
+	if (until <= 0)
+		until += SEC_PER_WEEK;	/* Sunday midnight wrap */
+
+	schedule->next_local = now_local + until;
+}
+
 /*
  * public functions
  */
@@ -73,56 +100,129 @@ init_index(long now_sow, struct schedule_str *schedule)
 double
 sched_get_setpoint(time_t now_sse, struct schedule_str *schedule)
 {
+	const struct profile_str *profile;
+	time_t now_local;	/* current local time */
 	long now_sow;		/* current second-of-week */
 	size_t idx;
 
-	now_sow = sse_to_sow(now_sse);
+	/* a switch with a time limit starts counting now */
+	if (schedule->profile_sec != 0) {
+		schedule->profile_expires = now_sse + schedule->profile_sec;
+		schedule->profile_sec = 0;
+	} else if ((schedule->profile_expires != 0)
+		   && (now_sse >= schedule->profile_expires)) {
+		ALOG(LOG_INFO, "PROFILE: %s expired, back to %s",
+		     sched_profile(schedule)->name, PROFILE_DEFAULT);
+		schedule->active = NULL;
+		schedule->profile_expires = 0;
+		schedule->curr_idx = -1;
+	}
+	profile = sched_profile(schedule);
+
+	now_local = sse_to_local(now_sse);
+	now_sow = local_to_sow(now_local);
 
 	if (schedule->curr_idx == -1) {
 		/* initialize index */
 		init_index(now_sow, schedule);
+		schedule->curr_local = now_local;
+		set_next(now_local, schedule);
+	} else if (now_local <= schedule->curr_local) {
+		/*
+		 * clock stepped back, or DST ended: events up to
+		 * curr_local have fired already and won't again.  a
+		 * large step is a corrected clock, start over from it.
+		 */
+		if (schedule->curr_local - now_local > SCHED_STEP_MAX) {
+			init_index(now_sow, schedule);
+			schedule->curr_local = now_local;
+			set_next(now_local, schedule);
+		}
 	} else {
 		/* update index */
-		long t_0;	/* current time */
-		long t_1;	/* time of upcoming event */
+		long elapsed;	/* since the last check */
+		long until;	/* from the last check to the next event */
 		size_t next_idx;
 
-		t_0 = now_sow;
+		elapsed = MIN(now_local - schedule->curr_local,
+			      (time_t)SEC_PER_WEEK);
 
-		/* t_1 is the time of the upcoming event */
 		next_idx = (schedule->curr_idx + 1)
-			% schedule->config.num_events;
-		t_1 = schedule->config.event[next_idx].sow;
+			% profile->num_events;
+		until = profile->event[next_idx].sow
+			- local_to_sow(schedule->curr_local);
+		if (until <= 0)
+			until += SEC_PER_WEEK;	/* Sunday midnight wrap */
 
 		/*
-		 * There's a chance that t_0, t_1 wrapped back
-		 * at Sunday midnight since the previous schedule
-		 * check. Unwrap these.
+		 * detect event(s): one second in the loop, maybe many
+		 * after a step forward.  land on the one now in force.
 		 */
-		if (t_0 < schedule->curr_sow)
-			t_0 += SEC_PER_WEEK;
-
-		if (t_1 < schedule->curr_sow)
-			t_1 += SEC_PER_WEEK;
-
-		/* detect event: current time >= time of next event */
-		if (t_0 >= t_1) {
-			schedule->curr_idx = next_idx;
+		if (elapsed >= until) {
+			if (elapsed == until)
+				schedule->curr_idx = next_idx;
+			else
+				init_index(now_sow, schedule);
+			set_next(now_local, schedule);
 			/* cancel override, advance modes at event boundary */
 			schedule->override_flag = false;
 			schedule->advance_flag = false;
 		}
-	}
 
-	schedule->curr_sow = now_sow; /* update the current time */
+		schedule->curr_local = now_local; /* update the current time */
+	}
 
 	/* implement override, advance mode */
 	if (schedule->override_flag)
 		return schedule->override_temp_degc;
 	else if (schedule->advance_flag)
-		idx = (schedule->curr_idx + 1) % schedule->config.num_events;
+		idx = (schedule->curr_idx + 1) % profile->num_events;
 	else
 		idx = schedule->curr_idx;
 
-	return schedule->config.event[idx].setpoint_degc;
+	return profile->event[idx].setpoint_degc;
+}
+
+int
+sched_next_event(const struct schedule_str *schedule, long *until,
+		 double *setpoint_degc)
+{
+	const struct profile_str *profile = sched_profile(schedule);
+
+	if (schedule->curr_idx == -1)
+		return -1;
+
+	*until = schedule->next_local - schedule->curr_local;
+	*setpoint_degc = profile->event[(schedule->curr_idx + 1)
+		% profile->num_events].setpoint_degc;
+
+	return 0;
+}
+
+const struct profile_str *
+sched_profile(const struct schedule_str *schedule)
+{
+	return (schedule->active != NULL) ? schedule->active
+		: &schedule->config.profile[0];
+}
+
+int
+sched_set_profile(struct schedule_str *schedule, const char *name,
+		  long sec)
+{
+	size_t i;
+
+	for (i = 0; i < schedule->config.num_profiles; i++)
+		if (strcmp(schedule->config.profile[i].name, name) == 0)
+			break;
+	if (i == schedule->config.num_profiles)
+		return -1;
+
+	/* new events: find the one in force at the next update */
+	schedule->active = (i == 0) ? NULL : &schedule->config.profile[i];
+	schedule->curr_idx = -1;
+	schedule->profile_sec = sec;
+	schedule->profile_expires = 0;
+
+	return 0;
 }
@@ -0,0 +1,632 @@
+/*
+ * temperature sensor backends
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <gpiod.h>
+#include <zlib.h>
+
+#include "sensor.h"
+#include "mcp9808.h"
+#include "alog.h"
+#include "util.h"
+
+#define PGM_NAME program_invocation_short_name
+
+/*
+ * MCP9808 over i2c-dev
+ */
+
+/* enough to open the bus again */
+struct mcp9808_priv_str {
+	char *path;		/* /dev/i2c-N */
+	uint8_t slave_addr;
+	enum mcp9808_res_enum res;
+	bool oneshot;		/* shut down between reads */
+	bool rdwr;		/* adapter takes I2C_RDWR bursts */
+	bool banded;		/* ALERT armed on lo..hi */
+	double lo;
+	double hi;
+};
+
+/* gpio line wired to the sensor's ALERT output */
+struct sensor_alert_str {
+	struct gpiod_chip *chip;
+	struct gpiod_line *line;
+};
+
+/* slave, resolution and mode; after open, or a power cycle */
+static int
+mcp9808_setup(int fd, const struct mcp9808_priv_str *priv)
+{
+	double lo = priv->lo;
+	double hi = priv->hi;
+
+	if ((mcp9808_config(fd, priv->slave_addr) == -1)
+	    || (mcp9808_set_resolution(fd, priv->res) == -1)
+	    || (mcp9808_set_shutdown(fd, priv->oneshot) == -1))
+		return -1;
+
+	if (priv->banded
+	    && ((mcp9808_set_limits(fd, &lo, &hi) == -1)
+		|| (mcp9808_set_alert(fd, true) == -1)))
+		return -1;
+
+	return 0;
+}
+
+/* one-shot: wake, wait out a conversion, read, shut down again */
+static int
+mcp9808_read_burst_op(struct sensor_str *sensor, double *temp_degc, int n)
+{
+	struct mcp9808_priv_str *priv = sensor->priv;
+	int ret;
+	int err;
+	int i;
+
+	if (priv->oneshot && (mcp9808_wake(sensor->fd, priv->res) == -1))
+		return -1;
+
+	if (n == 1) {
+		ret = mcp9808_read_temp(sensor->fd, NULL, temp_degc);
+	} else if (priv->rdwr) {
+		ret = mcp9808_read_burst(sensor->fd, priv->slave_addr,
+					 temp_degc, n);
+	} else {
+		for (i = 0, ret = 0; (i < n) && (ret == 0); i++)
+			ret = mcp9808_read_temp(sensor->fd, NULL,
+						&temp_degc[i]);
+	}
+	err = errno;
+
+	/* back to sleep even if the read failed */
+	if (priv->oneshot && (mcp9808_set_shutdown(sensor->fd, true) == -1))
+		return -1;
+
+	errno = err;
+
+	return ret;
+}
+
+static int
+mcp9808_read(struct sensor_str *sensor, double *temp_degc)
+{
+	double temp;
+
+	return mcp9808_read_burst_op(sensor, (temp_degc != NULL)
+				     ? temp_degc : &temp, 1);
+}
+
+static int
+fd_close(struct sensor_str *sensor)
+{
+	return close(sensor->fd);
+}
+
+/* fresh file descriptor and I2C_SLAVE, the adapter may have been reset */
+static int
+mcp9808_reopen(struct sensor_str *sensor)
+{
+	struct mcp9808_priv_str *priv = sensor->priv;
+	int fd;
+
+	fd = open(priv->path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	if (mcp9808_setup(fd, priv) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	close(sensor->fd);
+	sensor->fd = fd;
+
+	return 0;
+}
+
+static int
+mcp9808_set_band(struct sensor_str *sensor, double *lo_degc, double *hi_degc)
+{
+	struct mcp9808_priv_str *priv = sensor->priv;
+
+	if (mcp9808_set_limits(sensor->fd, lo_degc, hi_degc) == -1)
+		return -1;
+	if (!priv->banded && (mcp9808_set_alert(sensor->fd, true) == -1))
+		return -1;
+
+	priv->banded = true;
+	priv->lo = *lo_degc;
+	priv->hi = *hi_degc;
+
+	return 0;
+}
+
+static int
+mcp9808_close(struct sensor_str *sensor)
+{
+	struct mcp9808_priv_str *priv = sensor->priv;
+
+	free(priv->path);
+	free(priv);
+
+	return fd_close(sensor);
+}
+
+static const struct sensor_ops_str mcp9808_ops = {
+	.name = "mcp9808",
+	.read = mcp9808_read,
+	.close = mcp9808_close,
+	.reopen = mcp9808_reopen,
+	.read_burst = mcp9808_read_burst_op,
+	.set_band = mcp9808_set_band,
+};
+
+int
+sensor_open_mcp9808(struct sensor_str *sensor,
+		    const char *i2c_device, uint8_t slave_addr,
+		    enum mcp9808_res_enum res, bool oneshot)
+{
+	struct mcp9808_priv_str *priv;
+
+	priv = malloc(sizeof *priv);
+	if (priv == NULL) {
+		fprintf(stderr, "%s, malloc: %s\n", PGM_NAME, strerror(errno));
+		return -1;
+	}
+	priv->slave_addr = slave_addr;
+	priv->res = res;
+	priv->oneshot = oneshot;
+	priv->banded = false;
+
+	if (asprintf(&priv->path, "/dev/%s", i2c_device) == -1) {
+		fprintf(stderr,
+			"%s, asprintf(%s): %s\n",
+			PGM_NAME, i2c_device, strerror(errno));
+		free(priv);
+		return -1;
+	}
+
+	sensor->fd = open(priv->path, O_RDWR | O_CLOEXEC);
+	if (sensor->fd == -1) {
+		fprintf(stderr,
+			"%s, open(%s): %s\n",
+			PGM_NAME, priv->path, strerror(errno));
+		goto fail;
+	}
+
+	/* a previous run may have left it shut down */
+	if (mcp9808_setup(sensor->fd, priv) == -1) {
+		fprintf(stderr,
+			"configure MCP9808 (0x%02X): %s\n",
+			slave_addr, strerror(errno));
+		close(sensor->fd);
+		goto fail;
+	}
+
+	/* test communications to MCP9808 */
+	if (mcp9808_read_temp(sensor->fd, NULL, NULL) == -1) {
+		fprintf(stderr, "read temp: %s\n", strerror(errno));
+		close(sensor->fd);
+		goto fail;
+	}
+
+	/* SMBus-only adapters: bursts are separate transfers */
+	priv->rdwr = mcp9808_can_burst(sensor->fd);
+
+	sensor->ops = &mcp9808_ops;
+	sensor->priv = priv;
+	sensor_defaults(sensor);
+
+	return 0;
+
+fail:
+	free(priv->path);
+	free(priv);
+	return -1;
+}
+
+/*
+ * sysfs/hwmon: file holds an integer in millidegrees C
+ */
+
+static int
+hwmon_read(struct sensor_str *sensor, double *temp_degc)
+{
+	char buf[32];
+	ssize_t n;
+	long mdegc;
+	char *endptr;
+
+	/* single syscall per sample, no reopen */
+	n = pread(sensor->fd, buf, sizeof buf - 1, 0);
+	if (n == -1)
+		return -1;
+	buf[n] = '\0';
+
+	mdegc = strtol(buf, &endptr, 10);
+	if ((endptr == buf) || ((*endptr != '\n') && (*endptr != '\0'))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (temp_degc != NULL)
+		*temp_degc = mdegc / 1000.0;
+
+	return 0;
+}
+
+/* the driver may have been rebound: the old descriptor is dead */
+static int
+hwmon_reopen(struct sensor_str *sensor)
+{
+	int fd;
+
+	fd = open(sensor->priv, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	close(sensor->fd);
+	sensor->fd = fd;
+
+	return 0;
+}
+
+static int
+hwmon_close(struct sensor_str *sensor)
+{
+	free(sensor->priv);	/* path */
+
+	return fd_close(sensor);
+}
+
+static const struct sensor_ops_str hwmon_ops = {
+	.name = "hwmon",
+	.read = hwmon_read,
+	.close = hwmon_close,
+	.reopen = hwmon_reopen,
+};
+
+int
+sensor_open_hwmon(struct sensor_str *sensor, const char *path)
+{
+	sensor->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (sensor->fd == -1) {
+		fprintf(stderr,
+			"%s, open(%s): %s\n",
+			PGM_NAME, path, strerror(errno));
+		return -1;
+	}
+
+	sensor->ops = &hwmon_ops;
+	sensor_defaults(sensor);
+
+	if (hwmon_read(sensor, NULL) == -1) {
+		fprintf(stderr, "%s, read(%s): %s\n",
+			PGM_NAME, path, strerror(errno));
+		close(sensor->fd);
+		return -1;
+	}
+
+	sensor->priv = strdup(path);
+	if (sensor->priv == NULL) {
+		fprintf(stderr, "%s, strdup: %s\n", PGM_NAME, strerror(errno));
+		close(sensor->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * replay from dayfile: temperature is the sixth column,
+ * logged in deg F or deg C (auto-detected); plain or gzipped
+ */
+
+static int
+replay_read(struct sensor_str *sensor, double *temp_degc)
+{
+	gzFile infile = sensor->priv;
+	char line[128];
+	double temp;
+
+	for (;;) {
+		if (gzgets(infile, line, sizeof line) == NULL) {
+			errno = ENODATA;	/* end of replay */
+			return -1;
+		}
+
+		if (sscanf(line, "%*u %*d %*d %*d %*s %lf", &temp) == 1)
+			break;
+		/* skip malformed lines */
+	}
+
+	if (temp_degc != NULL)
+		*temp_degc = deg_to_degc_auto(temp);
+
+	return 0;
+}
+
+static int
+replay_close(struct sensor_str *sensor)
+{
+	return (gzclose(sensor->priv) == Z_OK) ? 0 : -1;
+}
+
+static const struct sensor_ops_str replay_ops = {
+	.name = "replay",
+	.read = replay_read,
+	.close = replay_close,
+};
+
+int
+sensor_open_replay(struct sensor_str *sensor, const char *path)
+{
+	gzFile infile;
+
+	infile = gzopen(path, "r");
+	if (infile == NULL) {
+		fprintf(stderr,
+			"%s, gzopen(%s): %s\n",
+			PGM_NAME, path, strerror(errno));
+		return -1;
+	}
+
+	sensor->ops = &replay_ops;
+	sensor->fd = -1;
+	sensor->priv = infile;
+	sensor_defaults(sensor);
+
+	return 0;
+}
+
+/*
+ * any backend
+ */
+
+static void
+sort_doubles(double *x, int n)
+{
+	double v;
+	int i, j;
+
+	/* insertion sort, n is a handful */
+	for (i = 1; i < n; i++) {
+		v = x[i];
+		for (j = i; (j > 0) && (x[j - 1] > v); j--)
+			x[j] = x[j - 1];
+		x[j] = v;
+	}
+}
+
+static double
+median(double *x, int n)
+{
+	sort_doubles(x, n);
+
+	return (n % 2) ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2.0;
+}
+
+/* mean of the samples within the MAD test, returns number rejected */
+static int
+robust_mean(const double *temp, int n, double *mean)
+{
+	double work[SENSOR_BURST_MAX];
+	double med, tol, sum = 0.0;
+	int i, kept = 0;
+
+	memcpy(work, temp, n * sizeof *work);
+	med = median(work, n);
+
+	for (i = 0; i < n; i++)
+		work[i] = fabs(temp[i] - med);
+
+	/* 1.4826 * MAD estimates sigma for normal noise */
+	tol = SENSOR_MAD_K * 1.4826 * median(work, n);
+	if (tol < SENSOR_BURST_TOL)
+		tol = SENSOR_BURST_TOL;
+
+	for (i = 0; i < n; i++) {
+		if (fabs(temp[i] - med) <= tol) {
+			sum += temp[i];
+			kept++;
+		}
+	}
+
+	/* at least half are within MAD of the median */
+	*mean = sum / kept;
+
+	return n - kept;
+}
+
+/* burst samples, reduced to one */
+static int
+sample(struct sensor_str *sensor, double *temp_degc)
+{
+	double temp[SENSOR_BURST_MAX];
+	int i;
+
+	if (sensor->burst <= 1)
+		return sensor_read(sensor, temp_degc);
+
+	if (sensor->ops->read_burst != NULL) {
+		if (sensor->ops->read_burst(sensor, temp, sensor->burst) == -1)
+			return -1;
+	} else {
+		for (i = 0; i < sensor->burst; i++)
+			if (sensor_read(sensor, &temp[i]) == -1)
+				return -1;
+	}
+
+	sensor->samples += sensor->burst;
+	sensor->rejected += robust_mean(temp, sensor->burst, temp_degc);
+
+	return 0;
+}
+
+void
+sensor_defaults(struct sensor_str *sensor)
+{
+	sensor->stale_sec = SENSOR_STALE_SEC;
+	sensor->burst = 1;
+	sensor->alert = NULL;
+	sensor->samples = 0;
+	sensor->rejected = 0;
+}
+
+int
+sensor_read_retry(struct sensor_str *sensor, double *temp_degc)
+{
+	struct timespec delay = { .tv_sec = 0 };
+	long backoff_us = SENSOR_BACKOFF_US;
+	int try;
+	int err;
+
+	for (try = 0; ; try++) {
+		if (sample(sensor, temp_degc) == 0)
+			return 0;
+		err = errno;
+
+		if ((err == ENODATA) || (try == SENSOR_RETRIES))
+			break;
+
+		delay.tv_nsec = backoff_us * 1000;
+		nanosleep(&delay, NULL);
+		backoff_us *= 2;
+
+		/* last chance: start over with a fresh descriptor */
+		if ((try == SENSOR_RETRIES - 1)
+		    && (sensor->ops->reopen != NULL))
+			sensor->ops->reopen(sensor);
+	}
+
+	errno = err;
+
+	return -1;
+}
+
+int
+sensor_alert_open(struct sensor_str *sensor,
+		  const char *gpio_device, unsigned offset)
+{
+	struct sensor_alert_str *alert;
+
+	if (sensor->ops->set_band == NULL) {
+		fprintf(stderr, "%s, %s sensor has no alert output\n",
+			PGM_NAME, sensor->ops->name);
+		return -1;
+	}
+
+	alert = malloc(sizeof *alert);
+	if (alert == NULL) {
+		fprintf(stderr, "%s, malloc: %s\n", PGM_NAME, strerror(errno));
+		return -1;
+	}
+
+	alert->chip = gpiod_chip_open_by_name(gpio_device);
+	if (alert->chip == NULL) {
+		fprintf(stderr,
+			"%s, gpiod open %s: %s\n",
+			PGM_NAME, gpio_device, strerror(errno));
+		free(alert);
+		return -1;
+	}
+
+	/* open drain, asserted low: the falling edge is the crossing */
+	alert->line = gpiod_chip_get_line(alert->chip, offset);
+	if ((alert->line == NULL)
+	    || (gpiod_line_request_falling_edge_events(alert->line,
+						       PGM_NAME) == -1)) {
+		fprintf(stderr,
+			"%s, gpiod alert line(%u): %s\n",
+			PGM_NAME, offset, strerror(errno));
+		gpiod_chip_close(alert->chip);
+		free(alert);
+		return -1;
+	}
+
+	sensor->alert = alert;
+
+	return 0;
+}
+
+int
+sensor_alert_fd(const struct sensor_str *sensor)
+{
+	if (sensor->alert == NULL)
+		return -1;
+
+	return gpiod_line_event_get_fd(sensor->alert->line);
+}
+
+void
+sensor_alert_ack(struct sensor_str *sensor)
+{
+	static const struct timespec zero = { 0, 0 };
+	struct gpiod_line_event event;
+
+	if (sensor->alert == NULL)
+		return;
+
+	while ((gpiod_line_event_wait(sensor->alert->line, &zero) == 1)
+	       && (gpiod_line_event_read(sensor->alert->line, &event) == 0))
+		;
+}
+
+void
+sensor_alert_close(struct sensor_str *sensor)
+{
+	if (sensor->alert == NULL)
+		return;
+
+	gpiod_line_release(sensor->alert->line);
+	gpiod_chip_close(sensor->alert->chip);
+	free(sensor->alert);
+	sensor->alert = NULL;
+}
+
+void
+sensor_report(struct sensor_str *sensor)
+{
+	if (sensor->samples == 0)
+		return;
+
+	ALOG(LOG_INFO, "%s: %lu of %lu burst samples rejected",
+	     sensor->ops->name, sensor->rejected, sensor->samples);
+
+	sensor->samples = 0;
+	sensor->rejected = 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * simulation module: virtual clock, thermal plant and fake relay
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "sim.h"
+
+/*
+ * private functions
+ */
+
+static int
+sim_read(struct sensor_str *sensor, double *temp_degc)
+{
+	const struct sim_str *sim = sensor->priv;
+
+	/* MCP9808 reports sixteenths of a degree */
+	if (temp_degc != NULL)
+		*temp_degc = floor(sim->temp_degc * 16.0) / 16.0;
+
+	return 0;
+}
+
+static int
+sim_set(struct actuator_str *actuator, bool on)
+{
+	struct sim_str *sim = actuator->priv;
+
+	sim->heat_on = on;
+
+	return 0;
+}
+
+static int
+sim_sensor_close(struct sensor_str *sensor)
+{
+	(void)sensor;
+
+	return 0;
+}
+
+static int
+sim_actuator_close(struct actuator_str *actuator)
+{
+	(void)actuator;
+
+	return 0;
+}
+
+static const struct sensor_ops_str sim_sensor_ops = {
+	.name = "sim",
+	.read = sim_read,
+	.close = sim_sensor_close,
+};
+
+static const struct actuator_ops_str sim_actuator_ops = {
+	.name = "sim",
+	.set = sim_set,
+	.close = sim_actuator_close,
+};
+
+/*
+ * public functions
+ */
+
+void
+sim_init(struct sim_str *sim, time_t start, long duration)
+{
+	sim->now.tv_sec = start;
+	sim->now.tv_nsec = 0;
+	sim->end = start + duration;
+	sim->temp_degc = SIM_INITIAL_DEGC;
+	sim->outdoor_degc = SIM_OUTDOOR_DEGC;
+	sim->tau_sec = SIM_TAU_SEC;
+	sim->heat_rise_degc = SIM_HEAT_RISE_DEGC;
+	sim->heat_on = false;
+}
+
+int
+sim_tick(struct sim_str *sim, struct timespec *timestamp)
+{
+	double temp_eq;		/* equilibrium temperature */
+
+	if (sim->now.tv_sec >= sim->end)
+		return -1;
+
+	/*
+	 * dT/dt = (T_out - T) / tau + heat * rise / tau
+	 * exact solution over one second, relay state held constant
+	 */
+	temp_eq = sim->outdoor_degc
+		+ (sim->heat_on ? sim->heat_rise_degc : 0.0);
+	sim->temp_degc = temp_eq
+		+ (sim->temp_degc - temp_eq) * exp(-1.0 / sim->tau_sec);
+
+	sim->now.tv_sec++;
+	*timestamp = sim->now;
+
+	return 0;
+}
+
+int
+sim_sensor_open(struct sensor_str *sensor, struct sim_str *sim)
+{
+	sensor->ops = &sim_sensor_ops;
+	sensor->fd = -1;
+	sensor->priv = sim;
+	sensor_defaults(sensor);
+
+	return 0;
+}
+
+int
+sim_actuator_open(struct actuator_str *actuator, struct sim_str *sim)
+{
+	actuator->ops = &sim_actuator_ops;
+	actuator->state = false;
+	actuator->switch_count = 0;
+	actuator->priv = sim;
+
+	return 0;
+}
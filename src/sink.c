@@ -0,0 +1,586 @@
+/*
+ * sink module: data log outputs
+ *
+ * records are formatted in place in the sink's buffer, one iovec
+ * each, and the batch goes out with a single writev.  nothing is
+ * allocated per record.
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "sink.h"
+#include "dayidx.h"
+#include "util.h"
+#include "alog.h"
+
+/*
+ * formats
+ */
+
+/* text dayfile, the original log_data() layout */
+static int
+format_dat(const struct sink_rec_str *rec, char *buf, size_t len)
+{
+	char date_buf[20];
+	int n;
+
+	if (strftime(date_buf, sizeof date_buf, "%w %Y%m%d%H%M%S",
+		     rec->bdt) == 0)
+		return -1;
+
+	n = snprintf(buf, len,
+		     "%7lu %10ld %9ld %s %7.4f %7.4f %4.1f %d %d %d %d\n",
+		     rec->sequence,
+		     rec->timestamp.tv_sec,
+		     rec->timestamp.tv_nsec,
+		     date_buf,
+		     rec->temp,
+		     rec->temp_avg,
+		     rec->setpoint,
+		     rec->heat,
+		     rec->hold,
+		     rec->override,
+		     rec->advance);
+
+	return ((n < 0) || ((size_t)n >= len)) ? -1 : n;
+}
+
+static int
+format_bin(const struct sink_rec_str *rec, char *buf, size_t len)
+{
+	struct sink_bin_rec_str bin = {
+		.sec = rec->timestamp.tv_sec,
+		.nsec = rec->timestamp.tv_nsec,
+		.sequence = rec->sequence,
+		.temp = rec->temp,
+		.temp_avg = rec->temp_avg,
+		.setpoint = rec->setpoint,
+		.heat = rec->heat,
+		.hold = rec->hold,
+		.override = rec->override,
+		.advance = rec->advance,
+	};
+
+	if (len < sizeof bin)
+		return -1;
+
+	memcpy(buf, &bin, sizeof bin);
+
+	return sizeof bin;
+}
+
+/* InfluxDB line protocol, nanosecond timestamps */
+static int
+format_influx(const struct sink_rec_str *rec, char *buf, size_t len)
+{
+	int n;
+
+	n = snprintf(buf, len,
+		     "bang,units=%c temp=%.4f,temp_avg=%.4f,setpoint=%.1f,"
+		     "heat=%di,hold=%di,override=%di,advance=%di %lld\n",
+		     rec->units,
+		     rec->temp,
+		     rec->temp_avg,
+		     rec->setpoint,
+		     rec->heat,
+		     rec->hold,
+		     rec->override,
+		     rec->advance,
+		     rec->timestamp.tv_sec * 1000000000LL
+		     + rec->timestamp.tv_nsec);
+
+	return ((n < 0) || ((size_t)n >= len)) ? -1 : n;
+}
+
+/* JSON Lines */
+static int
+format_json(const struct sink_rec_str *rec, char *buf, size_t len)
+{
+	char date_buf[24];
+	int n;
+
+	if (strftime(date_buf, sizeof date_buf, "%Y-%m-%dT%H:%M:%S",
+		     rec->bdt) == 0)
+		return -1;
+
+	n = snprintf(buf, len,
+		     "{\"seq\":%lu,\"time\":%ld.%09ld,\"local\":\"%s\","
+		     "\"units\":\"%c\",\"temp\":%.4f,\"temp_avg\":%.4f,"
+		     "\"setpoint\":%.1f,\"heat\":%s,\"hold\":%s,"
+		     "\"override\":%s,\"advance\":%s}\n",
+		     rec->sequence,
+		     rec->timestamp.tv_sec,
+		     rec->timestamp.tv_nsec,
+		     date_buf,
+		     rec->units,
+		     rec->temp,
+		     rec->temp_avg,
+		     rec->setpoint,
+		     rec->heat ? "true" : "false",
+		     rec->hold ? "true" : "false",
+		     rec->override ? "true" : "false",
+		     rec->advance ? "true" : "false");
+
+	return ((n < 0) || ((size_t)n >= len)) ? -1 : n;
+}
+
+static const struct sink_ops_str sink_types[] = {
+	{
+		.name = "dat",
+		.suffix = ".dat",
+		.indexed = true,
+		.format = format_dat,
+	},
+	{
+		.name = "bin",
+		.suffix = ".bin",
+		.indexed = true,
+		.format = format_bin,
+	},
+	{
+		.name = "influx",
+		.suffix = NULL,
+		.indexed = false,
+		.format = format_influx,
+	},
+	{
+		.name = "json",
+		.suffix = NULL,
+		.indexed = false,
+		.format = format_json,
+	},
+};
+
+/*
+ * private functions
+ */
+
+/* writev until done, picking up after short writes */
+static int
+writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		n = writev(fd, iov, iovcnt);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while ((iovcnt > 0) && ((size_t)n >= iov->iov_len)) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* end in buf of pending record i */
+static size_t
+mark_end(const struct sink_str *sink, int i)
+{
+	return (i + 1 < sink->iovcnt) ? sink->mark[i + 1].pos : sink->used;
+}
+
+/*
+ * after a failed write: how much of the batch is in the file, in
+ * whole records.  a torn record is cut off, so the next batch does
+ * not land out of step (bin) or mid-line (text).
+ */
+static size_t
+batch_written(struct sink_str *sink)
+{
+	struct stat statbuf;
+	size_t written, whole = 0;
+	int i;
+
+	if (fstat(sink->fd, &statbuf) == -1)
+		return 0;
+	if (statbuf.st_size <= sink->offset) {
+		sink->offset = statbuf.st_size;
+		return 0;
+	}
+	written = statbuf.st_size - sink->offset;
+
+	for (i = 0; (i < sink->iovcnt) && (mark_end(sink, i) <= written); i++)
+		whole = mark_end(sink, i);
+	if ((whole < written) && (i < sink->iovcnt)
+	    && (ftruncate(sink->fd, sink->offset + whole) == -1))
+		return written;
+
+	return whole;
+}
+
+/*
+ * index the first record of each minute that made it to the file:
+ * written bytes of the batch, all of it unless the write failed
+ */
+static void
+index_batch(struct sink_str *sink, size_t written)
+{
+	int i;
+
+	for (i = 0; i < sink->iovcnt; i++) {
+		if (mark_end(sink, i) > written) {
+			/* lost: mark the minute at its next record */
+			sink->index_key = -1;
+			return;
+		}
+		if ((sink->mark[i].minute != -1)
+		    && (dayidx_mark(sink->data_dir, sink->day_name,
+				    sink->mark[i].minute,
+				    sink->offset + sink->mark[i].pos) == -1))
+			ALOG(LOG_ERR, "dayidx_mark: %s", strerror(errno));
+	}
+}
+
+/* a synced sink's last fdatasync and close run on the iosync thread */
+static void
+close_fd(struct sink_str *sink)
+{
+	if (sink->fd == -1)
+		return;
+
+	if ((sink->sync != SINK_SYNC_NONE) && (sink->iosync != NULL)
+	    && (sink->unsynced != 0))
+		iosync_request(sink->iosync, sink->fd, true);
+	else if (sink->fd != STDOUT_FILENO)
+		close(sink->fd);
+
+	sink->fd = -1;
+	sink->unsynced = 0;
+}
+
+/* switch a daily sink to the file for this record's day */
+static int
+open_day(struct sink_str *sink, const struct tm *bdt)
+{
+	struct stat statbuf;
+	char *path;
+
+	if (sink_flush(sink) == -1)
+		return -1;
+
+	close_fd(sink);
+	sink->index_key = -1;
+
+	if (sink->data_dir == NULL) {
+		sink->fd = STDOUT_FILENO;
+		sink->offset = 0;
+		return 0;
+	}
+
+	if (snprintf(sink->day_name, sizeof sink->day_name, "%04d%02d%02d%s",
+		     bdt->tm_year + 1900, bdt->tm_mon + 1, bdt->tm_mday,
+		     sink->ops->suffix) >= (int)sizeof sink->day_name) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (asprintf(&path, "%s/%s", sink->data_dir, sink->day_name) == -1)
+		return -1;
+
+	sink->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	free(path);
+	if (sink->fd == -1)
+		return -1;
+
+	/* where the next record starts, for the dayfile index */
+	if (fstat(sink->fd, &statbuf) == -1) {
+		close_fd(sink);
+		return -1;
+	}
+	sink->offset = statbuf.st_size;
+
+	return 0;
+}
+
+static int
+rec_flags(const struct sink_rec_str *rec)
+{
+	return rec->heat | (rec->hold << 1) | (rec->override << 2)
+		| (rec->advance << 3);
+}
+
+/*
+ * delta mode: anything control-relevant changed, or keyframe due?
+ * a wall clock step back starts over with a keyframe.
+ */
+static bool
+delta_due(const struct sink_str *sink, const struct sink_rec_str *rec)
+{
+	return (rec->timestamp.tv_sec - sink->last.sec >= sink->keyframe)
+		|| (rec->timestamp.tv_sec < sink->last.sec)
+		|| (fabs(rec->temp - sink->last.temp) > sink->delta)
+		|| (rec->setpoint != sink->last.setpoint)
+		|| (rec_flags(rec) != sink->last.flags);
+}
+
+/* does this record end a group commit? */
+static bool
+sync_due(const struct sink_str *sink, const struct sink_rec_str *rec)
+{
+	switch (sink->sync) {
+	case SINK_SYNC_RECORDS:
+		return sink->unsynced >= sink->sync_every;
+	case SINK_SYNC_SECONDS:
+		return (rec->timestamp.tv_sec - sink->synced_sec
+			>= sink->sync_every)
+			|| (rec->timestamp.tv_sec < sink->synced_sec);
+	case SINK_SYNC_CHANGE:
+		return (rec->setpoint != sink->last.setpoint)
+			|| (rec_flags(rec) != sink->last.flags);
+	default:
+		return false;
+	}
+}
+
+/*
+ * public functions
+ */
+
+int
+sink_init(struct sink_str *sink, const char *spec)
+{
+	size_t len = strcspn(spec, "@:");
+	char *endptr;
+	long val;
+	size_t i;
+
+	memset(sink, 0, sizeof *sink);
+	sink->fd = -1;
+	sink->day_key = -1;
+	sink->index_key = -1;
+	sink->batch = 1;
+
+	for (i = 0; i < ARRAY_SIZE(sink_types); i++)
+		if ((strlen(sink_types[i].name) == len)
+		    && (strncmp(sink_types[i].name, spec, len) == 0))
+			sink->ops = &sink_types[i];
+	if (sink->ops == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	spec += len;
+
+	if (*spec == '@') {
+		val = strtol(spec + 1, &endptr, 10);
+		if ((val <= 0) || (val > 86400)) {
+			errno = EINVAL;
+			return -1;
+		}
+		sink->interval = val;
+		spec = endptr;
+	}
+
+	if (*spec == ':') {
+		/* daily sinks go to data_dir */
+		if (sink->ops->suffix != NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (strcmp(spec + 1, "-") != 0)
+			sink->path = spec + 1;
+		spec += strlen(spec);
+	}
+
+	if (*spec != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+sink_open(struct sink_str *sink)
+{
+	if ((sink->batch < 1) || (sink->batch > SINK_MAX_BATCH)
+	    || ((sink->sync != SINK_SYNC_NONE) && (sink->sync != SINK_SYNC_CHANGE)
+		&& (sink->sync_every < 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* daily files are opened with the first record of the day */
+	if (sink->ops->suffix != NULL)
+		return 0;
+
+	if (sink->path == NULL) {
+		sink->fd = STDOUT_FILENO;
+		return 0;
+	}
+
+	sink->fd = open(sink->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+	return (sink->fd == -1) ? -1 : 0;
+}
+
+int
+sink_put(struct sink_str *sink, const struct sink_rec_str *rec)
+{
+	long day_key = rec->bdt->tm_year * 1000L + rec->bdt->tm_yday;
+	bool sync;
+	int n;
+
+	/* each day starts with a full record */
+	if ((sink->delta != 0.0) && (day_key == sink->day_key)
+	    && !delta_due(sink, rec))
+		return 0;
+
+	if ((sink->ops->suffix != NULL) && (day_key != sink->day_key)) {
+		if (open_day(sink, rec->bdt) == -1)
+			return -1;
+	}
+	if (day_key != sink->day_key)
+		sink->synced_sec = rec->timestamp.tv_sec;
+	sink->day_key = day_key;
+
+	if ((SINK_BUF_SIZE - sink->used < SINK_MAX_REC)
+	    && (sink_flush(sink) == -1))
+		return -1;
+
+	n = sink->ops->format(rec, sink->buf + sink->used,
+			      SINK_BUF_SIZE - sink->used);
+	if (n == -1) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	/* first record of each minute goes in the index, once written */
+	sink->mark[sink->iovcnt].pos = sink->used;
+	sink->mark[sink->iovcnt].minute = -1;
+	if (sink->ops->indexed && (sink->data_dir != NULL)) {
+		long minute_key = (rec->timestamp.tv_sec
+				   + rec->bdt->tm_gmtoff) / 60;
+
+		if (minute_key != sink->index_key) {
+			sink->mark[sink->iovcnt].minute =
+				rec->bdt->tm_hour * 60 + rec->bdt->tm_min;
+			sink->index_key = minute_key;
+		}
+	}
+
+	sink->iov[sink->iovcnt].iov_base = sink->buf + sink->used;
+	sink->iov[sink->iovcnt].iov_len = n;
+	sink->iovcnt++;
+	sink->used += n;
+	sink->unsynced++;
+
+	/* compare with the previous record before it is replaced */
+	sync = sync_due(sink, rec);
+
+	sink->last.sec = rec->timestamp.tv_sec;
+	sink->last.temp = rec->temp;
+	sink->last.setpoint = rec->setpoint;
+	sink->last.flags = rec_flags(rec);
+
+	if (sync)
+		return sink_sync(sink, rec->timestamp.tv_sec);
+
+	if (sink->iovcnt >= sink->batch)
+		return sink_flush(sink);
+
+	return 0;
+}
+
+int
+sink_flush(struct sink_str *sink)
+{
+	size_t written = sink->used;
+	int ret = 0;
+	int err;
+
+	if (sink->iovcnt == 0)
+		return 0;
+
+	/* a failed batch is dropped rather than retried forever */
+	if (sink->fd == -1) {
+		ret = -1;
+		written = 0;
+	} else if (writev_all(sink->fd, sink->iov, sink->iovcnt) == -1) {
+		/* some of it may have landed: find the end of file again */
+		err = errno;
+		ret = -1;
+		written = batch_written(sink);
+		errno = err;
+	}
+
+	index_batch(sink, written);
+	sink->offset += written;
+
+	sink->iovcnt = 0;
+	sink->used = 0;
+
+	return ret;
+}
+
+int
+sink_sync(struct sink_str *sink, time_t now)
+{
+	int ret;
+
+	ret = sink_flush(sink);
+
+	if ((sink->fd != -1) && (sink->unsynced != 0)
+	    && (sink->sync != SINK_SYNC_NONE) && (sink->iosync != NULL))
+		iosync_request(sink->iosync, sink->fd, false);
+	sink->unsynced = 0;
+	sink->synced_sec = now;
+
+	return ret;
+}
+
+int
+sink_close(struct sink_str *sink)
+{
+	int ret;
+
+	ret = sink_flush(sink);
+	close_fd(sink);
+
+	return ret;
+}
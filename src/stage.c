@@ -0,0 +1,486 @@
+/*
+ * stage module: RAM-backed staging of daily sink files
+ *
+ * sinks append to stage_dir as if it were data_dir.  a thread copies
+ * the new bytes of each file to data_dir every sync_sec seconds, at a
+ * day change and at shutdown, then drops closed days from stage_dir.
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "stage.h"
+#include "rt.h"
+#include "sink.h"
+#include "util.h"
+
+/* what the daily sinks and rollups write, and how each is copied */
+static const struct {
+	const char *suffix;
+	bool whole;		/* rewritten in place: copy whole file */
+	size_t rec_size;	/* fixed size records, zero: lines */
+} staged[] = {
+	{ ".dat", false, 0 },
+	{ ".bin", false, sizeof(struct sink_bin_rec_str) },
+	{ ".idx", true, 0 },
+	{ ".min", false, 0 },
+	{ ".hr", false, 0 },
+	{ ".day", false, 0 },
+};
+
+/*
+ * private functions
+ */
+
+/* digits in the date a file is named for: YYYYMMDD.*, YYYY.day, or 0 */
+static int
+date_len(const char *name)
+{
+	int i;
+
+	for (i = 0; isdigit((unsigned char)name[i]); i++)
+		;
+
+	if ((i == 8) && (name[8] == '.'))
+		return 8;
+	if ((i == 4) && (strcmp(name + 4, ".day") == 0))
+		return 4;
+
+	return 0;
+}
+
+static int
+is_day_file(const struct dirent *ent)
+{
+	return date_len(ent->d_name) != 0;
+}
+
+/* <0 for a day (or year) before today's, 0 for the current one */
+static int
+cmp_period(const char *name, const char *today_buf)
+{
+	return strncmp(name, today_buf, date_len(name));
+}
+
+/* index into staged[], or -1 */
+static int
+staged_type(const char *name)
+{
+	size_t len = strlen(name);
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(staged); i++) {
+		size_t slen = strlen(staged[i].suffix);
+
+		if ((len >= slen)
+		    && (strcmp(name + len - slen, staged[i].suffix) == 0))
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+format_date(const struct tm *date, char *buf, size_t len)
+{
+	strftime(buf, len, "%Y%m%d", date);
+}
+
+/* copy [from, to) of src to the end of dst */
+static int
+copy_range(int src, int dst, off_t from, off_t to, char *buf)
+{
+	ssize_t n;
+
+	while (from < to) {
+		n = pread(src, buf, MIN((off_t)STAGE_CHUNK, to - from), from);
+		if (n <= 0)
+			return -1;
+		if (writen(dst, buf, n) == -1)
+			return -1;
+		from += n;
+	}
+
+	return 0;
+}
+
+/* end of the last whole record at or before end */
+static off_t
+record_end(int fd, int type, off_t from, off_t end)
+{
+	char tail[SINK_MAX_REC];
+	ssize_t len, n;
+
+	if (staged[type].rec_size != 0)
+		return from + (end - from) / staged[type].rec_size
+			* staged[type].rec_size;
+
+	/* a sink may be part way through a line */
+	len = MIN((off_t)sizeof tail, end - from);
+	if ((len == 0) || (pread(fd, tail, len, end - len) != len))
+		return from;
+	for (n = len; (n > 0) && (tail[n - 1] != '\n'); n--)
+		;
+	if (n == 0)
+		return from;
+
+	return end - len + n;
+}
+
+/* append what dst is missing, returns 1 if dst is now complete */
+static int
+copy_tail(const char *src_path, const char *dst_path, int type, char *buf)
+{
+	struct stat src_stat, dst_stat;
+	off_t end;
+	int src, dst;
+	int ret = -1;
+
+	src = open(src_path, O_RDONLY);
+	if (src == -1)
+		return -1;
+
+	dst = open(dst_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (dst == -1)
+		goto out_src;
+
+	if ((fstat(src, &src_stat) == -1) || (fstat(dst, &dst_stat) == -1))
+		goto out;
+
+	if (dst_stat.st_size > src_stat.st_size) {
+		/* not ours to append to */
+		syslog(LOG_ERR, "stage: %s is longer than staged copy",
+		       dst_path);
+		goto out;
+	}
+
+	end = record_end(src, type, dst_stat.st_size, src_stat.st_size);
+	if (end > dst_stat.st_size) {
+		if ((copy_range(src, dst, dst_stat.st_size, end, buf) == -1)
+		    || (fdatasync(dst) == -1))
+			goto out;
+	}
+
+	ret = (end == src_stat.st_size);
+out:
+	close(dst);
+out_src:
+	close(src);
+
+	return ret;
+}
+
+/* replace dst with src, if src has changed since (dst keeps its mtime) */
+static int
+copy_whole(const char *src_path, const char *dst_path, char *buf)
+{
+	struct stat src_stat, dst_stat;
+	struct timespec times[2];
+	char *tmp_path;
+	int src, dst;
+	int ret = -1;
+
+	src = open(src_path, O_RDONLY);
+	if (src == -1)
+		return -1;
+
+	if (fstat(src, &src_stat) == -1)
+		goto out_src;
+
+	if ((stat(dst_path, &dst_stat) == 0)
+	    && (src_stat.st_mtim.tv_sec == dst_stat.st_mtim.tv_sec)
+	    && (src_stat.st_mtim.tv_nsec == dst_stat.st_mtim.tv_nsec)) {
+		ret = 1;	/* up to date */
+		goto out_src;
+	}
+
+	if (asprintf(&tmp_path, "%s.tmp", dst_path) == -1)
+		goto out_src;
+
+	dst = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (dst == -1)
+		goto out_tmp;
+
+	times[0] = src_stat.st_atim;
+	times[1] = src_stat.st_mtim;
+	if ((copy_range(src, dst, 0, src_stat.st_size, buf) == -1)
+	    || (futimens(dst, times) == -1) || (fdatasync(dst) == -1)) {
+		close(dst);
+		unlink(tmp_path);
+		goto out_tmp;
+	}
+	close(dst);
+
+	if (rename(tmp_path, dst_path) == -1) {
+		unlink(tmp_path);
+		goto out_tmp;
+	}
+	ret = 1;
+
+out_tmp:
+	free(tmp_path);
+out_src:
+	close(src);
+
+	return ret;
+}
+
+static int
+copy_file(const char *from_dir, const char *to_dir, const char *name,
+	  char *buf)
+{
+	char *src_path, *dst_path;
+	int type = staged_type(name);
+	int ret = -1;
+
+	if (type == -1)
+		return 0;	/* not a sink file, leave it be */
+
+	if (asprintf(&src_path, "%s/%s", from_dir, name) == -1)
+		return -1;
+	if (asprintf(&dst_path, "%s/%s", to_dir, name) == -1) {
+		free(src_path);
+		return -1;
+	}
+
+	if (staged[type].whole)
+		ret = copy_whole(src_path, dst_path, buf);
+	else
+		ret = copy_tail(src_path, dst_path, type, buf);
+	if (ret == -1)
+		syslog(LOG_ERR, "stage: copy %s: %s", src_path,
+		       strerror(errno));
+
+	free(dst_path);
+	free(src_path);
+
+	return ret;
+}
+
+/*
+ * copy stage_dir out to data_dir.  days before today, or every day
+ * with all set, are removed from stage_dir once copied.
+ */
+static void
+do_sync(const struct stage_str *stage, const struct tm *today, bool all)
+{
+	struct dirent **names;
+	char today_buf[16];
+	int n, i;
+
+	format_date(today, today_buf, sizeof today_buf);
+
+	n = scandir(stage->stage_dir, &names, is_day_file, alphasort);
+	if (n == -1) {
+		syslog(LOG_ERR, "stage: scandir %s: %s", stage->stage_dir,
+		       strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *name = names[i]->d_name;
+		char *path;
+
+		if ((copy_file(stage->stage_dir, stage->data_dir, name,
+			       stage->buf) == 1)
+		    && (all || (cmp_period(name, today_buf) < 0))
+		    && (asprintf(&path, "%s/%s", stage->stage_dir,
+				 name) != -1)) {
+			if (unlink(path) == -1)
+				syslog(LOG_ERR, "stage: unlink %s: %s",
+				       path, strerror(errno));
+			free(path);
+		}
+		free(names[i]);
+	}
+	free(names);
+}
+
+/* bring today's files into stage_dir, so appends keep their offsets */
+static int
+prime(const struct stage_str *stage, const struct tm *today)
+{
+	struct dirent **names;
+	struct stat statbuf;
+	char today_buf[16];
+	int n, i;
+	int ret = 0;
+
+	format_date(today, today_buf, sizeof today_buf);
+
+	n = scandir(stage->data_dir, &names, is_day_file, alphasort);
+	if (n == -1)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		const char *name = names[i]->d_name;
+		char *path;
+
+		if ((cmp_period(name, today_buf) == 0)
+		    && (staged_type(name) != -1)
+		    && (asprintf(&path, "%s/%s", stage->stage_dir,
+				 name) != -1)) {
+			/* a staged copy from a crashed run is newer */
+			if ((stat(path, &statbuf) == -1)
+			    && (copy_file(stage->data_dir, stage->stage_dir,
+					  name, stage->buf) == -1))
+				ret = -1;
+			free(path);
+		}
+		free(names[i]);
+	}
+	free(names);
+
+	return ret;
+}
+
+static void *
+stage_thread(void *arg)
+{
+	struct stage_str *stage = arg;
+	struct timespec deadline;
+	struct tm today;
+	bool rolled;
+
+	pthread_mutex_lock(&stage->lock);
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += stage->sync_sec;
+		while (!stage->pending && !stage->stop) {
+			if (pthread_cond_timedwait(&stage->cond, &stage->lock,
+						   &deadline) == ETIMEDOUT)
+				break;
+		}
+
+		rolled = stage->pending;
+		stage->pending = false;
+		today = stage->today;
+		if (stage->stop)
+			break;
+
+		pthread_mutex_unlock(&stage->lock);
+		do_sync(stage, &today, false);
+		/* closed days are whole in data_dir now */
+		if (rolled && (stage->archive != NULL))
+			archive_notify(stage->archive, &today);
+		pthread_mutex_lock(&stage->lock);
+	}
+	pthread_mutex_unlock(&stage->lock);
+
+	do_sync(stage, &today, true);
+	if (rolled && (stage->archive != NULL))
+		archive_notify(stage->archive, &today);
+
+	return NULL;
+}
+
+/*
+ * public functions
+ */
+
+int
+stage_start(struct stage_str *stage, const struct tm *today)
+{
+	int ret;
+
+	stage->pending = false;
+	stage->stop = false;
+	stage->today = *today;
+
+	if (stage->stage_dir == NULL)
+		return 0;
+
+	stage->buf = malloc(STAGE_CHUNK);
+	if (stage->buf == NULL) {
+		stage->stage_dir = NULL;
+		return -1;
+	}
+
+	/* a crash may have left data behind */
+	do_sync(stage, today, false);
+	if (prime(stage, today) == -1) {
+		syslog(LOG_ERR, "stage: %s: %s", stage->data_dir,
+		       strerror(errno));
+		free(stage->buf);
+		stage->stage_dir = NULL;
+		return -1;
+	}
+
+	pthread_mutex_init(&stage->lock, NULL);
+	pthread_cond_init(&stage->cond, NULL);
+
+	ret = rt_thread_create(&stage->thread, stage_thread, stage);
+	if (ret != 0) {
+		syslog(LOG_ERR, "stage pthread_create: %s", strerror(ret));
+		free(stage->buf);
+		stage->stage_dir = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+stage_notify(struct stage_str *stage, const struct tm *today)
+{
+	if (stage->stage_dir == NULL)
+		return;
+
+	pthread_mutex_lock(&stage->lock);
+	stage->today = *today;
+	stage->pending = true;
+	pthread_cond_signal(&stage->cond);
+	pthread_mutex_unlock(&stage->lock);
+}
+
+void
+stage_stop(struct stage_str *stage)
+{
+	if (stage->stage_dir == NULL)
+		return;
+
+	pthread_mutex_lock(&stage->lock);
+	stage->stop = true;
+	pthread_cond_signal(&stage->cond);
+	pthread_mutex_unlock(&stage->lock);
+
+	pthread_join(stage->thread, NULL);
+
+	pthread_mutex_destroy(&stage->lock);
+	pthread_cond_destroy(&stage->cond);
+	free(stage->buf);
+}
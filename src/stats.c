@@ -0,0 +1,1099 @@
+/*
+ * bang-stats: per-day statistics from dayfiles
+ *
+ * dayfiles are mmap'd and parsed in parallel by a pool of threads,
+ * one file at a time per thread.  results are time-weighted, each
+ * record standing for the interval up to the next record.
+ *
+ * with --query, records in a time range are printed instead, starting
+ * from the per-minute index (YYYYMMDD.dat.idx) rather than the file top.
+ * --expand fills in the samples a change-only (delta) log left out,
+ * holding each record until the next.
+ *
+ * --journal reports the transition journal (bang.jnl) instead: each
+ * transition, and the runtime, cycles and mode hours replayed from it.
+ *
+ * --rollup reports the minute, hour or day rollup files bang keeps,
+ * one line per bucket, without reading the dayfiles at all.  hour
+ * lines add the thermal model's fit, hour by hour.
+ *
+ * compressed dayfiles (YYYYMMDD.dat.gz) are read by streaming
+ * decompression in place of the mmap.  binary dayfiles from the bin
+ * sink (YYYYMMDD.bin[.gz]) are read alike, and printed as text.
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "dayfile.h"
+#include "dayidx.h"
+#include "journal.h"
+#include "model.h"
+#include "sink.h"
+#include "util.h"
+
+#define PGM_NAME program_invocation_short_name
+
+#define DFLT_MAX_GAP 3600	/* longer gaps are not counted */
+#define MAX_JOBS 256
+
+struct options_str {
+	unsigned jobs;
+	long max_gap;
+	int query_from;		/* minute of day, -1: no query */
+	int query_to;		/* exclusive */
+	long expand;		/* seconds, zero: print records as logged */
+	const char *journal;	/* NULL: no journal report */
+	const char *model_dir;	/* NULL: no thermal model report */
+	int rollup;		/* enum rollup_level_enum, -1: dayfiles */
+};
+
+struct day_stats_str {
+	const char *path;
+	bool bin;		/* bin sink records */
+	int error;		/* errno, zero if OK */
+	long long date;		/* YYYYMMDD of first record */
+	unsigned long records;
+	unsigned long bad_lines;
+	double covered_sec;
+	double heat_sec;
+	double deg_sec_below;	/* degree-seconds below setpoint */
+	unsigned long cycles;	/* relay off -> on */
+	double temp_min;
+	double temp_max;
+	double temp_wsum;	/* time-weighted temperature sum */
+	struct dayrec_str prev;
+};
+
+struct stream_str {
+	struct day_stats_str *st;
+	bool bin;
+	long max_gap;
+	int from, to;		/* query range */
+	long expand;
+	bool have_prev;
+	struct dayrec_str prev;	/* held until the next record */
+	bool done;		/* past the end of the range */
+};
+
+struct pool_str {
+	struct day_stats_str *stats;
+	size_t num_files;
+	size_t next;		/* next file to claim, atomic */
+	long max_gap;
+};
+
+static const char *const mode_name[ROLLUP_NUM_MODES] = {
+	[ROLLUP_MODE_SCHED] = "sched",
+	[ROLLUP_MODE_HOLD] = "hold",
+	[ROLLUP_MODE_OVERRIDE] = "override",
+	[ROLLUP_MODE_ADVANCE] = "advance",
+};
+
+/*
+ * private functions
+ */
+
+static void
+print_help(void)
+{
+	printf("Usage: %s [OPTION]... FILE|DIR...\n", PGM_NAME);
+	printf("  or:  %s --journal=FILE\n", PGM_NAME);
+	printf("  or:  %s --model=DIR\n", PGM_NAME);
+	printf("  or:  %s --rollup=min|hr|day FILE|DIR...\n", PGM_NAME);
+	printf("Per-day statistics from bang dayfiles"
+	       " (YYYYMMDD.dat[.gz], YYYYMMDD.bin[.gz])\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  -h, --help:\t\tdisplay this message and exit\n");
+	printf("  -j, --jobs=N:\t\tworker threads (default: one per CPU)\n");
+	printf("  -g, --max-gap=SEC:\tignore gaps longer than SEC"
+	       " (default: %d)\n", DFLT_MAX_GAP);
+	printf("  -q, --query=HH:MM-HH:MM:\n");
+	printf("                     \tprint records in range (end"
+	       " exclusive)\n");
+	printf("  -x, --expand=SEC:\tprint a sample every SEC plus each"
+	       " logged\n");
+	printf("                     \trecord, filling in delta logs\n");
+	printf("  -J, --journal=FILE:\treport transitions from journal"
+	       " FILE\n");
+	printf("  -M, --model=DIR:\treport the thermal model bang saved"
+	       " in DIR\n");
+	printf("  -R, --rollup=LEVEL:\treport the min, hr or day rollup"
+	       " files\n");
+	printf("\n");
+	printf("Output columns: date, records, hours covered, duty cycle %%,"
+	       "\ndegree-minutes below setpoint, relay cycles,"
+	       " min, max, mean temp.\n");
+}
+
+/* HH:MM-HH:MM to minutes of day */
+static int
+parse_range(const char *arg, int *from, int *to)
+{
+	int h0, m0, h1, m1;
+	char c;
+
+	if (sscanf(arg, "%d:%d-%d:%d%c", &h0, &m0, &h1, &m1, &c) != 4)
+		return -1;
+
+	if ((h0 < 0) || (h0 > 24) || (m0 < 0) || (m0 >= 60)
+	    || (h1 < 0) || (h1 > 24) || (m1 < 0) || (m1 >= 60))
+		return -1;
+
+	*from = h0 * 60 + m0;
+	*to = h1 * 60 + m1;
+
+	return (*from < *to) ? 0 : -1;
+}
+
+static int
+parse_options(int argc, char *argv[], struct options_str *options)
+{
+	static const struct option longopts[] = {
+		{       .name = "help",
+			.has_arg = no_argument,
+			.flag = NULL,
+			.val = 'h',
+		},
+		{       .name = "jobs",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'j',
+		},
+		{       .name = "max-gap",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'g',
+		},
+		{       .name = "query",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'q',
+		},
+		{       .name = "expand",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'x',
+		},
+		{       .name = "journal",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'J',
+		},
+		{       .name = "model",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'M',
+		},
+		{       .name = "rollup",
+			.has_arg = required_argument,
+			.flag = NULL,
+			.val = 'R',
+		},
+		{ NULL, 0, NULL, 0 }  /* terminate */
+	};
+	static const char *const shortopts = ":hj:g:q:x:J:M:R:";
+	int optc, opti;
+	int level;
+	long long val;
+	char *endptr;
+	long ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	options->jobs = (ncpu > 0) ? MIN(ncpu, MAX_JOBS) : 1;
+	options->max_gap = DFLT_MAX_GAP;
+	options->query_from = options->query_to = -1;
+	options->expand = 0;
+	options->journal = NULL;
+	options->model_dir = NULL;
+	options->rollup = -1;
+
+	for (;;) {
+		optc = getopt_long(argc, argv, shortopts, longopts, &opti);
+		if (optc < 0)
+			break;
+
+		switch (optc) {
+		case 'h':
+			print_help();
+			exit(EXIT_SUCCESS);
+
+		case 'j':
+			val = strtoll(optarg, &endptr, 0);
+			if ((val < 1) || (val > MAX_JOBS) || (*endptr != '\0')) {
+				fprintf(stderr, "%s: jobs %s invalid\n",
+					PGM_NAME, optarg);
+				return -1;
+			}
+			options->jobs = val;
+			break;
+
+		case 'g':
+			val = strtoll(optarg, &endptr, 0);
+			if ((val < 1) || (*endptr != '\0')) {
+				fprintf(stderr, "%s: max gap %s invalid\n",
+					PGM_NAME, optarg);
+				return -1;
+			}
+			options->max_gap = val;
+			break;
+
+		case 'q':
+			if (parse_range(optarg, &options->query_from,
+					&options->query_to) == -1) {
+				fprintf(stderr, "%s: query range %s invalid\n",
+					PGM_NAME, optarg);
+				return -1;
+			}
+			break;
+
+		case 'x':
+			val = strtoll(optarg, &endptr, 0);
+			if ((val < 1) || (val > 86400) || (*endptr != '\0')) {
+				fprintf(stderr, "%s: expand %s invalid\n",
+					PGM_NAME, optarg);
+				return -1;
+			}
+			options->expand = val;
+			break;
+
+		case 'J':
+			options->journal = optarg;
+			break;
+
+		case 'M':
+			options->model_dir = optarg;
+			break;
+
+		case 'R':
+			for (level = 0; level < ROLLUP_NUM_LEVELS; level++)
+				if (strcmp(optarg,
+					   rollup_suffix(level) + 1) == 0)
+					break;
+			if (level == ROLLUP_NUM_LEVELS) {
+				fprintf(stderr, "%s: rollup %s invalid\n",
+					PGM_NAME, optarg);
+				return -1;
+			}
+			options->rollup = level;
+			break;
+
+		case '?':
+			fprintf(stderr, "%s: unrecognized option: %c\n",
+				PGM_NAME, optopt);
+			print_help();
+			return -1;
+
+		case ':':
+			fprintf(stderr, "%s: missing argument: -%c\n",
+				PGM_NAME, optopt);
+			print_help();
+			return -1;
+
+		default:
+			fprintf(stderr,
+				"%s: unexpected return from getopt: %d\n",
+				PGM_NAME, optc);
+			return -1;
+		}
+	}
+
+	/* expand alone: the whole day */
+	if ((options->expand != 0) && (options->query_from == -1)) {
+		options->query_from = 0;
+		options->query_to = 24 * 60;
+	}
+
+	if ((optind == argc) && (options->journal == NULL)
+	    && (options->model_dir == NULL)) {
+		fprintf(stderr, "%s: no files\n", PGM_NAME);
+		print_help();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* accumulate one record, weighted by time to the next */
+static void
+stats_add(struct day_stats_str *st, const struct dayrec_str *rec,
+	  long max_gap)
+{
+	if (st->records == 0) {
+		st->date = rec->datetime / 1000000;
+		st->temp_min = st->temp_max = rec->temp;
+	} else {
+		const struct dayrec_str *prev = &st->prev;
+		double dt;
+
+		dt = (rec->sec - prev->sec)
+			+ (rec->nsec - prev->nsec) * 1e-9;
+		if ((dt > 0.0) && (dt <= max_gap)) {
+			st->covered_sec += dt;
+			st->temp_wsum += prev->temp * dt;
+			if (prev->heat)
+				st->heat_sec += dt;
+			if (prev->temp < prev->setpoint)
+				st->deg_sec_below +=
+					(prev->setpoint - prev->temp) * dt;
+		}
+		if (rec->heat && !prev->heat)
+			st->cycles++;
+		if (rec->temp < st->temp_min)
+			st->temp_min = rec->temp;
+		if (rec->temp > st->temp_max)
+			st->temp_max = rec->temp;
+	}
+
+	st->prev = *rec;
+	st->records++;
+}
+
+static void
+stats_buf(struct day_stats_str *st, const char *buf, size_t len,
+	  long max_gap)
+{
+	const char *pos = buf;
+	const char *end = buf + len;
+	struct dayrec_str rec;
+
+	while (pos < end) {
+		if ((st->bin ? dayfile_parse_bin(&pos, end, &rec)
+		     : dayfile_parse_line(&pos, end, &rec)) == 0)
+			stats_add(st, &rec, max_gap);
+		else
+			st->bad_lines++;
+	}
+}
+
+static bool
+is_gzip_path(const char *path)
+{
+	size_t len = strlen(path);
+
+	return (len > 3) && (strcmp(path + len - 3, ".gz") == 0);
+}
+
+static int
+stats_chunk(const char *buf, size_t len, off_t base, void *arg)
+{
+	struct stream_str *stream = arg;
+
+	(void)base;
+	stats_buf(stream->st, buf, len, stream->max_gap);
+
+	return 0;
+}
+
+static int
+stats_file(struct day_stats_str *st, long max_gap)
+{
+	struct stat statbuf;
+	void *map;
+	int fd;
+
+	if (is_gzip_path(st->path)) {
+		struct stream_str stream = { .st = st, .max_gap = max_gap };
+
+		return dayfile_stream(st->path, 0, st->bin
+				      ? sizeof(struct sink_bin_rec_str) : 0,
+				      stats_chunk, &stream);
+	}
+
+	fd = open(st->path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &statbuf) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	if (statbuf.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+
+	stats_buf(st, map, statbuf.st_size, max_gap);
+
+	munmap(map, statbuf.st_size);
+
+	return 0;
+}
+
+/* local time less UTC, from the record's own date and time */
+static long
+rec_gmtoff(const struct dayrec_str *rec)
+{
+	long long dt = rec->datetime;	/* YYYYMMDDhhmmss */
+	struct tm bdt;
+
+	memset(&bdt, 0, sizeof bdt);
+	bdt.tm_sec = dt % 100;
+	bdt.tm_min = dt / 100 % 100;
+	bdt.tm_hour = dt / 10000 % 100;
+	bdt.tm_mday = dt / 1000000 % 100;
+	bdt.tm_mon = dt / 100000000 % 100 - 1;
+	bdt.tm_year = dt / 10000000000LL - 1900;
+
+	return timegm(&bdt) - rec->sec;
+}
+
+/* print rec as if logged at t, returns 1 once past the end */
+static int
+print_sample(const struct stream_str *q, const struct dayrec_str *rec,
+	     time_t t)
+{
+	struct tm bdt;
+	time_t local;
+	int minute;
+
+	local = t + rec_gmtoff(rec);
+	gmtime_r(&local, &bdt);
+
+	minute = bdt.tm_hour * 60 + bdt.tm_min;
+	if (minute < q->from)
+		return 0;
+	if (minute >= q->to)
+		return 1;
+
+	/* same layout as log_data() */
+	printf("%7lu %10ld %9ld %d %04d%02d%02d%02d%02d%02d"
+	       " %7.4f %7.4f %4.1f %d %d %d %d\n",
+	       rec->sequence + (unsigned long)(t - rec->sec),
+	       (long)t, rec->nsec, bdt.tm_wday,
+	       bdt.tm_year + 1900, bdt.tm_mon + 1, bdt.tm_mday,
+	       bdt.tm_hour, bdt.tm_min, bdt.tm_sec,
+	       rec->temp, rec->temp_avg, rec->setpoint,
+	       rec->heat, rec->hold, rec->override, rec->advance);
+
+	return 0;
+}
+
+/*
+ * hold the previous record on the expand grid up to rec (NULL: end
+ * of data), but not across gaps longer than max_gap
+ */
+static int
+expand_prev(const struct stream_str *q, const struct dayrec_str *rec)
+{
+	const struct dayrec_str *prev = &q->prev;
+	time_t t, last;
+
+	if (!q->have_prev)
+		return 0;
+
+	last = prev->sec;
+	if (rec != NULL)
+		last = MIN(prev->sec + q->max_gap, rec->sec - 1);
+
+	for (t = prev->sec; t <= last; t = (t / q->expand + 1) * q->expand)
+		if (print_sample(q, prev, t) == 1)
+			return 1;
+
+	return 0;
+}
+
+/* print records in [from, to), returns 1 once past the end */
+static int
+query_buf(struct stream_str *q, const char *buf, size_t len)
+{
+	const char *pos = buf;
+	const char *end = buf + len;
+
+	while (pos < end) {
+		const char *line = pos;
+		struct dayrec_str rec;
+		int minute;
+
+		if ((q->bin ? dayfile_parse_bin(&pos, end, &rec)
+		     : dayfile_parse_line(&pos, end, &rec)) == -1)
+			continue;
+
+		if (q->expand != 0) {
+			if (expand_prev(q, &rec) == 1)
+				return 1;
+			q->prev = rec;
+			q->have_prev = true;
+			continue;
+		}
+
+		minute = (rec.datetime / 10000 % 100) * 60
+			+ rec.datetime / 100 % 100;
+		if (minute < q->from)
+			continue;
+		if (minute >= q->to)
+			return 1;
+
+		if (q->bin)
+			print_sample(q, &rec, rec.sec);
+		else
+			fwrite(line, 1, pos - line, stdout);
+	}
+
+	return 0;
+}
+
+static int
+query_chunk(const char *buf, size_t len, off_t base, void *arg)
+{
+	struct stream_str *q = arg;
+
+	(void)base;
+	q->done = (query_buf(q, buf, len) == 1);
+
+	return q->done;
+}
+
+/* print records in [from, to), minutes of day */
+static int
+query_file(const char *path, const struct options_str *options)
+{
+	uint32_t idx[DAYIDX_ENTRIES];
+	struct stat statbuf;
+	const char *map;
+	uint32_t start;
+	int seek_minute = options->query_from;
+	int fd;
+	struct stream_str q = {
+		.bin = dayfile_is_bin(path),
+		.max_gap = options->max_gap,
+		.from = options->query_from,
+		.to = options->query_to,
+		.expand = options->expand,
+		.have_prev = false,
+		.done = false,
+	};
+
+	if (dayidx_load(path, idx) == -1)
+		return -1;
+
+	/* expanding needs the record in force at the start */
+	if ((q.expand != 0) && (seek_minute > 0))
+		seek_minute--;
+
+	if (is_gzip_path(path)) {
+		/* seeking decompresses up to start, but skips the parse */
+		if (dayfile_stream(path, dayidx_seek(idx, seek_minute),
+				   q.bin ? sizeof(struct sink_bin_rec_str) : 0,
+				   query_chunk, &q) == -1)
+			return -1;
+		if ((q.expand != 0) && !q.done)
+			expand_prev(&q, NULL);
+		return 0;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &statbuf) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	if (statbuf.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	/* stale index: fall back to a scan from the top */
+	start = dayidx_seek(idx, seek_minute);
+	if (start >= (uint32_t)statbuf.st_size)
+		start = 0;
+
+	if ((query_buf(&q, map + start, statbuf.st_size - start) == 0)
+	    && (q.expand != 0))
+		expand_prev(&q, NULL);
+
+	munmap((void *)map, statbuf.st_size);
+
+	return 0;
+}
+
+/* each transition, then what they add up to */
+static int
+report_journal(const char *path)
+{
+	struct journal_rec_str *recs;
+	struct journal_summary_str sum;
+	size_t num, i;
+	double span;
+
+	if (journal_read(path, &recs, &num) == -1)
+		return -1;
+
+	printf("#              time     mono_sec type     mode     heat"
+	       " setpoint_degc  arg\n");
+	for (i = 0; i < num; i++) {
+		const struct journal_rec_str *rec = &recs[i];
+		time_t t = rec->realtime_ns / 1000000000LL;
+		struct tm bdt;
+		char buf[24];
+
+		localtime_r(&t, &bdt);
+		strftime(buf, sizeof buf, "%Y-%m-%d %H:%M:%S", &bdt);
+		printf("%s %12.3f %-8s %-8s %4d %13.3f %4d\n",
+		       buf, rec->monotonic_ns * 1e-9,
+		       journal_type_name(rec->type),
+		       (rec->mode < ROLLUP_NUM_MODES)
+		       ? mode_name[rec->mode] : "?",
+		       rec->heat, rec->setpoint_mdegc / 1000.0, rec->arg);
+	}
+
+	journal_replay(recs, num, &sum);
+	free(recs);
+
+	span = (sum.last_ns - sum.first_ns) * 1e-9;
+	printf("# %zu transitions over %.2f hours, %.2f hours covered\n",
+	       num, span / 3600, sum.covered_sec / 3600);
+	printf("# runtime %.2f hours, duty %.2f%%, %lu cycles\n",
+	       sum.heat_sec / 3600,
+	       (sum.covered_sec > 0.0)
+	       ? 100.0 * sum.heat_sec / sum.covered_sec : 0.0,
+	       sum.cycles);
+	printf("# hours: sched %.2f, hold %.2f, override %.2f,"
+	       " advance %.2f\n",
+	       sum.mode_sec[ROLLUP_MODE_SCHED] / 3600,
+	       sum.mode_sec[ROLLUP_MODE_HOLD] / 3600,
+	       sum.mode_sec[ROLLUP_MODE_OVERRIDE] / 3600,
+	       sum.mode_sec[ROLLUP_MODE_ADVANCE] / 3600);
+	printf("# %lu starts, %lu config reloads, %lu schedule events,"
+	       " %lu hold, %lu override, %lu advance, %lu resume,"
+	       " %lu clock steps, %lu sensor faults,"
+	       " %lu profile switches\n",
+	       sum.count[JOURNAL_START], sum.count[JOURNAL_CONFIG],
+	       sum.count[JOURNAL_SCHED_EVENT], sum.count[JOURNAL_HOLD],
+	       sum.count[JOURNAL_OVERRIDE], sum.count[JOURNAL_ADVANCE],
+	       sum.count[JOURNAL_RESUME], sum.count[JOURNAL_CLOCK],
+	       sum.sensor_faults, sum.count[JOURNAL_PROFILE]);
+
+	return 0;
+}
+
+/* the thermal model bang saved in data_dir */
+static int
+report_model(const char *data_dir)
+{
+	struct model_str model;
+
+	if (model_load(&model, data_dir) == -1)
+		return -1;
+
+	printf("# thermal model, %lu samples (%.1f hours)%s\n",
+	       model.samples, model.samples / 3600.0,
+	       model_valid(&model) ? "" : ", not fitted yet");
+	printf("# time constant %.2f hours, loss %.4f /hour\n",
+	       model_tau(&model) / 3600, model_loss(&model) * 3600);
+	printf("# heating gain %.3f deg C/hour, ambient %.2f deg C\n",
+	       model_gain(&model) * 3600, model_ambient(&model));
+
+	return 0;
+}
+
+/* with the model's fit as the bucket closed, if model */
+static void
+print_bucket(const char *label, const struct rollup_bucket_str *bucket,
+	     bool model)
+{
+	printf("%16s %7.2f %6.2f %4lu %7.2f %7.2f %7.2f"
+	       " %6.2f %6.2f %6.2f %6.2f",
+	       label, bucket->count / 3600.0,
+	       100.0 * bucket->heat_sec / bucket->count,
+	       bucket->heat_cycles,
+	       bucket->temp_min_degc, bucket->temp_max_degc,
+	       bucket->temp_sum_degc / bucket->count,
+	       bucket->mode_sec[ROLLUP_MODE_SCHED] / 3600.0,
+	       bucket->mode_sec[ROLLUP_MODE_HOLD] / 3600.0,
+	       bucket->mode_sec[ROLLUP_MODE_OVERRIDE] / 3600.0,
+	       bucket->mode_sec[ROLLUP_MODE_ADVANCE] / 3600.0);
+	if (model)
+		printf(" %6.2f %7.3f %7.2f", bucket->tau_hours,
+		       bucket->gain_per_hour, bucket->ambient);
+	putchar('\n');
+}
+
+/* bucket, labelled with its local start time, and into the total */
+static void
+report_bucket(const struct rollup_bucket_str *bucket, bool model,
+	      struct rollup_bucket_str *total)
+{
+	struct tm bdt;
+	char label[24];
+
+	localtime_r(&bucket->start, &bdt);
+	strftime(label, sizeof label, "%Y-%m-%d %H:%M", &bdt);
+	print_bucket(label, bucket, model);
+	rollup_merge(total, bucket);
+}
+
+/* each bucket in a rollup file, a restart's replaced lines left out */
+static int
+report_rollup(const char *path, enum rollup_level_enum level,
+	      struct rollup_bucket_str *total)
+{
+	bool model = (level == ROLLUP_HOUR);
+	struct rollup_bucket_str bucket, prev;
+	char line[256];
+	unsigned long bad_lines = 0;
+	bool have_prev = false;
+	gzFile in;
+
+	/* zlib reads uncompressed files transparently */
+	in = gzopen(path, "r");
+	if (in == NULL)
+		return -1;
+
+	while (gzgets(in, line, sizeof line) != NULL) {
+		if (rollup_parse_line(line, &bucket) == -1) {
+			bad_lines++;
+			continue;
+		}
+		if (have_prev && (bucket.start != prev.start))
+			report_bucket(&prev, model, total);
+		prev = bucket;
+		have_prev = true;
+	}
+	if (have_prev)
+		report_bucket(&prev, model, total);
+	gzclose(in);
+
+	if (bad_lines != 0)
+		fprintf(stderr, "%s: %s: %lu malformed lines\n",
+			PGM_NAME, path, bad_lines);
+
+	return 0;
+}
+
+static void *
+worker(void *arg)
+{
+	struct pool_str *pool = arg;
+	size_t i;
+
+	for (;;) {
+		i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (i >= pool->num_files)
+			break;
+		if (stats_file(&pool->stats[i], pool->max_gap) == -1)
+			pool->stats[i].error = errno;
+	}
+
+	return NULL;
+}
+
+/* YYYYMMDD.dat, YYYYMMDD.bin, or either gzipped */
+static int
+is_dayfile(const struct dirent *ent)
+{
+	const char *name = ent->d_name;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		if (!isdigit((unsigned char)name[i]))
+			return 0;
+
+	return (strcmp(name + 8, ".dat") == 0)
+		|| (strcmp(name + 8, ".dat.gz") == 0)
+		|| (strcmp(name + 8, ".bin") == 0)
+		|| (strcmp(name + 8, ".bin.gz") == 0);
+}
+
+/* YYYYMMDD.min, YYYYMMDD.hr or YYYY.day, maybe gzipped */
+static int
+is_rollup_file(const char *name, enum rollup_level_enum level)
+{
+	int digits = (level == ROLLUP_DAY) ? 4 : 8;
+	size_t len = strlen(rollup_suffix(level));
+	int i;
+
+	for (i = 0; i < digits; i++)
+		if (!isdigit((unsigned char)name[i]))
+			return 0;
+
+	/* closed days may be gzipped */
+	return (strncmp(name + digits, rollup_suffix(level), len) == 0)
+		&& ((name[digits + len] == '\0')
+		    || (strcmp(name + digits + len, ".gz") == 0));
+}
+
+static int
+is_min_file(const struct dirent *ent)
+{
+	return is_rollup_file(ent->d_name, ROLLUP_MINUTE);
+}
+
+static int
+is_hr_file(const struct dirent *ent)
+{
+	return is_rollup_file(ent->d_name, ROLLUP_HOUR);
+}
+
+static int
+is_day_file(const struct dirent *ent)
+{
+	return is_rollup_file(ent->d_name, ROLLUP_DAY);
+}
+
+/* append path, or the files in it that filter takes if a directory */
+static int
+add_path(const char *path, int (*filter)(const struct dirent *),
+	 char ***paths, size_t *num_paths)
+{
+	struct stat statbuf;
+	struct dirent **names;
+	char **tmp;
+	int n, i;
+
+	if ((stat(path, &statbuf) == 0) && S_ISDIR(statbuf.st_mode)) {
+		n = scandir(path, &names, filter, alphasort);
+		if (n == -1) {
+			fprintf(stderr, "%s: %s: %s\n",
+				PGM_NAME, path, strerror(errno));
+			return -1;
+		}
+		tmp = realloc(*paths, (*num_paths + n) * sizeof *tmp);
+		if (tmp == NULL)
+			return -1;
+		*paths = tmp;
+		for (i = 0; i < n; i++) {
+			if (asprintf(&(*paths)[(*num_paths)++], "%s/%s",
+				     path, names[i]->d_name) == -1)
+				return -1;
+			free(names[i]);
+		}
+		free(names);
+		return 0;
+	}
+
+	tmp = realloc(*paths, (*num_paths + 1) * sizeof *tmp);
+	if (tmp == NULL)
+		return -1;
+	*paths = tmp;
+	(*paths)[*num_paths] = strdup(path);
+	if ((*paths)[*num_paths] == NULL)
+		return -1;
+	(*num_paths)++;
+
+	return 0;
+}
+
+static void
+print_stats(const char *label, const struct day_stats_str *st)
+{
+	printf("%8s %7lu %6.2f %6.2f %9.1f %4lu %7.2f %7.2f %7.2f\n",
+	       label, st->records,
+	       st->covered_sec / 3600.0,
+	       (st->covered_sec > 0.0)
+	       ? 100.0 * st->heat_sec / st->covered_sec : 0.0,
+	       st->deg_sec_below / 60.0,
+	       st->cycles,
+	       st->temp_min, st->temp_max,
+	       (st->covered_sec > 0.0)
+	       ? st->temp_wsum / st->covered_sec : st->prev.temp);
+}
+
+/* M A I N */
+int
+main(int argc, char *argv[])
+{
+	static int (*const rollup_filter[ROLLUP_NUM_LEVELS])
+		(const struct dirent *) = {
+		is_min_file, is_hr_file, is_day_file
+	};
+	struct options_str options;
+	struct pool_str pool;
+	struct day_stats_str total;
+	pthread_t threads[MAX_JOBS];
+	char **paths = NULL;
+	size_t num_paths = 0;
+	unsigned nthreads;
+	size_t i;
+	int status = EXIT_SUCCESS;
+
+	if (parse_options(argc, argv, &options) == -1)
+		exit(EXIT_FAILURE);
+
+	for (; optind < argc; optind++)
+		if (add_path(argv[optind], (options.rollup == -1)
+			     ? is_dayfile : rollup_filter[options.rollup],
+			     &paths, &num_paths) == -1)
+			exit(EXIT_FAILURE);
+
+	if (options.journal != NULL) {
+		if (report_journal(options.journal) == -1) {
+			fprintf(stderr, "%s: %s: %s\n",
+				PGM_NAME, options.journal, strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		if ((num_paths == 0) && (options.model_dir == NULL))
+			exit(status);
+	}
+
+	if (options.model_dir != NULL) {
+		if (report_model(options.model_dir) == -1) {
+			fprintf(stderr, "%s: %s/%s: %s\n", PGM_NAME,
+				options.model_dir, MODEL_FNAME,
+				strerror(errno));
+			status = EXIT_FAILURE;
+		}
+		if (num_paths == 0)
+			exit(status);
+	}
+
+	if (options.rollup != -1) {
+		struct rollup_bucket_str rtotal;
+
+		memset(&rtotal, 0, sizeof rtotal);
+		printf("#  start (local)   hours   duty cycl    tmin    tmax"
+		       "   tmean   sched   hold overrd advnce%s\n",
+		       (options.rollup == ROLLUP_HOUR)
+		       ? "  tau_h  gain_h ambient" : "");
+		for (i = 0; i < num_paths; i++) {
+			if (report_rollup(paths[i], options.rollup,
+					  &rtotal) == -1) {
+				fprintf(stderr, "%s: %s: %s\n",
+					PGM_NAME, paths[i], strerror(errno));
+				status = EXIT_FAILURE;
+			}
+			free(paths[i]);
+		}
+		free(paths);
+		if (rtotal.count != 0)
+			print_bucket("total", &rtotal, false);
+		exit(status);
+	}
+
+	if (options.query_from != -1) {
+		for (i = 0; i < num_paths; i++) {
+			if (query_file(paths[i], &options) == -1) {
+				fprintf(stderr, "%s: %s: %s\n",
+					PGM_NAME, paths[i], strerror(errno));
+				status = EXIT_FAILURE;
+			}
+			free(paths[i]);
+		}
+		free(paths);
+		exit(status);
+	}
+
+	pool.stats = calloc(num_paths ? num_paths : 1, sizeof *pool.stats);
+	if (pool.stats == NULL) {
+		fprintf(stderr, "%s: calloc: %s\n", PGM_NAME, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < num_paths; i++) {
+		pool.stats[i].path = paths[i];
+		pool.stats[i].bin = dayfile_is_bin(paths[i]);
+	}
+	pool.num_files = num_paths;
+	pool.next = 0;
+	pool.max_gap = options.max_gap;
+
+	nthreads = MIN(options.jobs, num_paths);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &pool) != 0) {
+			nthreads = i;
+			break;
+		}
+	}
+	/* main thread helps, and covers pthread_create failure */
+	worker(&pool);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	/* report in input order */
+	memset(&total, 0, sizeof total);
+	printf("#   date records  hours   duty   deg_min cycl"
+	       "    tmin    tmax   tmean\n");
+	for (i = 0; i < num_paths; i++) {
+		struct day_stats_str *st = &pool.stats[i];
+		char label[24];
+
+		if (st->error != 0) {
+			fprintf(stderr, "%s: %s: %s\n",
+				PGM_NAME, st->path, strerror(st->error));
+			status = EXIT_FAILURE;
+			continue;
+		}
+		if (st->bad_lines != 0)
+			fprintf(stderr, "%s: %s: %lu malformed lines\n",
+				PGM_NAME, st->path, st->bad_lines);
+		if (st->records == 0)
+			continue;
+
+		snprintf(label, sizeof label, "%lld", st->date);
+		print_stats(label, st);
+
+		if ((total.records == 0) || (st->temp_min < total.temp_min))
+			total.temp_min = st->temp_min;
+		if ((total.records == 0) || (st->temp_max > total.temp_max))
+			total.temp_max = st->temp_max;
+		total.records += st->records;
+		total.covered_sec += st->covered_sec;
+		total.heat_sec += st->heat_sec;
+		total.deg_sec_below += st->deg_sec_below;
+		total.cycles += st->cycles;
+		total.temp_wsum += st->temp_wsum;
+		total.prev = st->prev;
+	}
+	if (total.records != 0)
+		print_stats("total", &total);
+
+	for (i = 0; i < num_paths; i++)
+		free(paths[i]);
+	free(paths);
+	free(pool.stats);
+
+	exit(status);
+}
@@ -26,20 +26,33 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <gpiod.h>
 #include <syslog.h>
 #include <errno.h>
 
 #include "thermostat.h"
 #include "util.h"
-#include "mcp9808.h"
+#include "sensor.h"
+#include "actuator.h"
 #include "schedule.h"
 #include "cfgfile.h"
 #include "controls.h"
+#include "sim.h"
+#include "rollup.h"
+#include "dayidx.h"
+#include "archive.h"
+#include "journal.h"
+#include "sink.h"
+#include "stage.h"
+#include "alog.h"
+#include "rt.h"
+#include "tick.h"
+#include "pid.h"
 
 #define N_AVG 60
 
@@ -49,58 +62,175 @@ this program.  If not, see <http://www.gnu.org/licenses/>.
 
 struct state_str {
 	unsigned long sequence;
-	struct timespec timestamp;
+	struct timespec timestamp;	/* wall clock: schedule and logs */
+	struct timespec mono;		/* control timeline */
 	double temp_degc;
+	struct timespec temp_mono;	/* of the last good reading */
+	bool failsafe;		/* reading too old, heat held off */
+	struct cycle_str *cycle;	/* relay protection */
+	enum ctrl_mode_enum mode;	/* follows the config file */
+	struct pid_str pid;
+	struct model_str *model;	/* fitted each second */
+	struct iosync_str *iosync;	/* syncs the journal, NULL: none */
+	time_t preheat_local;	/* event being preheated for, 0: none */
+	const struct profile_str *profile;	/* last journaled */
 	double temp_arr[N_AVG];
 	double temp_sum;
 	double temp_avg;
 	bool heat_req;
 	double setpoint_degc;
+	double band_degc;	/* setpoint the alert band is set for, or NAN */
+	bool band_heat;		/* and relay state */
+	double band_lo;		/* limits the sensor compares with */
+	double band_hi;
+	bool watch;		/* an alert can end the wait for a tick */
+	long day_key;		/* local day of the active dayfile */
+	ssize_t event_idx;	/* schedule event last journaled */
+	struct rt_jitter_str jitter;
 };
 
+/* controls and config before this second's update, for the journal */
+struct snap_str {
+	time_t hold_mtime;
+	time_t override_mtime;
+	time_t advance_mtime;
+	time_t resume_mtime;
+	time_t config_mtime;
+	bool heat_req;
+};
+
+/* set from a signal handler by tstat_stop() */
+static volatile sig_atomic_t stop_requested;
+
 /*
  * private functions
  */
 
+/*
+ * returns 1 at end of simulation, or when asked to stop, 2 if the
+ * sensor alert woke the loop before the second
+ */
 static int
-sync_to_second(struct state_str *state)
+sync_to_second(struct state_str *state, struct tick_str *tick,
+	       struct sim_str *sim)
 {
-	if (wait_for_next_second() == -1) {
-		syslog(LOG_ERR, "wait: %s", strerror(errno));
-		return -1;
+	int ret;
+
+	if (stop_requested)
+		return 1;
+
+	if (sim != NULL) {
+		/* virtual clock, no waiting */
+		if (sim_tick(sim, &state->timestamp) == -1)
+			return 1;
+		/* the virtual clock is monotonic too */
+		state->mono = state->timestamp;
+		state->sequence++;
+		return 0;
 	}
 
-	if (clock_gettime(CLOCK_REALTIME, &state->timestamp) == -1) {
-		syslog(LOG_ERR, "clock_gettime: %s", strerror(errno));
+	ret = tick_wait(tick);
+	if (ret == -1) {
+		ALOG(LOG_ERR, "wait: %s", strerror(errno));
 		return -1;
 	}
+	if (stop_requested)
+		return 1;
+	if (ret == 1)
+		return 2;
+
+	state->timestamp = tick->wall;
+	state->mono = tick->mono;
+
+	rt_jitter_add(&state->jitter, &state->timestamp);
+	if (state->jitter.ticks >= RT_JITTER_REPORT)
+		rt_jitter_report(&state->jitter);
 
 	state->sequence++;
 
 	return 0;
 }
 
-static int
-get_temperature(struct state_str *state, int mcp9808_fd)
+/*
+ * bang-bang with the comparator watching the band: it wakes the loop
+ * for a crossing, so the tick need not read the sensor every second
+ */
+static bool
+alert_driven(const struct state_str *state)
 {
-	int idx;
+	return state->watch && (state->mode == CTRL_BANG)
+		&& !isnan(state->band_degc);
+}
 
-	/* measure temperature */
-	if (mcp9808_read_temp(mcp9808_fd,
-			      NULL, &state->temp_degc) == -1) {
-		syslog(LOG_ERR, "mcp9808 read temp: %s",
-		       strerror(errno));
-		return -1;
-	}
+/* seconds between the tick's sensor reads */
+static long
+read_interval(const struct state_str *state, const struct sensor_str *sensor)
+{
+	long interval = ALERT_POLL_SEC;
+
+	if (!alert_driven(state))
+		return 1;
+
+	/* a failed read must still have a second try before fail-safe */
+	if (sensor->stale_sec < interval)
+		interval = sensor->stale_sec;
+
+	return (interval < 1) ? 1 : interval;
+}
+
+static void
+update_average(struct state_str *state)
+{
+	int idx;
 
-	/* averaging */
 	idx = state->sequence % ARRAY_SIZE(state->temp_arr);
 	state->temp_sum -= state->temp_arr[idx];
 	state->temp_arr[idx] = state->temp_degc;
 	state->temp_sum += state->temp_degc;
 
 	state->temp_avg = state->temp_sum / ARRAY_SIZE(state->temp_arr);
+}
+
+/*
+ * returns 1 if there is no reading younger than the staleness budget:
+ * temp_degc then holds the last good one
+ */
+static int
+get_temperature(struct state_str *state, struct sensor_str *sensor)
+{
+	long interval = read_interval(state, sensor);
+	double temp;
+	long age;
+
+	/* between alerts, the reading has stayed inside the band */
+	age = state->mono.tv_sec - state->temp_mono.tv_sec;
+	if (alert_driven(state) && (age < interval)) {
+		update_average(state);
+		return 0;
+	}
 
+	/* measure temperature */
+	if (sensor_read_retry(sensor, &temp) == -1) {
+		if (errno == ENODATA) {
+			ALOG(LOG_NOTICE, "%s: end of replay",
+			     sensor->ops->name);
+			return -1;
+		}
+
+		ALOG(LOG_WARNING, "%s read temp: %s, last good %ld s ago",
+		     sensor->ops->name, strerror(errno), age);
+		if (age > sensor->stale_sec)
+			return 1;
+		/* hold the last good value */
+	} else {
+		if (age > interval)
+			ALOG(LOG_NOTICE, "%s recovered after %ld s",
+			     sensor->ops->name, age);
+		state->temp_degc = temp;
+		state->temp_mono = state->mono;
+	}
+
+	update_average(state);
 
 	return 0;
 }
@@ -109,34 +239,55 @@ static int
 update_schedule(struct schedule_str *schedule)
 {
 	struct cfg_data_str cfg_data;
+	char active[PROFILE_NAME_MAX];
+	long profile_sec;
+	time_t profile_expires;
 	time_t mtime;
 	size_t i;
 
 	if (get_mtime(schedule->config.fname, &mtime) == -1) {
-		syslog(LOG_ERR,
-		       "update_sched - get_mtime(%s): %s",
-		       schedule->config.fname, strerror(errno));
+		ALOG(LOG_ERR,
+		     "update_sched - get_mtime(%s): %s",
+		     schedule->config.fname, strerror(errno));
 		return -1;
 	}
 
 	if (mtime <= schedule->config.mtime)
 		return 0;
 
-	syslog(LOG_INFO, "updating schedule");
+	ALOG(LOG_INFO, "updating schedule");
 
 	/* failure leaves schedule unchanged */
 	if (cfg_load(schedule->config.fname, &cfg_data) == -1)
 		return -1;
 
+	/* the profile in force, by name: it may have moved, or gone */
+	strcpy(active, sched_profile(schedule)->name);
+	profile_sec = schedule->profile_sec;
+	profile_expires = schedule->profile_expires;
+
 	/* copy in new events */
 	schedule->config.units = cfg_data.units;
-	schedule->config.num_events = cfg_data.num_events;
-	for (i = 0; i < schedule->config.num_events; i++)
-		schedule->config.event[i] = cfg_data.event[i];
+	schedule->config.num_profiles = cfg_data.num_profiles;
+	for (i = 0; i < schedule->config.num_profiles; i++)
+		schedule->config.profile[i] = cfg_data.profile[i];
+	schedule->config.mode = cfg_data.mode;
+	schedule->config.pid = cfg_data.pid;
+	schedule->config.optimal_start = cfg_data.optimal_start;
+	schedule->config.max_lead = cfg_data.max_lead;
 	schedule->config.mtime = cfg_data.mtime;
 
 	schedule->curr_idx = -1; /* new schedule */
 
+	if (sched_set_profile(schedule, active, 0) == 0) {
+		schedule->profile_sec = profile_sec;
+		schedule->profile_expires = profile_expires;
+	} else {
+		ALOG(LOG_NOTICE, "PROFILE: %s gone, back to %s",
+		     active, PROFILE_DEFAULT);
+		sched_set_profile(schedule, PROFILE_DEFAULT, 0);
+	}
+
 	/* cancel override, advance modes for new schedule */
 	schedule->override_flag = false;
 	schedule->advance_flag = false;
@@ -144,12 +295,52 @@ update_schedule(struct schedule_str *schedule)
 	return 0;
 }
 
+/*
+ * optimal start: move to the next event's setpoint early, by as long
+ * as the model says the heat needs to get there.  once started, stay
+ * with it until the event fires.
+ */
+static void
+preheat(struct state_str *state, const struct schedule_str *schedule)
+{
+	double next_degc, need;
+	long until;
+
+	if (!schedule->config.optimal_start || schedule->override_flag
+	    || schedule->advance_flag || state->failsafe
+	    || (sched_next_event(schedule, &until, &next_degc) == -1)
+	    || (next_degc <= state->setpoint_degc)) {
+		state->preheat_local = 0;
+		return;
+	}
+
+	if (state->preheat_local != schedule->next_local) {
+		/* settled reading, fitted model, within reach */
+		if ((state->sequence < ARRAY_SIZE(state->temp_arr))
+		    || !model_valid(state->model)
+		    || (until > schedule->config.max_lead))
+			return;
+
+		/* INFINITY if it can't get there: as early as allowed */
+		need = model_recovery(state->model, state->temp_avg,
+				      next_degc);
+		if (until > need + SCHED_LEAD_MARGIN)
+			return;
+
+		ALOG(LOG_INFO, "optimal start: %.1f deg C in %ld min,"
+		     " recovery %.0f min", next_degc, until / 60, need / 60);
+		state->preheat_local = schedule->next_local;
+	}
+
+	state->setpoint_degc = next_degc;
+}
+
 static void
 update_sys(struct state_str *state, struct schedule_str *schedule)
 {
 	/* check controls (hold, advance, resume) */
 	if (ctrls_check(schedule) == -1)
-		syslog(LOG_ERR, "controls check failed!");
+		ALOG(LOG_ERR, "controls check failed!");
 
 	if (schedule->hold_flag) {
 		state->setpoint_degc = schedule->hold_temp_degc;
@@ -159,152 +350,606 @@ update_sys(struct state_str *state, struct schedule_str *schedule)
 		 * soldier on if it fails
 		 */
 		if (update_schedule(schedule) == -1)
-			syslog(LOG_ERR, "schedule update failed!");
+			ALOG(LOG_ERR, "schedule update failed!");
 		state->setpoint_degc = sched_get_setpoint(
 			state->timestamp.tv_sec, schedule);
+		preheat(state, schedule);
 	}
 }
 
 static int
-set_heat_request(struct state_str *state, struct gpiod_line *line,
-		       bool req)
+set_heat_request(struct state_str *state, struct actuator_str *actuator,
+		 bool req)
 {
-	if (gpiod_line_set_value(line, req) != 0) {
-		syslog(LOG_ERR, "gpiod line set value: %s",
-		       strerror(errno));
+	if (actuator_set(actuator, req) == -1) {
+		ALOG(LOG_ERR, "%s set value: %s",
+		     actuator->ops->name, strerror(errno));
 		return -1;
 	}
 
+	if (req != state->heat_req)
+		cycle_switched(state->cycle, req, state->mono.tv_sec);
 	state->heat_req = req;
 
 	return 0;
 }
 
+/* log the fit, and keep it for the next run */
+static void
+report_model(const struct model_str *model, const char *data_dir)
+{
+	if (model_valid(model))
+		ALOG(LOG_INFO, "thermal model: tau %.1f h, gain %.2f deg C/h,"
+		     " ambient %.1f deg C, %lu samples",
+		     model_tau(model) / 3600, model_gain(model) * 3600,
+		     model_ambient(model), model->samples);
+	else
+		ALOG(LOG_INFO, "thermal model: not fitted yet, %lu samples",
+		     model->samples);
+
+	if ((data_dir != NULL) && (model_save(model, data_dir) == -1))
+		ALOG(LOG_ERR, "model_save: %s", strerror(errno));
+}
+
+/* shortest pulse worth a relay cycle: at least the cycle limits */
 static int
-control_temp(struct state_str *state, struct gpiod_line *line)
+min_pulse(const struct cycle_str *cycle)
 {
-	/* wait for temperature average to settle */
-	if (state->sequence < ARRAY_SIZE(state->temp_arr))
-		;
-	else if ((!state->heat_req)
-		 && (state->temp_avg < state->setpoint_degc - HYST_DEGC)) {
-		if (set_heat_request(state, line, true) == -1)
-			return -1;
-	} else if ((state->heat_req)
-		   && (state->temp_avg > state->setpoint_degc)) {
-		if (set_heat_request(state, line, false) == -1)
-			return -1;
+	int pulse = PID_MIN_PULSE;
+
+	if (cycle->min_on > pulse)
+		pulse = cycle->min_on;
+	if (cycle->min_off > pulse)
+		pulse = cycle->min_off;
+
+	return pulse;
+}
+
+/* pick up control mode and PID tuning from a (re)loaded config file */
+static void
+update_mode(struct state_str *state, const struct schedule_str *schedule)
+{
+	state->pid.cfg = schedule->config.pid;
+
+	if (schedule->config.mode == state->mode)
+		return;
+
+	ALOG(LOG_NOTICE, "control mode %s",
+	     (schedule->config.mode == CTRL_PID) ? "pid" : "bang");
+	state->mode = schedule->config.mode;
+	pid_init(&state->pid);
+}
+
+/*
+ * on the 60-second average, in either mode.  driven by the alert,
+ * bang-bang decides on what the comparator sees: the reading, against
+ * the limits programmed into the sensor.
+ */
+static int
+control_temp(struct state_str *state, struct actuator_str *actuator)
+{
+	double temp = state->temp_avg;
+	double lo = state->setpoint_degc - HYST_DEGC;
+	double hi = state->setpoint_degc;
+	bool want = state->heat_req;
+
+	if (alert_driven(state)) {
+		temp = state->temp_degc;
+		lo = state->band_lo;
+		hi = state->band_hi;
+	} else if (state->sequence < ARRAY_SIZE(state->temp_arr)) {
+		/* wait for temperature average to settle */
+		return 0;
 	}
 
+	if (state->mode == CTRL_PID)
+		want = pid_control(&state->pid, state->setpoint_degc, temp,
+				   state->mono.tv_sec, min_pulse(state->cycle));
+	else if ((!state->heat_req) && (temp < lo))
+		want = true;
+	else if ((state->heat_req) && (temp > hi))
+		want = false;
+
+	/* minimum on/off times, starts per hour */
+	if (!cycle_allow(state->cycle, state->heat_req, want,
+			 state->mono.tv_sec))
+		return 0;
+
+	if ((want != state->heat_req)
+	    && (set_heat_request(state, actuator, want) == -1))
+		return -1;
+
 	return 0;
 }
 
+/*
+ * open the sensor's alert window on the edge of the hysteresis band
+ * that switches the relay: the bottom with the heat off, the top with
+ * it on.  after the switch the window moves to the other edge,
+ * HYST_DEGC away, so noise at an edge costs one wakeup, not one per
+ * reading.
+ */
+static void
+update_band(struct state_str *state, struct sensor_str *sensor)
+{
+	double lo = -INFINITY;
+	double hi = INFINITY;
+
+	if ((sensor->alert == NULL) || (state->mode != CTRL_BANG))
+		return;
+	if ((state->setpoint_degc == state->band_degc)
+	    && (state->heat_req == state->band_heat))
+		return;
+
+	if (state->heat_req)
+		hi = state->setpoint_degc;
+	else
+		lo = state->setpoint_degc - HYST_DEGC;
+
+	if (sensor_set_band(sensor, &lo, &hi) == -1) {
+		ALOG(LOG_ERR, "%s set alert band: %s",
+		     sensor->ops->name, strerror(errno));
+		state->band_degc = NAN;	/* try again next second */
+		return;
+	}
+
+	state->band_degc = state->setpoint_degc;
+	state->band_heat = state->heat_req;
+	state->band_lo = lo;
+	state->band_hi = hi;
+}
+
+static enum rollup_mode_enum
+current_mode(const struct schedule_str *schedule)
+{
+	return schedule->hold_flag ? ROLLUP_MODE_HOLD
+		: schedule->override_flag ? ROLLUP_MODE_OVERRIDE
+		: schedule->advance_flag ? ROLLUP_MODE_ADVANCE
+		: ROLLUP_MODE_SCHED;
+}
+
+/* fold this second's sample into the rollups */
 static int
-log_data(const struct state_str *state, const struct schedule_str *schedule,
-	 const char *data_dir)
+update_rollup(const struct state_str *state,
+	      const struct schedule_str *schedule,
+	      struct rollup_str *rollup)
 {
-	FILE *out;
-	struct tm bdt;		/* broken down time */
-	char date_buf[20];
-	double temp, temp_avg, setpoint;
+	struct tm bdt;		/* for tm_gmtoff */
 
 	if (localtime_r(&state->timestamp.tv_sec, &bdt) == NULL) {
-		syslog(LOG_ERR, "localtime_r: %s", strerror(errno));
+		ALOG(LOG_ERR, "localtime_r: %s", strerror(errno));
 		return -1;
 	}
 
-	//printf("%ld\n", bdt.tm_gmtoff);
-
-	out = open_dayfile(data_dir, &bdt);
-	if (out == NULL) {
-		syslog(LOG_ERR, "open_dayfile: %s", strerror(errno));
+	if (rollup_add(rollup, state->timestamp.tv_sec, bdt.tm_gmtoff,
+		       state->temp_degc, state->heat_req,
+		       current_mode(schedule),
+		       schedule->config.units == UNITS_DEGF) == -1) {
+		ALOG(LOG_ERR, "rollup write: %s", strerror(errno));
 		return -1;
 	}
 
-	if (strftime(date_buf, sizeof date_buf, "%w %Y%m%d%H%M%S", &bdt) == 0) {
-		syslog(LOG_ERR, "strftime: buffer overflow");
+	return 0;
+}
+
+static void
+take_snap(struct snap_str *snap, const struct state_str *state,
+	  const struct schedule_str *schedule)
+{
+	snap->hold_mtime = schedule->hold_mtime;
+	snap->override_mtime = schedule->override_mtime;
+	snap->advance_mtime = schedule->advance_mtime;
+	snap->resume_mtime = schedule->resume_mtime;
+	snap->config_mtime = schedule->config.mtime;
+	snap->heat_req = state->heat_req;
+}
+
+/* append one transition, with the state after it */
+static void
+journal_note(const struct state_str *state,
+	     const struct schedule_str *schedule,
+	     struct journal_str *journal,
+	     enum journal_type_enum type, int arg)
+{
+	struct journal_rec_str rec;
+
+	memset(&rec, 0, sizeof rec);
+	rec.realtime_ns = state->timestamp.tv_sec * 1000000000LL
+		+ state->timestamp.tv_nsec;
+	rec.monotonic_ns = state->mono.tv_sec * 1000000000LL
+		+ state->mono.tv_nsec;
+	rec.type = type;
+	rec.mode = current_mode(schedule);
+	rec.heat = state->heat_req;
+	rec.arg = arg;
+	rec.setpoint_mdegc = lround(state->setpoint_degc * 1000.0);
+
+	if (journal_append(journal, &rec) == -1)
+		ALOG(LOG_ERR, "journal_append: %s", strerror(errno));
+	else if ((journal->fd != -1) && (state->iosync != NULL))
+		iosync_request(state->iosync, journal->fd, false);
+}
+
+/* journal whatever changed this second */
+static void
+update_journal(struct state_str *state, const struct schedule_str *schedule,
+	       struct journal_str *journal, const struct snap_str *before)
+{
+	if (schedule->config.mtime != before->config_mtime) {
+		journal_note(state, schedule, journal, JOURNAL_CONFIG,
+			     sched_profile(schedule)->num_events);
+		state->event_idx = -1;	/* indexes are for the old config */
+	}
+
+	if (sched_profile(schedule) != state->profile) {
+		state->profile = sched_profile(schedule);
+		journal_note(state, schedule, journal, JOURNAL_PROFILE,
+			     state->profile - schedule->config.profile);
+		state->event_idx = -1;	/* indexes are for the old profile */
+	}
+
+	if ((schedule->hold_mtime != before->hold_mtime)
+	    && schedule->hold_flag)
+		journal_note(state, schedule, journal, JOURNAL_HOLD, 0);
+	if ((schedule->override_mtime != before->override_mtime)
+	    && schedule->override_flag)
+		journal_note(state, schedule, journal,
+			     JOURNAL_OVERRIDE, 0);
+	if (schedule->advance_mtime != before->advance_mtime)
+		journal_note(state, schedule, journal,
+			     JOURNAL_ADVANCE, 0);
+	if (schedule->resume_mtime != before->resume_mtime)
+		journal_note(state, schedule, journal,
+			     JOURNAL_RESUME, 0);
+
+	if ((schedule->curr_idx != -1)
+	    && (schedule->curr_idx != state->event_idx)) {
+		journal_note(state, schedule, journal,
+			     JOURNAL_SCHED_EVENT, schedule->curr_idx);
+		state->event_idx = schedule->curr_idx;
+	}
+
+	if (state->heat_req != before->heat_req)
+		journal_note(state, schedule, journal,
+			     state->heat_req ? JOURNAL_HEAT_ON
+			     : JOURNAL_HEAT_OFF, 0);
+}
+
+/*
+ * ALERT asserted between ticks: the reading crossed the watched edge
+ * of the band.  read it, and switch now rather than at the next second.
+ */
+static int
+alert_control(struct state_str *state, struct sensor_str *sensor,
+	      struct actuator_str *actuator,
+	      const struct schedule_str *schedule,
+	      struct journal_str *journal)
+{
+	bool heat_req = state->heat_req;
+	double temp;
+
+	sensor_alert_ack(sensor);
+
+	/* time-proportioning runs on the tick alone */
+	if (!alert_driven(state) || state->failsafe
+	    || (sensor_read_retry(sensor, &temp) == -1))
+		return 0;	/* the tick deals with it */
+
+	/* journal the switch when it happened; the next tick restamps */
+	clock_gettime(CLOCK_REALTIME, &state->timestamp);
+	clock_gettime(CLOCK_MONOTONIC, &state->mono);
+
+	state->temp_degc = temp;
+	state->temp_mono = state->mono;
+
+	if (control_temp(state, actuator) == -1)
+		return -1;
+
+	/* watch the other edge, which lets ALERT go */
+	update_band(state, sensor);
+
+	if (state->heat_req != heat_req)
+		journal_note(state, schedule, journal,
+			     state->heat_req ? JOURNAL_HEAT_ON
+			     : JOURNAL_HEAT_OFF, 0);
+
+	return 0;
+}
+
+/* hand this second's record to each sink due one */
+static int
+log_data(struct state_str *state, const struct schedule_str *schedule,
+	 const struct datalog_str *datalog)
+{
+	struct sink_rec_str rec;
+	struct tm bdt;		/* broken down time */
+	long day_key;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < datalog->num_sinks; i++)
+		if (sink_wants(&datalog->sinks[i], state->timestamp.tv_sec))
+			break;
+	if (i == datalog->num_sinks)
+		return 0;
+
+	if (localtime_r(&state->timestamp.tv_sec, &bdt) == NULL) {
+		ALOG(LOG_ERR, "localtime_r: %s", strerror(errno));
 		return -1;
 	}
 
+	rec.sequence = state->sequence;
+	rec.timestamp = state->timestamp;
+	rec.bdt = &bdt;
 	if (schedule->config.units == UNITS_DEGF) {
-		temp = degc_to_degf(state->temp_degc);
-		temp_avg = degc_to_degf(state->temp_avg);
-		setpoint = degc_to_degf(state->setpoint_degc);
+		rec.units = 'F';
+		rec.temp = degc_to_degf(state->temp_degc);
+		rec.temp_avg = degc_to_degf(state->temp_avg);
+		rec.setpoint = degc_to_degf(state->setpoint_degc);
 	} else {
-		temp = state->temp_degc;
-		temp_avg = state->temp_avg;
-		setpoint = state->setpoint_degc;
+		rec.units = 'C';
+		rec.temp = state->temp_degc;
+		rec.temp_avg = state->temp_avg;
+		rec.setpoint = state->setpoint_degc;
+	}
+	rec.heat = state->heat_req;
+	rec.hold = schedule->hold_flag;
+	rec.override = schedule->override_flag;
+	rec.advance = schedule->advance_flag;
+
+	for (; i < datalog->num_sinks; i++) {
+		struct sink_str *sink = &datalog->sinks[i];
+
+		if (!sink_wants(sink, state->timestamp.tv_sec))
+			continue;
+		if (sink_put(sink, &rec) == -1) {
+			ALOG(LOG_ERR, "%s sink: %s",
+			     sink->ops->name, strerror(errno));
+			ret = -1;
+		}
 	}
 
-	fprintf(out, "%7lu %10ld %9ld %s %7.4f %7.4f %4.1f %d %d %d %d\n",
-		state->sequence,
-		state->timestamp.tv_sec,
-		state->timestamp.tv_nsec,
-		date_buf,
-		temp,
-		temp_avg,
-		setpoint,
-		state->heat_req,
-		schedule->hold_flag,
-		schedule->override_flag,
-		schedule->advance_flag);
-
-	if (out != stdout) {
-		if (fclose(out) == EOF) {
-			syslog(LOG_ERR, "fclose: %s", strerror(errno));
-			return -1;
+	/*
+	 * new day: earlier dayfiles are closed, let archive at them.
+	 * staged files are copied out first, and archived after that.
+	 */
+	day_key = bdt.tm_year * 1000L + bdt.tm_yday;
+	if (day_key != state->day_key) {
+		if ((datalog->archive != NULL) || (datalog->stage != NULL)) {
+			for (i = 0; i < datalog->num_sinks; i++)
+				sink_flush(&datalog->sinks[i]);
 		}
+		if (datalog->stage != NULL)
+			stage_notify(datalog->stage, &bdt);
+		else if (datalog->archive != NULL)
+			archive_notify(datalog->archive, &bdt);
+		state->day_key = day_key;
 	}
 
-	return 0;
+	return ret;
 }
 
 /*
  * public functions
  */
 int
-tstat_control(struct gpiod_line *line, int mcp9808_fd,
-	      struct schedule_str *schedule,
-	      const char *data_dir, int data_interval)
+tstat_control(struct sensor_str *sensor, struct actuator_str *actuator,
+	      struct schedule_str *schedule, struct control_str *control,
+	      const struct datalog_str *datalog, struct sim_str *sim)
 {
+	struct rollup_str rollup;
+	struct journal_str journal;
+	struct snap_str snap;
+	struct tick_str tick;
+	const char *site_dir;
+	unsigned long missed = 0;
+	size_t i;
+	int stale;
+	int ret;
+	int status = 0;
+
 	struct state_str state = {
 		.sequence = 0,
 		.temp_sum = 0.0,
 		.setpoint_degc = 0.0,
+		.band_degc = NAN,
+		.day_key = -1,
+		.event_idx = -1,
 	};
 
 	memset(&state.temp_arr, 0, sizeof state.temp_arr);
 
+	state.cycle = &control->cycle;
+	cycle_init(state.cycle);
+	state.iosync = datalog->iosync;
+
+	state.mode = CTRL_BANG;
+	pid_init(&state.pid);
+
+	/*
+	 * the fitted model and the journal belong to the real site: a
+	 * simulation neither starts from nor replaces the one, nor
+	 * appends to the other in simulated time
+	 */
+	site_dir = (sim == NULL) ? datalog->data_dir : NULL;
+
+	/* carry on from the last run's fit */
+	state.model = &control->model;
+	model_init(state.model);
+	if ((site_dir != NULL)
+	    && (model_load(state.model, site_dir) == -1)
+	    && (errno != ENOENT))
+		ALOG(LOG_ERR, "model_load: %s", strerror(errno));
+
+	/* rollups are appended each minute: stage them with the dayfiles */
+	rollup_init(&rollup, (datalog->stage != NULL)
+		    ? datalog->stage->stage_dir : datalog->data_dir,
+		    state.model);
+
 	/* start with heat off */
-	if (set_heat_request(&state, line, false) == -1)
+	if (set_heat_request(&state, actuator, false) == -1)
 		return -1;
 
 	schedule->curr_idx = -1; /* reset schedule */
 
 	/* initialize setpoint */
-	state.setpoint_degc = sched_get_setpoint(time(NULL), schedule);
+	if (sim != NULL) {
+		state.timestamp = state.mono = sim->now;
+	} else {
+		if (tick_open(&tick) == -1) {
+			ALOG(LOG_ERR, "tick_open: %s", strerror(errno));
+			return -1;
+		}
+		state.timestamp = tick.wall;
+		state.mono = tick.mono;
+		tick.wake_fd = sensor_alert_fd(sensor);
+		if ((tick.fd == -1) && (tick.wake_fd != -1)) {
+			ALOG(LOG_WARNING, "%s alert: no timerfd to wait on,"
+			     " reading every second", sensor->ops->name);
+			tick.wake_fd = -1;
+		}
+	}
+	state.temp_mono = state.mono;	/* the sensor answered at open */
+	state.setpoint_degc = sched_get_setpoint(state.timestamp.tv_sec,
+						 schedule);
+	state.profile = sched_profile(schedule);
+
+	/* soldier on without a journal */
+	if (journal_open(&journal, site_dir) == -1)
+		ALOG(LOG_ERR, "journal_open: %s", strerror(errno));
+	else if (journal.torn != 0)
+		ALOG(LOG_WARNING, "journal: dropped %lld bytes of a torn record",
+		     (long long)journal.torn);
+
+	journal_note(&state, schedule, &journal,
+		     JOURNAL_START, JOURNAL_VERSION);
 
 	for (;;) {
 		/* 1 Hertz control loop */
-		if (sync_to_second(&state) == -1)
-			return -1;
+		ret = sync_to_second(&state, &tick, sim);
+		if (ret == -1) {
+			status = -1;
+			break;
+		}
+		if (ret == 2) {
+			if (alert_control(&state, sensor, actuator, schedule,
+					  &journal) == -1) {
+				status = -1;
+				break;
+			}
+			continue;
+		}
+		if (ret == 1)
+			break;	/* end of simulation, or shutdown signal */
+
+		/* tick_wait() stops watching an alert line that fails */
+		state.watch = (sim == NULL) && (tick.wake_fd != -1);
+
+		/* the schedule copes by itself, but say so */
+		if ((sim == NULL) && (tick.step_ns != 0)) {
+			ALOG(LOG_WARNING, "wall clock stepped %+.3f s",
+			     tick.step_ns * 1e-9);
+			journal_note(&state, schedule, &journal,
+				     JOURNAL_CLOCK, lround(tick.step_ns * 1e-9));
+		}
+		if ((sim == NULL) && (tick.missed != missed)) {
+			ALOG(LOG_WARNING, "control loop overran %lu ticks",
+			     tick.missed - missed);
+			missed = tick.missed;
+		}
 
 		/* get new measurement, maintain 60-second average */
-		if (get_temperature(&state, mcp9808_fd) == -1)
-			return -1;
+		stale = get_temperature(&state, sensor);
+		if (stale == -1)
+			break;	/* end of replay */
+		if ((state.sequence % SENSOR_REPORT) == 0)
+			sensor_report(sensor);
+		if ((state.sequence % CYCLE_REPORT) == 0)
+			cycle_report(state.cycle);
+		if ((state.sequence % MODEL_REPORT) == 0)
+			report_model(state.model, site_dir);
 
 		/* perform system updates */
+		take_snap(&snap, &state, schedule);
 		update_sys(&state, schedule);
+		update_mode(&state, schedule);
+
+		/* no trustworthy reading: heat off until there is one */
+		if (stale != state.failsafe) {
+			state.failsafe = stale;
+			pid_init(&state.pid);	/* no winding up blind */
+			model_break(state.model);
+			ALOG(state.failsafe ? LOG_ERR : LOG_NOTICE,
+			     "sensor fail-safe %s", state.failsafe ? "on" : "off");
+			journal_note(&state, schedule, &journal, JOURNAL_SENSOR,
+				     state.failsafe);
+		}
 
-		/* bang-bang controller */
-		if (control_temp(&state, line) == -1)
-			return -1;
+		/*
+		 * fit on this second's reading, with the relay state over
+		 * the second before it (before this second's decision).
+		 * the average would smear a relay switch over a minute.
+		 */
+		if (!state.failsafe)
+			model_update(state.model, state.temp_degc,
+				     state.heat_req, state.mono.tv_sec);
+
+		/* the window the alert watches follows the setpoint */
+		update_band(&state, sensor);
+
+		if (state.failsafe) {
+			if (state.heat_req
+			    && (set_heat_request(&state, actuator, false) == -1)) {
+				status = -1;
+				break;
+			}
+		} else if (control_temp(&state, actuator) == -1) {
+			status = -1;
+			break;
+		}
+
+		/* and the relay */
+		update_band(&state, sensor);
+
+		/* transitions to the journal */
+		update_journal(&state, schedule, &journal, &snap);
+
+		/* minute, hour and day aggregates */
+		update_rollup(&state, schedule, &rollup);
 
 		/* log data (if requested) */
-		if ((data_interval != 0)
-		    && (state.timestamp.tv_sec % data_interval == 0))
-			log_data(&state, schedule, data_dir);
+		log_data(&state, schedule, datalog);
 	}
 
-	return 0;
+	/*
+	 * every way out of the loop: leave the heat off, with nothing
+	 * left to turn it off again, and save what the run collected
+	 */
+	if (set_heat_request(&state, actuator, false) == -1)
+		status = -1;
+	if (rollup_flush(&rollup, schedule->config.units == UNITS_DEGF) == -1)
+		ALOG(LOG_ERR, "rollup write: %s", strerror(errno));
+	journal_note(&state, schedule, &journal, JOURNAL_STOP, 0);
+	if ((journal.fd != -1) && (state.iosync != NULL)) {
+		/* closed after its last sync, on the I/O thread */
+		iosync_request(state.iosync, journal.fd, true);
+		journal.fd = -1;
+	}
+	journal_close(&journal);
+	for (i = 0; i < datalog->num_sinks; i++)
+		sink_flush(&datalog->sinks[i]);
+	rt_jitter_report(&state.jitter);
+	sensor_report(sensor);
+	cycle_report(state.cycle);
+	report_model(state.model, site_dir);
+	if (sim == NULL)
+		tick_close(&tick);
+
+	return status;
+}
+
+void
+tstat_stop(void)
+{
+	stop_requested = 1;
 }
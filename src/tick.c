@@ -0,0 +1,191 @@
+/*
+ * tick module: control loop timing
+ */
+/*
+
+bang: DIY thermostat, designed to run on a Raspberry Pi, or any Linux
+      system with GPIO and an I2C bus.
+Copyright (C) 2019 Todd Allen
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of  MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tick.h"
+#include "util.h"
+#include "alog.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * private functions
+ */
+
+static long long
+ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/* every whole wall clock second from the next one on */
+static int
+arm(int fd)
+{
+	struct itimerspec its;
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) == -1)
+		return -1;
+
+	memset(&its, 0, sizeof its);
+	its.it_value.tv_sec = now.tv_sec + 1;
+	its.it_interval.tv_sec = 1;
+
+	return timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+			       &its, NULL);
+}
+
+static int
+stamp(struct tick_str *tick)
+{
+	struct timespec wall, mono;
+	long long dwall, dmono;
+
+	if ((clock_gettime(CLOCK_REALTIME, &wall) == -1)
+	    || (clock_gettime(CLOCK_MONOTONIC, &mono) == -1))
+		return -1;
+
+	/* with the sleep fallback, a step shows as the clocks parting */
+	if ((tick->fd == -1) && (tick->mono.tv_sec != 0)) {
+		dwall = ts_ns(&wall) - ts_ns(&tick->wall);
+		dmono = ts_ns(&mono) - ts_ns(&tick->mono);
+		if ((dwall - dmono > NSEC_PER_SEC)
+		    || (dwall - dmono < -NSEC_PER_SEC))
+			tick->step_ns = dwall - dmono;
+	}
+
+	tick->wall = wall;
+	tick->mono = mono;
+
+	return 0;
+}
+
+/*
+ * public functions
+ */
+
+int
+tick_open(struct tick_str *tick)
+{
+	memset(tick, 0, sizeof *tick);
+	tick->wake_fd = -1;
+
+	tick->fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+	if ((tick->fd != -1) && (arm(tick->fd) == -1)) {
+		close(tick->fd);
+		tick->fd = -1;
+	}
+	if (tick->fd == -1)
+		syslog(LOG_WARNING, "timerfd: %s, clock steps found late",
+		       strerror(errno));
+
+	return stamp(tick);
+}
+
+int
+tick_wait(struct tick_str *tick)
+{
+	struct pollfd pfd[2];
+	struct tick_str before;
+	uint64_t expired;
+	ssize_t n;
+
+	tick->step_ns = 0;
+
+	/* no early wakeups without the timerfd */
+	if (tick->fd == -1) {
+		if (wait_for_next_second() == -1)
+			return -1;
+		return stamp(tick);
+	}
+
+	pfd[0].fd = tick->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = tick->wake_fd;	/* ignored by poll if -1 */
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		/* a broken wake_fd would end every wait: stop watching it */
+		if (pfd[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			ALOG(LOG_ERR, "tick wake_fd: poll revents %#x,"
+			     " no longer watched", pfd[1].revents);
+			tick->wake_fd = -1;
+			pfd[1].fd = -1;
+			continue;
+		}
+		/* the tick wins a tie, the wakeup is still pending */
+		if (!(pfd[0].revents & POLLIN) && (pfd[1].revents & POLLIN))
+			return 1;
+
+		n = read(tick->fd, &expired, sizeof expired);
+		if (n == sizeof expired)
+			break;
+		if ((n == -1) && (errno == EINTR))
+			continue;
+		if ((n == -1) && (errno == ECANCELED)) {
+			/* the wall clock was set: measure it, realign */
+			before = *tick;
+			if (stamp(tick) == -1)
+				return -1;
+			tick->step_ns =
+				(ts_ns(&tick->wall) - ts_ns(&before.wall))
+				- (ts_ns(&tick->mono) - ts_ns(&before.mono));
+			if (arm(tick->fd) == -1)
+				return -1;
+			continue;
+		}
+		return -1;
+	}
+
+	if (expired > 1)
+		tick->missed += expired - 1;
+
+	return stamp(tick);
+}
+
+void
+tick_close(struct tick_str *tick)
+{
+	if (tick->fd != -1)
+		close(tick->fd);
+	tick->fd = -1;
+}